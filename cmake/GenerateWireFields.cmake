@@ -0,0 +1,41 @@
+# Writes the field numbers of the messages decoded by src/wire_decoder.cc
+# as C++ constants, so the decoder follows Mumble.proto.
+#
+# cmake -DPROTO_FILE=Mumble.proto -DOUTPUT_FILE=mumble_wire_fields.h -P GenerateWireFields.cmake
+
+set (WIRE_MESSAGES UserState Ping)
+
+file (READ ${PROTO_FILE} PROTO_TEXT)
+
+set (HEADER "// Generated from Mumble.proto by cmake/GenerateWireFields.cmake, do not edit\n")
+set (HEADER "${HEADER}#ifndef _LIBMUMBLECLIENT_MUMBLE_WIRE_FIELDS_H_\n")
+set (HEADER "${HEADER}#define _LIBMUMBLECLIENT_MUMBLE_WIRE_FIELDS_H_\n\n")
+set (HEADER "${HEADER}#include \"src/libmumble_stdint.h\"\n\n")
+set (HEADER "${HEADER}namespace MumbleClient {\n\nnamespace wire_fields {\n")
+
+foreach (MESSAGE ${WIRE_MESSAGES})
+    string (REGEX MATCH "message[ \t]+${MESSAGE}[ \t\r\n]*{[^}]*}" BLOCK "${PROTO_TEXT}")
+    if (NOT BLOCK)
+        message (FATAL_ERROR "message ${MESSAGE} not found in ${PROTO_FILE}")
+    endif ()
+
+    set (HEADER "${HEADER}\nnamespace ${MESSAGE} {\n")
+    string (REGEX MATCHALL "(optional|required|repeated)[ \t]+[A-Za-z0-9_.]+[ \t]+[A-Za-z0-9_]+[ \t]*=[ \t]*[0-9]+" FIELDS "${BLOCK}")
+    foreach (FIELD ${FIELDS})
+        string (REGEX REPLACE ".*[ \t]([A-Za-z0-9_]+)[ \t]*=[ \t]*([0-9]+)$" "\\1" NAME "${FIELD}")
+        string (REGEX REPLACE ".*=[ \t]*([0-9]+)$" "\\1" NUMBER "${FIELD}")
+        set (HEADER "${HEADER}const uint32_t ${NAME} = ${NUMBER};\n")
+    endforeach ()
+    set (HEADER "${HEADER}}  // namespace ${MESSAGE}\n")
+endforeach ()
+
+set (HEADER "${HEADER}\n}  // namespace wire_fields\n\n}  // namespace MumbleClient\n\n#endif\n")
+
+# Only touch the file when it changes, so dependants are not rebuilt
+set (OLD_HEADER "")
+if (EXISTS ${OUTPUT_FILE})
+    file (READ ${OUTPUT_FILE} OLD_HEADER)
+endif ()
+if (NOT OLD_HEADER STREQUAL HEADER)
+    file (WRITE ${OUTPUT_FILE} "${HEADER}")
+endif ()
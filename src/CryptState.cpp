@@ -39,7 +39,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "CryptState.h"
 #include "libmumble_stdint.h"
+#include "trace.h"
 
+#include <boost/thread/once.hpp>
 #include <openssl/rand.h>
 #include <string.h>
 #include <cstdio>
@@ -47,12 +49,98 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 namespace MumbleClient {
 
 CryptState::CryptState() {
+    init(selectKernel());
+}
+
+CryptState::CryptState(const crypt_accel::OcbKernel* kernel) {
+    init(kernel);
+}
+
+void CryptState::init(const crypt_accel::OcbKernel* kernel) {
     for (int i = 0; i < 0x100; i++)
         decrypt_history[i] = 0;
 
     bInit = false;
     uiGood = uiLate = uiLost = uiResync = 0;
     uiRemoteGood = uiRemoteLate = uiRemoteLost = uiRemoteResync = 0;
+
+    accel = kernel;
+}
+
+namespace {
+
+// Known answer for the portable OCB-AES128 code: key 00..0f, nonce f0..ff,
+// plain text 00..27.
+const unsigned char kTestCipher[40] = {
+    0x7e, 0x10, 0x67, 0x64, 0xf3, 0x1a, 0x1a, 0xc1, 0x9c, 0x31, 0x39, 0x90, 0xea, 0x1c, 0x41, 0x2b,
+    0xa8, 0x33, 0x3c, 0xc3, 0x40, 0x94, 0x01, 0xba, 0xa2, 0xad, 0x79, 0xdc, 0xe6, 0xc6, 0xce, 0x84,
+    0xf4, 0xbf, 0x6f, 0x15, 0x71, 0x3f, 0xde, 0xfc
+};
+const unsigned char kTestTag[16] = {
+    0x0a, 0x9e, 0x86, 0xf5, 0xf5, 0x39, 0xf5, 0xf1, 0xd7, 0x52, 0x57, 0xce, 0x0a, 0x7c, 0xad, 0xc6
+};
+
+boost::once_flag kernel_once = BOOST_ONCE_INIT;
+const crypt_accel::OcbKernel* selected_kernel = 0;
+
+}  // namespace
+
+// Runs once, whichever thread creates the first CryptState
+void CryptState::detectKernel() {
+    const crypt_accel::OcbKernel* kernel = crypt_accel::DetectOcbKernel();
+    if (kernel && selfTest(kernel))
+        selected_kernel = kernel;
+}
+
+const crypt_accel::OcbKernel* CryptState::selectKernel() {
+    boost::call_once(kernel_once, &CryptState::detectKernel);
+    return selected_kernel;
+}
+
+// Checks a hardware kernel byte for byte against the portable code before it
+// is ever used, over every length up to four blocks.
+bool CryptState::selfTest(const crypt_accel::OcbKernel* kernel) {
+    unsigned char key[AES_BLOCK_SIZE], nonce[AES_BLOCK_SIZE];
+    unsigned char plain[64], reference[64], encrypted[64], decrypted[64];
+    unsigned char reference_tag[AES_BLOCK_SIZE], tag[AES_BLOCK_SIZE];
+
+    for (int i = 0; i < AES_BLOCK_SIZE; i++) {
+        key[i] = static_cast<unsigned char>(i);
+        nonce[i] = static_cast<unsigned char>(0xf0 + i);
+    }
+    for (int i = 0; i < 64; i++)
+        plain[i] = static_cast<unsigned char>(i);
+
+    // Does not go through selectKernel(), which is still running
+    CryptState portable(0);
+    portable.setKey(key, nonce, nonce);
+
+    portable.ocb_encrypt(plain, reference, 40, nonce, reference_tag);
+    if (memcmp(reference, kTestCipher, 40) != 0 || memcmp(reference_tag, kTestTag, AES_BLOCK_SIZE) != 0)
+        return false;
+
+    crypt_accel::RoundKeys keys;
+    kernel->expand_key(key, &keys);
+
+    // Plain AES over several blocks, as used by the batched calls
+    portable.aes_encrypt_blocks(plain, reference, 4);
+    kernel->encrypt_blocks(keys, plain, encrypted, 4);
+    kernel->decrypt_blocks(keys, encrypted, decrypted, 4);
+    if (memcmp(reference, encrypted, 64) != 0 || memcmp(plain, decrypted, 64) != 0)
+        return false;
+
+    for (unsigned int len = 0; len <= 64; len++) {
+        portable.ocb_encrypt(plain, reference, len, nonce, reference_tag);
+        kernel->encrypt(keys, plain, encrypted, len, nonce, tag);
+        if (memcmp(reference, encrypted, len) != 0 || memcmp(reference_tag, tag, AES_BLOCK_SIZE) != 0)
+            return false;
+
+        kernel->decrypt(keys, encrypted, decrypted, len, nonce, tag);
+        if (memcmp(plain, decrypted, len) != 0 || memcmp(reference_tag, tag, AES_BLOCK_SIZE) != 0)
+            return false;
+    }
+
+    return true;
 }
 
 bool CryptState::isValid() const {
@@ -65,6 +153,8 @@ void CryptState::genKey() {
     RAND_bytes(decrypt_iv, AES_BLOCK_SIZE);
     AES_set_encrypt_key(raw_key, 128, &encrypt_key);
     AES_set_decrypt_key(raw_key, 128, &decrypt_key);
+    if (accel)
+        accel->expand_key(raw_key, &accel_keys);
     bInit = true;
 }
 
@@ -74,18 +164,38 @@ void CryptState::setKey(const unsigned char* rkey, const unsigned char* eiv, con
     memcpy(decrypt_iv, div, AES_BLOCK_SIZE);
     AES_set_encrypt_key(raw_key, 128, &encrypt_key);
     AES_set_decrypt_key(raw_key, 128, &decrypt_key);
+    if (accel)
+        accel->expand_key(raw_key, &accel_keys);
     bInit = true;
 }
 
 void CryptState::setDecryptIV(const unsigned char* iv) {
     memcpy(decrypt_iv, iv, AES_BLOCK_SIZE);
+    uiResync++;
+}
+
+void CryptState::setRemoteStats(unsigned int good, unsigned int late, unsigned int lost, unsigned int resync) {
+    uiRemoteGood = good;
+    uiRemoteLate = late;
+    uiRemoteLost = lost;
+    uiRemoteResync = resync;
 }
 
 const unsigned char* CryptState::getEncryptIV() const {
     return encrypt_iv;
 }
 
+const char* CryptState::kernelName() const {
+    return accel ? accel->name : "portable";
+}
+
+void CryptState::usePortable() {
+    accel = 0;
+}
+
 void CryptState::encrypt(const unsigned char* source, unsigned char* dst, unsigned int plain_length) {
+    MC_TRACE_SCOPE("CryptState::encrypt");
+
     unsigned char tag[AES_BLOCK_SIZE];
 
     // First, increase our IV.
@@ -101,21 +211,16 @@ void CryptState::encrypt(const unsigned char* source, unsigned char* dst, unsign
     dst[3] = tag[2];
 }
 
-bool CryptState::decrypt(const unsigned char* source, unsigned char* dst, unsigned int crypted_length) {
+bool CryptState::prepareDecrypt(const unsigned char* source, unsigned int crypted_length, DecryptPlan& plan) {
     if (crypted_length < 4)
         return false;
 
-    unsigned int plain_length = crypted_length - 4;
-
-    unsigned char saveiv[AES_BLOCK_SIZE];
     unsigned char ivbyte = source[0];
-    bool restore = false;
-    unsigned char tag[AES_BLOCK_SIZE];
+    plan.restore = false;
+    plan.lost = 0;
+    plan.late = 0;
 
-    int lost = 0;
-    int late = 0;
-
-    memcpy(saveiv, decrypt_iv, AES_BLOCK_SIZE);
+    memcpy(plan.saveiv, decrypt_iv, AES_BLOCK_SIZE);
 
     if (((decrypt_iv[0] + 1) & 0xFF) == ivbyte) {
         // In order as expected.
@@ -140,26 +245,26 @@ bool CryptState::decrypt(const unsigned char* source, unsigned char* dst, unsign
 
         if ((ivbyte < decrypt_iv[0]) && (diff > -30) && (diff < 0)) {
             // Late packet, but no wraparound.
-            late = 1;
-            lost = -1;
+            plan.late = 1;
+            plan.lost = -1;
             decrypt_iv[0] = ivbyte;
-            restore = true;
+            plan.restore = true;
         } else if ((ivbyte > decrypt_iv[0]) && (diff > -30) && (diff < 0)) {
             // Last was 0x02, here comes 0xff from last round
-            late = 1;
-            lost = -1;
+            plan.late = 1;
+            plan.lost = -1;
             decrypt_iv[0] = ivbyte;
             for (int i = 1; i < AES_BLOCK_SIZE; i++)
                 if (decrypt_iv[i]--)
                     break;
-            restore = true;
+            plan.restore = true;
         } else if ((ivbyte > decrypt_iv[0]) && (diff > 0)) {
             // Lost a few packets, but beyond that we're good.
-            lost = ivbyte - decrypt_iv[0] - 1;
+            plan.lost = ivbyte - decrypt_iv[0] - 1;
             decrypt_iv[0] = ivbyte;
         } else if ((ivbyte < decrypt_iv[0]) && (diff > 0)) {
             // Lost a few packets, and wrapped around
-            lost = 256 - decrypt_iv[0] + ivbyte - 1;
+            plan.lost = 256 - decrypt_iv[0] + ivbyte - 1;
             decrypt_iv[0] = ivbyte;
             for (int i = 1; i < AES_BLOCK_SIZE; i++)
                 if (++decrypt_iv[i])
@@ -169,29 +274,174 @@ bool CryptState::decrypt(const unsigned char* source, unsigned char* dst, unsign
         }
 
         if (decrypt_history[decrypt_iv[0]] == decrypt_iv[1]) {
-            memcpy(decrypt_iv, saveiv, AES_BLOCK_SIZE);
+            memcpy(decrypt_iv, plan.saveiv, AES_BLOCK_SIZE);
             return false;
         }
     }
 
-    ocb_decrypt(source + 4, dst, plain_length, decrypt_iv, tag);
+    return true;
+}
 
-    if (memcmp(tag, source + 1, 3) != 0) {
-        memcpy(decrypt_iv, saveiv, AES_BLOCK_SIZE);
-        return false;
-    }
+void CryptState::acceptDecrypt(const DecryptPlan& plan) {
     decrypt_history[decrypt_iv[0]] = decrypt_iv[1];
 
-    if (restore)
-        memcpy(decrypt_iv, saveiv, AES_BLOCK_SIZE);
+    if (plan.restore)
+        memcpy(decrypt_iv, plan.saveiv, AES_BLOCK_SIZE);
 
     uiGood++;
-    uiLate += late;
-    uiLost += lost;
+    uiLate += plan.late;
+    uiLost += plan.lost;
+}
+
+bool CryptState::decrypt(const unsigned char* source, unsigned char* dst, unsigned int crypted_length) {
+    MC_TRACE_SCOPE("CryptState::decrypt");
+
+    DecryptPlan plan;
+    unsigned char tag[AES_BLOCK_SIZE];
+
+    if (!prepareDecrypt(source, crypted_length, plan))
+        return false;
 
+    ocb_decrypt(source + 4, dst, crypted_length - 4, decrypt_iv, tag);
+
+    if (memcmp(tag, source + 1, 3) != 0) {
+        memcpy(decrypt_iv, plan.saveiv, AES_BLOCK_SIZE);
+        return false;
+    }
+
+    acceptDecrypt(plan);
     return true;
 }
 
+void CryptState::encryptBatch(const unsigned char* const* sources, unsigned char* const* dsts, const unsigned int* plain_lengths, unsigned int count) {
+    MC_TRACE_SCOPE("CryptState::encryptBatch");
+
+    unsigned char nonces[kBatchChunk * AES_BLOCK_SIZE];
+    unsigned char tags[kBatchChunk * AES_BLOCK_SIZE];
+    unsigned char* encrypted[kBatchChunk];
+
+    // Nothing to interleave with, the single packet kernel is faster
+    if (count == 1) {
+        encrypt(sources[0], dsts[0], plain_lengths[0]);
+        return;
+    }
+
+    while (count > 0) {
+        unsigned int n = count < kBatchChunk ? count : kBatchChunk;
+
+        // Every packet takes the next IV, exactly as n calls to encrypt() would
+        for (unsigned int p = 0; p < n; p++) {
+            for (int i = 0; i < AES_BLOCK_SIZE; i++)
+                if (++encrypt_iv[i])
+                    break;
+            memcpy(nonces + p * AES_BLOCK_SIZE, encrypt_iv, AES_BLOCK_SIZE);
+            encrypted[p] = dsts[p] + 4;
+        }
+
+        ocb_encrypt_batch(n, sources, encrypted, plain_lengths, nonces, tags);
+
+        for (unsigned int p = 0; p < n; p++) {
+            dsts[p][0] = nonces[p * AES_BLOCK_SIZE];
+            dsts[p][1] = tags[p * AES_BLOCK_SIZE];
+            dsts[p][2] = tags[p * AES_BLOCK_SIZE + 1];
+            dsts[p][3] = tags[p * AES_BLOCK_SIZE + 2];
+        }
+
+        sources += n;
+        dsts += n;
+        plain_lengths += n;
+        count -= n;
+    }
+}
+
+unsigned int CryptState::decryptBatch(const unsigned char* const* sources, unsigned char* const* dsts, const unsigned int* crypted_lengths, bool* results, unsigned int count) {
+    MC_TRACE_SCOPE("CryptState::decryptBatch");
+
+    unsigned char nonces[kBatchChunk * AES_BLOCK_SIZE];
+    unsigned char tags[kBatchChunk * AES_BLOCK_SIZE];
+    const unsigned char* encrypted[kBatchChunk];
+    unsigned char* plain[kBatchChunk];
+    unsigned int lengths[kBatchChunk];
+    unsigned int index[kBatchChunk];
+    DecryptPlan plans[kBatchChunk];
+
+    unsigned char saved_iv[AES_BLOCK_SIZE];
+    unsigned char saved_history[0x100];
+    unsigned int good = 0;
+    unsigned int start = 0;
+
+    if (count == 1) {
+        results[0] = decrypt(sources[0], dsts[0], crypted_lengths[0]);
+        return results[0] ? 1 : 0;
+    }
+
+    while (start < count) {
+        unsigned int n = count - start < kBatchChunk ? count - start : kBatchChunk;
+
+        memcpy(saved_iv, decrypt_iv, AES_BLOCK_SIZE);
+        memcpy(saved_history, decrypt_history, 0x100);
+        unsigned int saved_good = uiGood, saved_late = uiLate, saved_lost = uiLost;
+
+        // Work out every nonce up front assuming all tags will verify
+        unsigned int m = 0;
+        for (unsigned int p = start; p < start + n; p++) {
+            results[p] = prepareDecrypt(sources[p], crypted_lengths[p], plans[m]);
+            if (!results[p])
+                continue;
+
+            memcpy(nonces + m * AES_BLOCK_SIZE, decrypt_iv, AES_BLOCK_SIZE);
+            encrypted[m] = sources[p] + 4;
+            plain[m] = dsts[p];
+            lengths[m] = crypted_lengths[p] - 4;
+            index[m] = p;
+            acceptDecrypt(plans[m]);
+            m++;
+        }
+
+        ocb_decrypt_batch(m, encrypted, plain, lengths, nonces, tags);
+
+        unsigned int failed = m;
+        for (unsigned int j = 0; j < m; j++) {
+            if (memcmp(tags + j * AES_BLOCK_SIZE, sources[index[j]] + 1, 3) != 0) {
+                failed = j;
+                break;
+            }
+        }
+
+        if (failed == m) {
+            good += m;
+            start += n;
+            continue;
+        }
+
+        // A forged or corrupt packet must not move the IV or history. Rewind
+        // and replay the bookkeeping up to it the way decrypt() would, then
+        // go on with the packets after it.
+        unsigned int bad = index[failed];
+        memcpy(decrypt_iv, saved_iv, AES_BLOCK_SIZE);
+        memcpy(decrypt_history, saved_history, 0x100);
+        uiGood = saved_good;
+        uiLate = saved_late;
+        uiLost = saved_lost;
+
+        for (unsigned int p = start; p < bad; p++) {
+            DecryptPlan plan;
+            if (prepareDecrypt(sources[p], crypted_lengths[p], plan))
+                acceptDecrypt(plan);
+        }
+
+        DecryptPlan plan;
+        if (prepareDecrypt(sources[bad], crypted_lengths[bad], plan))
+            memcpy(decrypt_iv, plan.saveiv, AES_BLOCK_SIZE);
+        results[bad] = false;
+
+        good += failed;
+        start = bad + 1;
+    }
+
+    return good;
+}
+
 namespace {
 
 #if defined(__LP64__)
@@ -260,7 +510,32 @@ void inline ZERO(keyblock &block) {
 #define AESencrypt(src,dst,key) AES_encrypt(reinterpret_cast<const unsigned char *>(src),reinterpret_cast<unsigned char *>(dst), key);
 #define AESdecrypt(src,dst,key) AES_decrypt(reinterpret_cast<const unsigned char *>(src),reinterpret_cast<unsigned char *>(dst), key);
 
+void CryptState::aes_encrypt_blocks(const unsigned char* in, unsigned char* out, unsigned int blocks) {
+    if (accel) {
+        accel->encrypt_blocks(accel_keys, in, out, blocks);
+        return;
+    }
+
+    for (unsigned int i = 0; i < blocks; i++)
+        AES_encrypt(in + i * AES_BLOCK_SIZE, out + i * AES_BLOCK_SIZE, &encrypt_key);
+}
+
+void CryptState::aes_decrypt_blocks(const unsigned char* in, unsigned char* out, unsigned int blocks) {
+    if (accel) {
+        accel->decrypt_blocks(accel_keys, in, out, blocks);
+        return;
+    }
+
+    for (unsigned int i = 0; i < blocks; i++)
+        AES_decrypt(in + i * AES_BLOCK_SIZE, out + i * AES_BLOCK_SIZE, &decrypt_key);
+}
+
 void CryptState::ocb_encrypt(const unsigned char* plain, unsigned char* encrypted, unsigned int len, const unsigned char* nonce, unsigned char* tag) {
+    if (accel) {
+        accel->encrypt(accel_keys, plain, encrypted, len, nonce, tag);
+        return;
+    }
+
     keyblock checksum, delta, tmp, pad;
 
     // Initialize
@@ -270,9 +545,9 @@ void CryptState::ocb_encrypt(const unsigned char* plain, unsigned char* encrypte
     while (len > AES_BLOCK_SIZE) {
         S2(delta);
         XOR(tmp, delta, reinterpret_cast<const subblock *>(plain));
+        XOR(checksum, checksum, reinterpret_cast<const subblock *>(plain));
         AESencrypt(tmp, tmp, &encrypt_key);
         XOR(reinterpret_cast<subblock *>(encrypted), delta, tmp);
-        XOR(checksum, checksum, reinterpret_cast<const subblock *>(plain));
         len -= AES_BLOCK_SIZE;
         plain += AES_BLOCK_SIZE;
         encrypted += AES_BLOCK_SIZE;
@@ -295,6 +570,11 @@ void CryptState::ocb_encrypt(const unsigned char* plain, unsigned char* encrypte
 }
 
 void CryptState::ocb_decrypt(const unsigned char* encrypted, unsigned char* plain, unsigned int len, const unsigned char* nonce, unsigned char* tag) {
+    if (accel) {
+        accel->decrypt(accel_keys, encrypted, plain, len, nonce, tag);
+        return;
+    }
+
     keyblock checksum, delta, tmp, pad;
 
     // Initialize
@@ -328,4 +608,129 @@ void CryptState::ocb_decrypt(const unsigned char* encrypted, unsigned char* plai
     AESencrypt(tmp, tag, &encrypt_key);
 }
 
+/*
+* Batched OCB works on up to kBatchChunk packets at once. Each step that
+* needs the cipher gathers one block from every packet still at that step,
+* so the AES pipeline always has several independent blocks in flight.
+*/
+void CryptState::ocb_encrypt_batch(unsigned int count, const unsigned char* const* plain, unsigned char* const* encrypted, const unsigned int* lengths, const unsigned char* nonces, unsigned char* tags) {
+    keyblock delta[kBatchChunk], checksum[kBatchChunk], blocks[kBatchChunk], tmp;
+    const unsigned char* src[kBatchChunk];
+    unsigned char* dst[kBatchChunk];
+    unsigned int len[kBatchChunk];
+    unsigned int lane[kBatchChunk];
+
+    // Initialize
+    aes_encrypt_blocks(nonces, reinterpret_cast<unsigned char *>(delta), count);
+    for (unsigned int p = 0; p < count; p++) {
+        ZERO(checksum[p]);
+        src[p] = plain[p];
+        dst[p] = encrypted[p];
+        len[p] = lengths[p];
+    }
+
+    for (;;) {
+        unsigned int m = 0;
+        for (unsigned int p = 0; p < count; p++) {
+            if (len[p] > AES_BLOCK_SIZE) {
+                S2(delta[p]);
+                XOR(blocks[m], delta[p], reinterpret_cast<const subblock *>(src[p]));
+                XOR(checksum[p], checksum[p], reinterpret_cast<const subblock *>(src[p]));
+                lane[m++] = p;
+            }
+        }
+        if (m == 0)
+            break;
+
+        aes_encrypt_blocks(reinterpret_cast<unsigned char *>(blocks), reinterpret_cast<unsigned char *>(blocks), m);
+        for (unsigned int j = 0; j < m; j++) {
+            unsigned int p = lane[j];
+            XOR(reinterpret_cast<subblock *>(dst[p]), delta[p], blocks[j]);
+            len[p] -= AES_BLOCK_SIZE;
+            src[p] += AES_BLOCK_SIZE;
+            dst[p] += AES_BLOCK_SIZE;
+        }
+    }
+
+    for (unsigned int p = 0; p < count; p++) {
+        S2(delta[p]);
+        ZERO(blocks[p]);
+        blocks[p][BLOCKSIZE - 1] = SWAPPED(len[p] * 8);
+        XOR(blocks[p], blocks[p], delta[p]);
+    }
+    aes_encrypt_blocks(reinterpret_cast<unsigned char *>(blocks), reinterpret_cast<unsigned char *>(blocks), count);
+
+    for (unsigned int p = 0; p < count; p++) {
+        memcpy(tmp, src[p], len[p]);
+        memcpy(reinterpret_cast<unsigned char *>(tmp) + len[p], reinterpret_cast<const unsigned char *>(blocks[p]) + len[p], AES_BLOCK_SIZE - len[p]);
+        XOR(checksum[p], checksum[p], tmp);
+        XOR(tmp, blocks[p], tmp);
+        memcpy(dst[p], tmp, len[p]);
+
+        S3(delta[p]);
+        XOR(blocks[p], delta[p], checksum[p]);
+    }
+    aes_encrypt_blocks(reinterpret_cast<unsigned char *>(blocks), tags, count);
+}
+
+void CryptState::ocb_decrypt_batch(unsigned int count, const unsigned char* const* encrypted, unsigned char* const* plain, const unsigned int* lengths, const unsigned char* nonces, unsigned char* tags) {
+    keyblock delta[kBatchChunk], checksum[kBatchChunk], blocks[kBatchChunk], tmp;
+    const unsigned char* src[kBatchChunk];
+    unsigned char* dst[kBatchChunk];
+    unsigned int len[kBatchChunk];
+    unsigned int lane[kBatchChunk];
+
+    // Initialize
+    aes_encrypt_blocks(nonces, reinterpret_cast<unsigned char *>(delta), count);
+    for (unsigned int p = 0; p < count; p++) {
+        ZERO(checksum[p]);
+        src[p] = encrypted[p];
+        dst[p] = plain[p];
+        len[p] = lengths[p];
+    }
+
+    for (;;) {
+        unsigned int m = 0;
+        for (unsigned int p = 0; p < count; p++) {
+            if (len[p] > AES_BLOCK_SIZE) {
+                S2(delta[p]);
+                XOR(blocks[m], delta[p], reinterpret_cast<const subblock *>(src[p]));
+                lane[m++] = p;
+            }
+        }
+        if (m == 0)
+            break;
+
+        aes_decrypt_blocks(reinterpret_cast<unsigned char *>(blocks), reinterpret_cast<unsigned char *>(blocks), m);
+        for (unsigned int j = 0; j < m; j++) {
+            unsigned int p = lane[j];
+            XOR(reinterpret_cast<subblock *>(dst[p]), delta[p], blocks[j]);
+            XOR(checksum[p], checksum[p], reinterpret_cast<const subblock *>(dst[p]));
+            len[p] -= AES_BLOCK_SIZE;
+            src[p] += AES_BLOCK_SIZE;
+            dst[p] += AES_BLOCK_SIZE;
+        }
+    }
+
+    for (unsigned int p = 0; p < count; p++) {
+        S2(delta[p]);
+        ZERO(blocks[p]);
+        blocks[p][BLOCKSIZE - 1] = SWAPPED(len[p] * 8);
+        XOR(blocks[p], blocks[p], delta[p]);
+    }
+    aes_encrypt_blocks(reinterpret_cast<unsigned char *>(blocks), reinterpret_cast<unsigned char *>(blocks), count);
+
+    for (unsigned int p = 0; p < count; p++) {
+        memset(tmp, 0, AES_BLOCK_SIZE);
+        memcpy(tmp, src[p], len[p]);
+        XOR(tmp, tmp, blocks[p]);
+        XOR(checksum[p], checksum[p], tmp);
+        memcpy(dst[p], tmp, len[p]);
+
+        S3(delta[p]);
+        XOR(blocks[p], delta[p], checksum[p]);
+    }
+    aes_encrypt_blocks(reinterpret_cast<unsigned char *>(blocks), tags, count);
+}
+
 }  // namespace MumbleClient
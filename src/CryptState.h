@@ -33,9 +33,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <openssl/aes.h>
 
+#include "CryptStateAccel.h"
+
 namespace MumbleClient {
 
 class CryptState {
+public:
+    // Packets handled per pass of the batched calls
+    static const unsigned int kBatchChunk = 16;
+
 private:
     unsigned char raw_key[AES_BLOCK_SIZE];
     unsigned char encrypt_iv[AES_BLOCK_SIZE];
@@ -56,6 +62,33 @@ private:
     AES_KEY decrypt_key;
     bool bInit;
 
+    // Hardware OCB kernel picked at runtime, NULL for the portable code
+    const crypt_accel::OcbKernel* accel;
+    crypt_accel::RoundKeys accel_keys;
+
+    explicit CryptState(const crypt_accel::OcbKernel* kernel);
+    void init(const crypt_accel::OcbKernel* kernel);
+
+    static const crypt_accel::OcbKernel* selectKernel();
+    static void detectKernel();
+    static bool selfTest(const crypt_accel::OcbKernel* kernel);
+
+    // Replay window bookkeeping of a packet that is about to be decrypted
+    struct DecryptPlan {
+        unsigned char saveiv[AES_BLOCK_SIZE];
+        bool restore;
+        int late;
+        int lost;
+    };
+
+    bool prepareDecrypt(const unsigned char* source, unsigned int crypted_length, DecryptPlan& plan);
+    void acceptDecrypt(const DecryptPlan& plan);
+
+    void aes_encrypt_blocks(const unsigned char* in, unsigned char* out, unsigned int blocks);
+    void aes_decrypt_blocks(const unsigned char* in, unsigned char* out, unsigned int blocks);
+    void ocb_encrypt_batch(unsigned int count, const unsigned char* const* plain, unsigned char* const* encrypted, const unsigned int* lengths, const unsigned char* nonces, unsigned char* tags);
+    void ocb_decrypt_batch(unsigned int count, const unsigned char* const* encrypted, unsigned char* const* plain, const unsigned int* lengths, const unsigned char* nonces, unsigned char* tags);
+
 public:
     CryptState();
 
@@ -64,12 +97,35 @@ public:
     void setKey(const unsigned char* rkey, const unsigned char* eiv, const unsigned char* div);
     void setDecryptIV(const unsigned char* iv);
     const unsigned char* getEncryptIV() const;
+    const char* kernelName() const;
+    // Uses the portable code even where a hardware kernel passed its self
+    // test, for comparing the two
+    void usePortable();
+
+    // Packets decrypted in order, out of order, missing and resyncs, and
+    // the same counts as last reported by the other end
+    unsigned int getGood() const { return uiGood; }
+    unsigned int getLate() const { return uiLate; }
+    unsigned int getLost() const { return uiLost; }
+    unsigned int getResync() const { return uiResync; }
+    unsigned int getRemoteGood() const { return uiRemoteGood; }
+    unsigned int getRemoteLate() const { return uiRemoteLate; }
+    unsigned int getRemoteLost() const { return uiRemoteLost; }
+    unsigned int getRemoteResync() const { return uiRemoteResync; }
+    void setRemoteStats(unsigned int good, unsigned int late, unsigned int lost, unsigned int resync);
 
     void ocb_encrypt(const unsigned char* plain, unsigned char* encrypted, unsigned int len, const unsigned char* nonce, unsigned char* tag);
     void ocb_decrypt(const unsigned char* encrypted, unsigned char* plain, unsigned int len, const unsigned char* nonce, unsigned char* tag);
 
     bool decrypt(const unsigned char* source, unsigned char* dst, unsigned int crypted_length);
+    // |source| may be dst + 4 to encrypt a packet in place.
     void encrypt(const unsigned char* source, unsigned char* dst, unsigned int plain_length);
+
+    // Same results as calling encrypt()/decrypt() on each packet in order, but
+    // the AES blocks of several packets are interleaved. decryptBatch() stores
+    // the outcome of each packet in |results| and returns the number decrypted.
+    void encryptBatch(const unsigned char* const* sources, unsigned char* const* dsts, const unsigned int* plain_lengths, unsigned int count);
+    unsigned int decryptBatch(const unsigned char* const* sources, unsigned char* const* dsts, const unsigned int* crypted_lengths, bool* results, unsigned int count);
 };
 
 }  // namespace MumbleClient
@@ -0,0 +1,468 @@
+/*
+* Hardware accelerated OCB-AES128 kernels for CryptState.
+*
+* Both kernels follow CryptState::ocb_encrypt/ocb_decrypt step by step.
+* The OCB offset is kept as a little endian 128 bit integer so that the
+* GF(2^128) doubling is a pair of 64 bit shifts, and is byte swapped to
+* stream order whenever it is mixed with data.
+*/
+
+#include "CryptStateAccel.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define LIBMUMBLE_HAVE_AESNI
+#define MC_TARGET_AESNI __attribute__((target("aes,ssse3")))
+#include <cpuid.h>
+#elif defined(_MSC_VER) && _MSC_VER >= 1600
+#define LIBMUMBLE_HAVE_AESNI
+#define MC_TARGET_AESNI
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef LIBMUMBLE_HAVE_AESNI
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#define LIBMUMBLE_HAVE_ARMV8_AES
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+namespace MumbleClient {
+
+namespace crypt_accel {
+
+namespace {
+
+#if defined(LIBMUMBLE_HAVE_AESNI) || defined(LIBMUMBLE_HAVE_ARMV8_AES)
+
+const unsigned char kSbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+// Standard AES-128 key schedule, round keys in byte order.
+void ExpandEncryptKey(const unsigned char* raw_key, unsigned char* rk) {
+    memcpy(rk, raw_key, 16);
+
+    unsigned char rcon = 0x01;
+    for (int i = 16; i < 11 * 16; i += 4) {
+        unsigned char t[4] = { rk[i - 4], rk[i - 3], rk[i - 2], rk[i - 1] };
+        if (i % 16 == 0) {
+            unsigned char first = t[0];
+            t[0] = kSbox[t[1]] ^ rcon;
+            t[1] = kSbox[t[2]];
+            t[2] = kSbox[t[3]];
+            t[3] = kSbox[first];
+            rcon = static_cast<unsigned char>((rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0x00));
+        }
+        for (int j = 0; j < 4; j++)
+            rk[i + j] = rk[i - 16 + j] ^ t[j];
+    }
+}
+
+#endif
+
+#ifdef LIBMUMBLE_HAVE_AESNI
+
+MC_TARGET_AESNI inline __m128i ByteSwap(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+// Multiply by x in GF(2^128), same as S2() on the stream ordered block.
+MC_TARGET_AESNI inline __m128i Double(__m128i x) {
+    __m128i carry = _mm_srli_epi64(x, 63);
+    carry = _mm_shuffle_epi32(carry, _MM_SHUFFLE(1, 0, 3, 2));
+    carry = _mm_sub_epi64(_mm_setzero_si128(), carry);
+    carry = _mm_and_si128(carry, _mm_set_epi32(0, 1, 0, 0x87));
+    return _mm_xor_si128(_mm_slli_epi64(x, 1), carry);
+}
+
+// Final block length in bits, big endian in the last byte.
+MC_TARGET_AESNI inline __m128i LengthBlock(unsigned int len) {
+    return _mm_slli_si128(_mm_cvtsi32_si128(static_cast<int>(len * 8)), 15);
+}
+
+MC_TARGET_AESNI inline void LoadKeys(const unsigned char* rk, __m128i* k) {
+    for (int i = 0; i < 11; i++)
+        k[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk + i * 16));
+}
+
+MC_TARGET_AESNI inline __m128i EncryptBlock(const __m128i* k, __m128i b) {
+    b = _mm_xor_si128(b, k[0]);
+    for (int i = 1; i < 10; i++)
+        b = _mm_aesenc_si128(b, k[i]);
+    return _mm_aesenclast_si128(b, k[10]);
+}
+
+MC_TARGET_AESNI inline __m128i DecryptBlock(const __m128i* k, __m128i b) {
+    b = _mm_xor_si128(b, k[0]);
+    for (int i = 1; i < 10; i++)
+        b = _mm_aesdec_si128(b, k[i]);
+    return _mm_aesdeclast_si128(b, k[10]);
+}
+
+MC_TARGET_AESNI void ExpandKeyAesni(const unsigned char* raw_key, RoundKeys* keys) {
+    ExpandEncryptKey(raw_key, keys->enc);
+
+    memcpy(keys->dec, keys->enc + 10 * 16, 16);
+    for (int i = 1; i < 10; i++) {
+        __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys->enc + (10 - i) * 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(keys->dec + i * 16), _mm_aesimc_si128(k));
+    }
+    memcpy(keys->dec + 10 * 16, keys->enc, 16);
+}
+
+MC_TARGET_AESNI void OcbEncryptAesni(const RoundKeys& keys, const unsigned char* plain, unsigned char* encrypted, unsigned int len, const unsigned char* nonce, unsigned char* tag) {
+    __m128i k[11];
+    LoadKeys(keys.enc, k);
+
+    __m128i delta = ByteSwap(EncryptBlock(k, _mm_loadu_si128(reinterpret_cast<const __m128i *>(nonce))));
+    __m128i checksum = _mm_setzero_si128();
+
+    while (len > 16) {
+        delta = Double(delta);
+        __m128i offset = ByteSwap(delta);
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(plain));
+        __m128i c = _mm_xor_si128(offset, EncryptBlock(k, _mm_xor_si128(offset, p)));
+        checksum = _mm_xor_si128(checksum, p);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(encrypted), c);
+        len -= 16;
+        plain += 16;
+        encrypted += 16;
+    }
+
+    delta = Double(delta);
+    __m128i pad = EncryptBlock(k, _mm_xor_si128(ByteSwap(delta), LengthBlock(len)));
+
+    unsigned char tmp[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(tmp), pad);
+    memcpy(tmp, plain, len);
+    __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tmp));
+    checksum = _mm_xor_si128(checksum, t);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(tmp), _mm_xor_si128(pad, t));
+    memcpy(encrypted, tmp, len);
+
+    delta = _mm_xor_si128(delta, Double(delta));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(tag), EncryptBlock(k, _mm_xor_si128(ByteSwap(delta), checksum)));
+}
+
+MC_TARGET_AESNI void OcbDecryptAesni(const RoundKeys& keys, const unsigned char* encrypted, unsigned char* plain, unsigned int len, const unsigned char* nonce, unsigned char* tag) {
+    __m128i ek[11], dk[11];
+    LoadKeys(keys.enc, ek);
+    LoadKeys(keys.dec, dk);
+
+    __m128i delta = ByteSwap(EncryptBlock(ek, _mm_loadu_si128(reinterpret_cast<const __m128i *>(nonce))));
+    __m128i checksum = _mm_setzero_si128();
+
+    while (len > 16) {
+        delta = Double(delta);
+        __m128i offset = ByteSwap(delta);
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(encrypted));
+        __m128i p = _mm_xor_si128(offset, DecryptBlock(dk, _mm_xor_si128(offset, c)));
+        checksum = _mm_xor_si128(checksum, p);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(plain), p);
+        len -= 16;
+        plain += 16;
+        encrypted += 16;
+    }
+
+    delta = Double(delta);
+    __m128i pad = EncryptBlock(ek, _mm_xor_si128(ByteSwap(delta), LengthBlock(len)));
+
+    unsigned char tmp[16];
+    memset(tmp, 0, 16);
+    memcpy(tmp, encrypted, len);
+    __m128i t = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(tmp)), pad);
+    checksum = _mm_xor_si128(checksum, t);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(tmp), t);
+    memcpy(plain, tmp, len);
+
+    delta = _mm_xor_si128(delta, Double(delta));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(tag), EncryptBlock(ek, _mm_xor_si128(ByteSwap(delta), checksum)));
+}
+
+MC_TARGET_AESNI void EncryptBlocksAesni(const RoundKeys& keys, const unsigned char* in, unsigned char* out, unsigned int blocks) {
+    __m128i k[11];
+    LoadKeys(keys.enc, k);
+
+    for (; blocks >= 4; blocks -= 4, in += 64, out += 64) {
+        __m128i b0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)), k[0]);
+        __m128i b1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 16)), k[0]);
+        __m128i b2 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 32)), k[0]);
+        __m128i b3 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 48)), k[0]);
+        for (int i = 1; i < 10; i++) {
+            b0 = _mm_aesenc_si128(b0, k[i]);
+            b1 = _mm_aesenc_si128(b1, k[i]);
+            b2 = _mm_aesenc_si128(b2, k[i]);
+            b3 = _mm_aesenc_si128(b3, k[i]);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_aesenclast_si128(b0, k[10]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), _mm_aesenclast_si128(b1, k[10]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 32), _mm_aesenclast_si128(b2, k[10]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 48), _mm_aesenclast_si128(b3, k[10]));
+    }
+
+    for (; blocks > 0; blocks--, in += 16, out += 16)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), EncryptBlock(k, _mm_loadu_si128(reinterpret_cast<const __m128i *>(in))));
+}
+
+MC_TARGET_AESNI void DecryptBlocksAesni(const RoundKeys& keys, const unsigned char* in, unsigned char* out, unsigned int blocks) {
+    __m128i k[11];
+    LoadKeys(keys.dec, k);
+
+    for (; blocks >= 4; blocks -= 4, in += 64, out += 64) {
+        __m128i b0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)), k[0]);
+        __m128i b1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 16)), k[0]);
+        __m128i b2 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 32)), k[0]);
+        __m128i b3 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 48)), k[0]);
+        for (int i = 1; i < 10; i++) {
+            b0 = _mm_aesdec_si128(b0, k[i]);
+            b1 = _mm_aesdec_si128(b1, k[i]);
+            b2 = _mm_aesdec_si128(b2, k[i]);
+            b3 = _mm_aesdec_si128(b3, k[i]);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_aesdeclast_si128(b0, k[10]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), _mm_aesdeclast_si128(b1, k[10]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 32), _mm_aesdeclast_si128(b2, k[10]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 48), _mm_aesdeclast_si128(b3, k[10]));
+    }
+
+    for (; blocks > 0; blocks--, in += 16, out += 16)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), DecryptBlock(k, _mm_loadu_si128(reinterpret_cast<const __m128i *>(in))));
+}
+
+bool CpuHasAesni() {
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    unsigned int ecx = static_cast<unsigned int>(regs[2]);
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+#endif
+    // AES-NI and SSSE3 (for the byte swaps)
+    return (ecx & (1 << 25)) && (ecx & (1 << 9));
+}
+
+const OcbKernel kAesniKernel = { "AES-NI", ExpandKeyAesni, OcbEncryptAesni, OcbDecryptAesni, EncryptBlocksAesni, DecryptBlocksAesni };
+
+#endif  // LIBMUMBLE_HAVE_AESNI
+
+#ifdef LIBMUMBLE_HAVE_ARMV8_AES
+
+inline uint8x16_t ByteSwap(uint8x16_t x) {
+    x = vrev64q_u8(x);
+    return vextq_u8(x, x, 8);
+}
+
+// Multiply by x in GF(2^128), same as S2() on the stream ordered block.
+inline uint8x16_t Double(uint8x16_t v) {
+    uint64x2_t x = vreinterpretq_u64_u8(v);
+    uint64x2_t carry = vshrq_n_u64(x, 63);
+    carry = vextq_u64(carry, carry, 1);
+    carry = vreinterpretq_u64_s64(vnegq_s64(vreinterpretq_s64_u64(carry)));
+    carry = vandq_u64(carry, vcombine_u64(vcreate_u64(0x87), vcreate_u64(1)));
+    return vreinterpretq_u8_u64(veorq_u64(vshlq_n_u64(x, 1), carry));
+}
+
+// Final block length in bits, big endian in the last byte.
+inline uint8x16_t LengthBlock(unsigned int len) {
+    return vsetq_lane_u8(static_cast<uint8_t>(len * 8), vdupq_n_u8(0), 15);
+}
+
+inline void LoadKeys(const unsigned char* rk, uint8x16_t* k) {
+    for (int i = 0; i < 11; i++)
+        k[i] = vld1q_u8(rk + i * 16);
+}
+
+inline uint8x16_t EncryptBlock(const uint8x16_t* k, uint8x16_t b) {
+    for (int i = 0; i < 9; i++)
+        b = vaesmcq_u8(vaeseq_u8(b, k[i]));
+    return veorq_u8(vaeseq_u8(b, k[9]), k[10]);
+}
+
+inline uint8x16_t DecryptBlock(const uint8x16_t* k, uint8x16_t b) {
+    for (int i = 0; i < 9; i++)
+        b = vaesimcq_u8(vaesdq_u8(b, k[i]));
+    return veorq_u8(vaesdq_u8(b, k[9]), k[10]);
+}
+
+void ExpandKeyArmv8(const unsigned char* raw_key, RoundKeys* keys) {
+    ExpandEncryptKey(raw_key, keys->enc);
+
+    memcpy(keys->dec, keys->enc + 10 * 16, 16);
+    for (int i = 1; i < 10; i++)
+        vst1q_u8(keys->dec + i * 16, vaesimcq_u8(vld1q_u8(keys->enc + (10 - i) * 16)));
+    memcpy(keys->dec + 10 * 16, keys->enc, 16);
+}
+
+void OcbEncryptArmv8(const RoundKeys& keys, const unsigned char* plain, unsigned char* encrypted, unsigned int len, const unsigned char* nonce, unsigned char* tag) {
+    uint8x16_t k[11];
+    LoadKeys(keys.enc, k);
+
+    uint8x16_t delta = ByteSwap(EncryptBlock(k, vld1q_u8(nonce)));
+    uint8x16_t checksum = vdupq_n_u8(0);
+
+    while (len > 16) {
+        delta = Double(delta);
+        uint8x16_t offset = ByteSwap(delta);
+        uint8x16_t p = vld1q_u8(plain);
+        uint8x16_t c = veorq_u8(offset, EncryptBlock(k, veorq_u8(offset, p)));
+        checksum = veorq_u8(checksum, p);
+        vst1q_u8(encrypted, c);
+        len -= 16;
+        plain += 16;
+        encrypted += 16;
+    }
+
+    delta = Double(delta);
+    uint8x16_t pad = EncryptBlock(k, veorq_u8(ByteSwap(delta), LengthBlock(len)));
+
+    unsigned char tmp[16];
+    vst1q_u8(tmp, pad);
+    memcpy(tmp, plain, len);
+    uint8x16_t t = vld1q_u8(tmp);
+    checksum = veorq_u8(checksum, t);
+    vst1q_u8(tmp, veorq_u8(pad, t));
+    memcpy(encrypted, tmp, len);
+
+    delta = veorq_u8(delta, Double(delta));
+    vst1q_u8(tag, EncryptBlock(k, veorq_u8(ByteSwap(delta), checksum)));
+}
+
+void OcbDecryptArmv8(const RoundKeys& keys, const unsigned char* encrypted, unsigned char* plain, unsigned int len, const unsigned char* nonce, unsigned char* tag) {
+    uint8x16_t ek[11], dk[11];
+    LoadKeys(keys.enc, ek);
+    LoadKeys(keys.dec, dk);
+
+    uint8x16_t delta = ByteSwap(EncryptBlock(ek, vld1q_u8(nonce)));
+    uint8x16_t checksum = vdupq_n_u8(0);
+
+    while (len > 16) {
+        delta = Double(delta);
+        uint8x16_t offset = ByteSwap(delta);
+        uint8x16_t c = vld1q_u8(encrypted);
+        uint8x16_t p = veorq_u8(offset, DecryptBlock(dk, veorq_u8(offset, c)));
+        checksum = veorq_u8(checksum, p);
+        vst1q_u8(plain, p);
+        len -= 16;
+        plain += 16;
+        encrypted += 16;
+    }
+
+    delta = Double(delta);
+    uint8x16_t pad = EncryptBlock(ek, veorq_u8(ByteSwap(delta), LengthBlock(len)));
+
+    unsigned char tmp[16];
+    memset(tmp, 0, 16);
+    memcpy(tmp, encrypted, len);
+    uint8x16_t t = veorq_u8(vld1q_u8(tmp), pad);
+    checksum = veorq_u8(checksum, t);
+    vst1q_u8(tmp, t);
+    memcpy(plain, tmp, len);
+
+    delta = veorq_u8(delta, Double(delta));
+    vst1q_u8(tag, EncryptBlock(ek, veorq_u8(ByteSwap(delta), checksum)));
+}
+
+void EncryptBlocksArmv8(const RoundKeys& keys, const unsigned char* in, unsigned char* out, unsigned int blocks) {
+    uint8x16_t k[11];
+    LoadKeys(keys.enc, k);
+
+    for (; blocks >= 4; blocks -= 4, in += 64, out += 64) {
+        uint8x16_t b0 = vld1q_u8(in), b1 = vld1q_u8(in + 16), b2 = vld1q_u8(in + 32), b3 = vld1q_u8(in + 48);
+        for (int i = 0; i < 9; i++) {
+            b0 = vaesmcq_u8(vaeseq_u8(b0, k[i]));
+            b1 = vaesmcq_u8(vaeseq_u8(b1, k[i]));
+            b2 = vaesmcq_u8(vaeseq_u8(b2, k[i]));
+            b3 = vaesmcq_u8(vaeseq_u8(b3, k[i]));
+        }
+        vst1q_u8(out, veorq_u8(vaeseq_u8(b0, k[9]), k[10]));
+        vst1q_u8(out + 16, veorq_u8(vaeseq_u8(b1, k[9]), k[10]));
+        vst1q_u8(out + 32, veorq_u8(vaeseq_u8(b2, k[9]), k[10]));
+        vst1q_u8(out + 48, veorq_u8(vaeseq_u8(b3, k[9]), k[10]));
+    }
+
+    for (; blocks > 0; blocks--, in += 16, out += 16)
+        vst1q_u8(out, EncryptBlock(k, vld1q_u8(in)));
+}
+
+void DecryptBlocksArmv8(const RoundKeys& keys, const unsigned char* in, unsigned char* out, unsigned int blocks) {
+    uint8x16_t k[11];
+    LoadKeys(keys.dec, k);
+
+    for (; blocks >= 4; blocks -= 4, in += 64, out += 64) {
+        uint8x16_t b0 = vld1q_u8(in), b1 = vld1q_u8(in + 16), b2 = vld1q_u8(in + 32), b3 = vld1q_u8(in + 48);
+        for (int i = 0; i < 9; i++) {
+            b0 = vaesimcq_u8(vaesdq_u8(b0, k[i]));
+            b1 = vaesimcq_u8(vaesdq_u8(b1, k[i]));
+            b2 = vaesimcq_u8(vaesdq_u8(b2, k[i]));
+            b3 = vaesimcq_u8(vaesdq_u8(b3, k[i]));
+        }
+        vst1q_u8(out, veorq_u8(vaesdq_u8(b0, k[9]), k[10]));
+        vst1q_u8(out + 16, veorq_u8(vaesdq_u8(b1, k[9]), k[10]));
+        vst1q_u8(out + 32, veorq_u8(vaesdq_u8(b2, k[9]), k[10]));
+        vst1q_u8(out + 48, veorq_u8(vaesdq_u8(b3, k[9]), k[10]));
+    }
+
+    for (; blocks > 0; blocks--, in += 16, out += 16)
+        vst1q_u8(out, DecryptBlock(k, vld1q_u8(in)));
+}
+
+bool CpuHasArmv8Aes() {
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#elif defined(__APPLE__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+const OcbKernel kArmv8Kernel = { "ARMv8 Crypto", ExpandKeyArmv8, OcbEncryptArmv8, OcbDecryptArmv8, EncryptBlocksArmv8, DecryptBlocksArmv8 };
+
+#endif  // LIBMUMBLE_HAVE_ARMV8_AES
+
+}  // namespace
+
+const OcbKernel* DetectOcbKernel() {
+#ifdef LIBMUMBLE_HAVE_AESNI
+    if (CpuHasAesni())
+        return &kAesniKernel;
+#endif
+#ifdef LIBMUMBLE_HAVE_ARMV8_AES
+    if (CpuHasArmv8Aes())
+        return &kArmv8Kernel;
+#endif
+    return 0;
+}
+
+}  // namespace crypt_accel
+
+}  // namespace MumbleClient
@@ -0,0 +1,35 @@
+#ifndef _LIBMUMBLECLIENT_CRYPTSTATEACCEL_H
+#define _LIBMUMBLECLIENT_CRYPTSTATEACCEL_H
+
+namespace MumbleClient {
+
+namespace crypt_accel {
+
+// Expanded AES-128 round keys in byte order. |dec| holds the equivalent
+// inverse cipher schedule used by the hardware decryption instructions.
+struct RoundKeys {
+    unsigned char enc[11 * 16];
+    unsigned char dec[11 * 16];
+};
+
+// OCB-AES128 implemented with CPU crypto instructions. Output is byte for
+// byte identical to CryptState::ocb_encrypt/ocb_decrypt. The block calls
+// run plain AES over independent blocks with several kept in flight.
+struct OcbKernel {
+    const char* name;
+    void (*expand_key)(const unsigned char* raw_key, RoundKeys* keys);
+    void (*encrypt)(const RoundKeys& keys, const unsigned char* plain, unsigned char* encrypted, unsigned int len, const unsigned char* nonce, unsigned char* tag);
+    void (*decrypt)(const RoundKeys& keys, const unsigned char* encrypted, unsigned char* plain, unsigned int len, const unsigned char* nonce, unsigned char* tag);
+    void (*encrypt_blocks)(const RoundKeys& keys, const unsigned char* in, unsigned char* out, unsigned int blocks);
+    void (*decrypt_blocks)(const RoundKeys& keys, const unsigned char* in, unsigned char* out, unsigned int blocks);
+};
+
+// Returns the kernel supported by the running CPU, or NULL when only the
+// portable implementation can be used.
+const OcbKernel* DetectOcbKernel();
+
+}  // namespace crypt_accel
+
+}  // namespace MumbleClient
+
+#endif
@@ -0,0 +1,70 @@
+#include "buffer_pool.h"
+
+namespace MumbleClient
+{
+    BufferPool::BufferPool(size_t slab_size, size_t max_slabs) :
+        slab_size_(slab_size),
+        max_slabs_(max_slabs),
+        free_(max_slabs),
+        allocated_(0),
+        in_use_(0),
+        high_water_(0),
+        exhausted_(0)
+    {
+        slabs_.reserve(max_slabs_);
+    }
+
+    BufferPool::~BufferPool()
+    {
+        for (size_t i = 0; i < slabs_.size(); ++i)
+            delete[] slabs_[i];
+    }
+
+    unsigned char* BufferPool::Acquire()
+    {
+        unsigned char* slab = 0;
+        if (!free_.pop(slab))
+        {
+            if (allocated_.fetch_add(1) >= max_slabs_)
+            {
+                allocated_.fetch_sub(1);
+                exhausted_.fetch_add(1);
+                return 0;
+            }
+
+            slab = new unsigned char[slab_size_];
+            boost::mutex::scoped_lock lock(slabs_mutex_);
+            slabs_.push_back(slab);
+        }
+
+        size_t in_use = in_use_.fetch_add(1) + 1;
+        size_t high_water = high_water_.load();
+        while (in_use > high_water && !high_water_.compare_exchange_weak(high_water, in_use))
+            ;
+
+        return slab;
+    }
+
+    void BufferPool::Release(unsigned char* slab)
+    {
+        if (!slab)
+            return;
+
+        // Never more slabs than the nodes reserved in the constructor, so
+        // this cannot fail or allocate
+        free_.bounded_push(slab);
+        in_use_.fetch_sub(1);
+    }
+
+    BufferPoolStats BufferPool::Stats() const
+    {
+        BufferPoolStats stats;
+        stats.slab_size = slab_size_;
+        stats.capacity = max_slabs_;
+        stats.allocated = allocated_.load();
+        stats.in_use = in_use_.load();
+        stats.high_water = high_water_.load();
+        stats.exhausted = exhausted_.load();
+        return stats;
+    }
+}
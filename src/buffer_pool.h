@@ -0,0 +1,59 @@
+#ifndef _LIBMUMBLECLIENT_BUFFER_POOL_H_
+#define _LIBMUMBLECLIENT_BUFFER_POOL_H_
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/lockfree/stack.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace MumbleClient {
+
+struct BufferPoolStats
+{
+    size_t slab_size;
+    size_t capacity;    // Most slabs the pool will ever hold
+    size_t allocated;   // Slabs allocated so far
+    size_t in_use;      // Slabs currently handed out
+    size_t high_water;  // Most slabs ever handed out at once
+    size_t exhausted;   // Acquire() calls that found no slab
+};
+
+// Fixed size buffers that are reused instead of freed. Slabs are allocated
+// lazily up to |max_slabs|, after that Acquire() fails until one is released.
+// Acquire() and Release() may be called from any thread; once the pool has
+// grown to its working size neither takes a lock.
+class BufferPool
+{
+public:
+    BufferPool(size_t slab_size, size_t max_slabs);
+    ~BufferPool();
+
+    unsigned char* Acquire();
+    void Release(unsigned char* slab);
+
+    size_t slab_size() const { return slab_size_; }
+    BufferPoolStats Stats() const;
+
+private:
+    const size_t slab_size_;
+    const size_t max_slabs_;
+
+    boost::lockfree::stack<unsigned char*> free_;
+    boost::atomic<size_t> allocated_;
+    boost::atomic<size_t> in_use_;
+    boost::atomic<size_t> high_water_;
+    boost::atomic<size_t> exhausted_;
+
+    // Every slab ever allocated, only touched when the pool grows
+    boost::mutex slabs_mutex_;
+    std::vector<unsigned char*> slabs_;
+
+    BufferPool(const BufferPool&);
+    void operator=(const BufferPool&);
+};
+
+}  // namespace MumbleClient
+
+#endif
@@ -0,0 +1,121 @@
+#include "callback_executor.h"
+
+#include <string.h>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace MumbleClient
+{
+    namespace
+    {
+        uint64_t NowMicroseconds()
+        {
+            static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+            return static_cast<uint64_t>((boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds());
+        }
+    }
+
+    CallbackExecutor::CallbackExecutor(size_t capacity, OverflowPolicy policy) :
+        policy_(policy),
+        queue_(capacity > 0 ? capacity : 1),
+        stopping_(false),
+        total_lag_(0)
+    {
+        memset(&stats_, 0, sizeof(stats_));
+        thread_ = boost::thread(boost::bind(&CallbackExecutor::Run, this));
+    }
+
+    CallbackExecutor::~CallbackExecutor()
+    {
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            stopping_ = true;
+            stats_.dropped += queue_.size();
+            queue_.clear();
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+        thread_.join();
+    }
+
+    void CallbackExecutor::Post(const Task& task)
+    {
+        Entry entry;
+        entry.task = task;
+        entry.queued_at = NowMicroseconds();
+
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (stopping_)
+                return;
+
+            ++stats_.posted;
+            if (queue_.full())
+            {
+                switch (policy_)
+                {
+                case kBlock:
+                    while (queue_.full() && !stopping_)
+                        not_full_.wait(lock);
+                    if (stopping_)
+                    {
+                        ++stats_.dropped;
+                        return;
+                    }
+                    break;
+                case kDropOldest:
+                    // push_back() onto a full circular_buffer overwrites the front
+                    ++stats_.dropped;
+                    break;
+                case kDropNewest:
+                    ++stats_.dropped;
+                    return;
+                }
+            }
+
+            queue_.push_back(entry);
+            if (queue_.size() > stats_.high_water)
+                stats_.high_water = queue_.size();
+        }
+        not_empty_.notify_one();
+    }
+
+    CallbackExecutorStats CallbackExecutor::Stats() const
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        CallbackExecutorStats stats = stats_;
+        stats.depth = queue_.size();
+        stats.average_lag = stats_.delivered ? total_lag_ / stats_.delivered : 0;
+        return stats;
+    }
+
+    void CallbackExecutor::Run()
+    {
+        for (;;)
+        {
+            Entry entry;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                while (queue_.empty() && !stopping_)
+                    not_empty_.wait(lock);
+                if (stopping_)
+                    return;
+
+                entry = queue_.front();
+                queue_.pop_front();
+
+                uint64_t now = NowMicroseconds();
+                uint64_t lag = now > entry.queued_at ? now - entry.queued_at : 0;
+                stats_.last_lag = lag;
+                if (lag > stats_.max_lag)
+                    stats_.max_lag = lag;
+                total_lag_ += lag;
+                ++stats_.delivered;
+            }
+            not_full_.notify_one();
+
+            entry.task();
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef _LIBMUMBLECLIENT_CALLBACK_EXECUTOR_H_
+#define _LIBMUMBLECLIENT_CALLBACK_EXECUTOR_H_
+
+#include <boost/circular_buffer.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "libmumble_stdint.h"
+#include "visibility.h"
+
+namespace MumbleClient {
+
+struct CallbackExecutorStats
+{
+    uint64_t posted;
+    uint64_t delivered;
+    uint64_t dropped;
+    size_t depth;
+    size_t high_water;
+    // Time events spent queued, in microseconds
+    uint64_t last_lag;
+    uint64_t max_lag;
+    uint64_t average_lag;
+};
+
+// Runs client callbacks on a thread of its own, so a slow consumer does not
+// hold up networking. Attach it with MumbleClient::SetCallbackExecutor();
+// one executor may serve many clients. Events carry copies of their data.
+class DLL_PUBLIC CallbackExecutor
+{
+public:
+    enum OverflowPolicy
+    {
+        // The network thread waits for room in the queue
+        kBlock,
+        // The oldest queued event is discarded
+        kDropOldest,
+        // The new event is discarded
+        kDropNewest
+    };
+
+    typedef boost::function<void ()> Task;
+
+    CallbackExecutor(size_t capacity, OverflowPolicy policy);
+    // Stops the thread. Events still queued are dropped.
+    ~CallbackExecutor();
+
+    void Post(const Task& task);
+    CallbackExecutorStats Stats() const;
+
+private:
+    struct Entry
+    {
+        Task task;
+        uint64_t queued_at;
+    };
+
+    void Run();
+
+    const OverflowPolicy policy_;
+
+    mutable boost::mutex mutex_;
+    boost::condition_variable not_empty_;
+    boost::condition_variable not_full_;
+    boost::circular_buffer<Entry> queue_;
+    bool stopping_;
+    CallbackExecutorStats stats_;
+    uint64_t total_lag_;
+
+    boost::thread thread_;
+
+    CallbackExecutor(const CallbackExecutor&);
+    void operator=(const CallbackExecutor&);
+};
+
+}  // namespace MumbleClient
+
+#endif
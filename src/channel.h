@@ -8,7 +8,7 @@ namespace MumbleClient {
 
 class Channel {
 public:
-    Channel(int32_t id_) : id(id_) { }
+    Channel(int32_t id_) : id(id_), position(0), temporary(false) { }
     ~Channel() { DLOG(INFO) << "Channel " << name << " destroyed"; }
     int32_t id;
     boost::weak_ptr<Channel> parent;
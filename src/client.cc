@@ -1,15 +1,27 @@
 #include "client.h"
 
 #include <boost/make_shared.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/version.hpp>
+#include <algorithm>
 #include <deque>
 #include <typeinfo>
 #include <iostream>
+#include <string.h>
 
 #include "channel.h"
+#include "client_lib.h"
 #include "CryptState.h"
+#include "handler_memory.h"
 #include "logging.h"
+#include "message_framer.h"
+#include "PacketDataStream.h"
 #include "settings.h"
+#include "trace.h"
+#include "udp_batch.h"
 #include "user.h"
+#include "wire_decoder.h"
 
 #ifndef SAFE_DELETE
 #define SAFE_DELETE(p) { delete p; p=0; }
@@ -19,10 +31,11 @@
 
 namespace 
 {
+    // Parses into a cached message. ParseFromArray() clears it first, but
+    // the string fields keep their allocations for the next message.
     template <class T>
-    T ConstructProtobufObject(void* buffer, int32_t length, bool print) 
+    T& ParseProtobufObject(T& pb, const void* buffer, int32_t length, bool print) 
     {
-        T pb;
         pb.ParseFromArray(buffer, length);
         if (print) {
             DLOG(INFO) << ">> IN: " << typeid(T).name() << ":";
@@ -31,72 +44,201 @@ namespace
         return pb;
     }
 
+    // Hot messages are read with the wire decoder. Anything it does not
+    // handle is parsed by protobuf; debug builds parse every message with
+    // protobuf as well and check that both agree.
+    template <class T, class View>
+    void DecodeMessage(T& pb, const void* buffer, int32_t length, View& view, bool print) 
+    {
+        bool decoded = MumbleClient::wire_decoder::Decode(buffer, length, view);
+#ifndef NDEBUG
+        View expected;
+        MumbleClient::wire_decoder::FromProtobuf(ParseProtobufObject(pb, buffer, length, print), expected);
+        if (decoded && !MumbleClient::wire_decoder::Equal(view, expected))
+        {
+            LOG(ERROR) << "libmumble: Wire decoder disagrees with protobuf on " << typeid(T).name();
+            assert(false);
+        }
+        if (!decoded)
+            view = expected;
+#else
+        if (!decoded)
+            MumbleClient::wire_decoder::FromProtobuf(ParseProtobufObject(pb, buffer, length, false), view);
+#endif
+    }
+
     inline int32_t MUMBLE_VERSION(int16_t x, int16_t y, int16_t z) 
     {
         return (x << 16) | (y << 8) | (z & 0xFF);
     }
-}
 
-///////////////////////////////////////////////////////////////////////////////
+    // Copies handed to a CallbackExecutor, so the network thread may keep
+    // updating or drop its own objects
+    boost::shared_ptr<MumbleClient::User> SnapshotUser(const MumbleClient::User& user) 
+    {
+        boost::shared_ptr<MumbleClient::User> copy = boost::make_shared<MumbleClient::User>(user.session, user.channel.lock());
+        copy->user_id = user.user_id;
+        copy->mute = user.mute;
+        copy->deaf = user.deaf;
+        copy->suppress = user.suppress;
+        copy->self_mute = user.self_mute;
+        copy->self_deaf = user.self_deaf;
+        copy->name = user.name;
+        copy->comment = user.comment;
+        copy->hash = user.hash;
+        return copy;
+    }
 
-namespace MumbleClient 
-{
-    class MessageHeader 
+    boost::shared_ptr<MumbleClient::Channel> SnapshotChannel(const MumbleClient::Channel& channel) 
     {
-    public:
-        int16_t type() const { return (d_[0] << 8) | d_[1]; }
-        int32_t length() const { return (d_[2] << 24) | (d_[3] << 16) | (d_[4] << 8) | d_[5]; }
+        boost::shared_ptr<MumbleClient::Channel> copy = boost::make_shared<MumbleClient::Channel>(channel.id);
+        copy->parent = channel.parent;
+        copy->position = channel.position;
+        copy->temporary = channel.temporary;
+        copy->name = channel.name;
+        copy->description = channel.description;
+        return copy;
+    }
 
-        void type(int16_t t_) { d_[0] = t_ >> 8; d_[1] = t_ & 0xFF; }
-        void length(int32_t l_) 
-        {
-            d_[2] = static_cast<unsigned char>(l_ >> 24);
-            d_[3] = static_cast<unsigned char>(l_ >> 16);
-            d_[4] = static_cast<unsigned char>(l_ >> 8);
-            d_[5] = static_cast<unsigned char>(l_ & 0xFF);
-        }
+    void CallWithPacket(const MumbleClient::RawUdpTunnelCallbackType& callback, const boost::shared_ptr< std::vector<char> >& packet) 
+    {
+        callback(static_cast<int32_t>(packet->size()), packet->empty() ? 0 : &(*packet)[0]);
+    }
 
-        const unsigned char* data() const { return d_; }
+    void CallWithUser(const MumbleClient::UserJoinedCallbackType& callback, const boost::shared_ptr<MumbleClient::User>& user) 
+    {
+        callback(*user);
+    }
 
-        friend std::istream& operator>>(std::istream& is, MessageHeader& header) 
-        {
-            return is.read(reinterpret_cast<char*>(header.d_), 6);
-        }
+    void CallWithUserMoved(const MumbleClient::UserMovedCallbackType& callback, const boost::shared_ptr<MumbleClient::User>& user, const boost::shared_ptr<MumbleClient::Channel>& channel) 
+    {
+        callback(*user, *channel);
+    }
+
+    void CallWithChannel(const MumbleClient::ChannelAddCallbackType& callback, const boost::shared_ptr<MumbleClient::Channel>& channel) 
+    {
+        callback(*channel);
+    }
+
+    // Microseconds since the epoch, used for ping timestamps
+    uint64_t CurrentMicroseconds() 
+    {
+        static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+        return static_cast<uint64_t>((boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds());
+    }
+
+    // Records the time until it goes out of scope as callback time
+    class CallbackTimer 
+    {
+    public:
+        explicit CallbackTimer(MumbleClient::MetricHistogram& histogram) : histogram_(histogram), start_(CurrentMicroseconds()) { }
+        ~CallbackTimer() { histogram_.Record(CurrentMicroseconds() - start_); }
 
     private:
-        unsigned char d_[6];
+        MumbleClient::MetricHistogram& histogram_;
+        uint64_t start_;
     };
 
-    class Message 
+    void RunTimedCallback(const boost::shared_ptr<MumbleClient::MetricHistogram>& histogram, const MumbleClient::CallbackExecutor::Task& task) 
     {
-    public:
-        Message(const MessageHeader& header, const std::string& msg) : header_(header), msg_(msg) { };
+        MC_TRACE_SCOPE("ExecutorCallback");
+        CallbackTimer timer(*histogram);
+        task();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
 
-        MessageHeader header_;
-        std::string msg_;
+namespace MumbleClient 
+{
+    // Incoming messages are parsed into these instead of new objects
+    struct MumbleClient::ParsedMessages
+    {
+        MumbleProto::Ping ping;
+        MumbleProto::ChannelRemove channel_remove;
+        MumbleProto::ChannelState channel_state;
+        MumbleProto::UserRemove user_remove;
+        MumbleProto::UserState user_state;
+        MumbleProto::TextMessage text_message;
+        MumbleProto::CryptSetup crypt_setup;
+        MumbleProto::ServerSync server_sync;
     };
 
-    ///////////////////////////////////////////////////////////////////////////////
+    // Referenced by every handler the client gave Boost.Asio. Operation
+    // memory lives here, so that it outlives the client when handlers are
+    // left on an io_service that was stopped.
+    struct MumbleClient::HandlerState
+    {
+        // Memory for the posted drain, for one UDP send at a time and for
+        // the single TCP write in flight
+        HandlerMemory drain_memory;
+        HandlerMemory udp_send_memory;
+        HandlerMemory tcp_write_memory;
+    };
 
     MumbleClient::MumbleClient(boost::asio::io_service* io_service) :
         io_service_(io_service),
+        strand_(new boost::asio::io_service::strand(*io_service)),
+        lib_(0),
+        callback_executor_(0),
+        shard_(-1),
         cs_(new CryptState()),
         state_(kStateNew),
         processing_tcp_queue_(false),
+        drain_posted_(false),
+        submissions_dropped_(0),
+        submissions_spilled_(0),
+        spilling_(false),
+        udp_pool_fallbacks_(0),
+        control_queue_(kSendQueueInitialCapacity),
+        voice_queue_(kDefaultVoiceMaxFrames),
+        tcp_frame_pool_(new BufferPool(kTcpFrameSlabSize, kTcpFramePoolSize)),
+        voice_max_age_(kDefaultVoiceMaxAge),
         resolving_(false),
         ping_timer_(0),
         tcp_socket_(0),
         udp_socket_(0),
-        resolver_(0)
+        resolver_(0),
+        connect_timer_(0),
+        connect_timeout_(kDefaultConnectTimeout),
+        connect_attempt_(0),
+        recv_framer_(new MessageFramer()),
+        parsed_(new ParsedMessages()),
+        udp_send_pool_(new BufferPool(kUdpBufferSize, kUdpSendPoolSize)),
+        recv_pool_(new ReceivePool(kRecvSlabSize, kRecvPoolSize)),
+        udp_batching_(false),
+        udp_flush_posted_(false),
+        udp_active_(false),
+        udp_ping_samples_(0),
+        udp_last_ping_reply_(0),
+        udp_ping_avg_(0),
+        udp_ping_var_(0),
+        callback_time_(boost::make_shared<MetricHistogram>()),
+        handler_state_(boost::make_shared<HandlerState>())
     {
         currentSettings_ = Settings();
+        tcp_write_buffer_.reserve(kTcpWriteBufferSize);
         resolver_ = new boost::asio::ip::tcp::resolver(*io_service_);
     }
 
     MumbleClient::~MumbleClient() 
     {
-        if (state_ != kStateDisconnected)
-            Disconnect();
+        // A callback deleting its own client returns into it
+        BOOST_ASSERT(!strand_->running_in_this_thread());
+
+        // Disconnects on the strand, after anything posted before, and
+        // waits for the handlers that were pending to finish
+        if (!HandlersIdle())
+        {
+            strand_->post(Track(boost::bind(&MumbleClient::ApplyTeardown, this)));
+            WaitForHandlers();
+        }
+        ApplyTeardown();
+
+        // Leaves the library's metrics before anything is deleted, so
+        // MumbleClientLib::GetMetrics() never reads a client being torn down
+        if (lib_)
+            lib_->ClientDestroyed(this);
 
         try
         {
@@ -105,6 +247,11 @@ namespace MumbleClient
                 //LOG(INFO) << "-- Deleting ping timer";
                 SAFE_DELETE(ping_timer_);
             }
+            if (connect_timer_)
+            {
+                //LOG(INFO) << "-- Deleting connect timer";
+                SAFE_DELETE(connect_timer_);
+            }
             if (tcp_socket_)
             {
                 //LOG(INFO) << "-- Deleting TCP socket";
@@ -125,6 +272,33 @@ namespace MumbleClient
                 //LOG(INFO) << "-- Deleting crypt state";
                 SAFE_DELETE(cs_);
             }
+            if (recv_framer_)
+            {
+                //LOG(INFO) << "-- Deleting receive framer";
+                SAFE_DELETE(recv_framer_);
+            }
+            if (parsed_)
+            {
+                //LOG(INFO) << "-- Deleting parsed messages";
+                SAFE_DELETE(parsed_);
+            }
+            DiscardSubmissions();
+            ClearSendQueue();
+            if (tcp_frame_pool_)
+            {
+                //LOG(INFO) << "-- Deleting TCP frame pool";
+                SAFE_DELETE(tcp_frame_pool_);
+            }
+            if (udp_send_pool_)
+            {
+                //LOG(INFO) << "-- Deleting UDP send pool";
+                SAFE_DELETE(udp_send_pool_);
+            }
+            if (strand_)
+            {
+                //LOG(INFO) << "-- Deleting strand";
+                SAFE_DELETE(strand_);
+            }
         }
         catch(std::exception &e)
         {
@@ -132,7 +306,38 @@ namespace MumbleClient
         }
     }
 
+    bool MumbleClient::Rebind(boost::asio::io_service* io_service) 
+    {
+        // The strand and the state below belong to the old io_service's
+        // threads; they may only be touched once nothing is queued or
+        // pending there
+        if (!HandlersIdle() || drain_posted_ || spilling_ || !submissions_.empty())
+            return false;
+
+        // Sockets and timers cannot move between io_services, so only a
+        // client without any may change shards
+        if (state_ != kStateNew && state_ != kStateDisconnected)
+            return false;
+        if (resolving_ || tcp_socket_ || udp_socket_)
+            return false;
+
+        SAFE_DELETE(connect_timer_);
+        SAFE_DELETE(ping_timer_);
+        SAFE_DELETE(resolver_);
+        SAFE_DELETE(strand_);
+
+        io_service_ = io_service;
+        resolver_ = new boost::asio::ip::tcp::resolver(*io_service_);
+        strand_ = new boost::asio::io_service::strand(*io_service_);
+        return true;
+    }
+
     void MumbleClient::Connect(const Settings& s) 
+    {
+        strand_->post(Track(boost::bind(&MumbleClient::ApplyConnect, this, s)));
+    }
+
+    void MumbleClient::ApplyConnect(const Settings& s) 
     {
         if (!resolver_)
         {
@@ -149,89 +354,118 @@ namespace MumbleClient
         LOG(INFO) << "libmumble: Resolving host " << s.GetHost() << ":" << s.GetPort();
 
         state_ = kStateNew;
+        udp_active_ = false;
+        udp_ping_samples_ = 0;
         currentSettings_ = Settings(s.GetHost(), s.GetPort(), s.GetUserName(), s.GetPassword());
 
         // Note: 'io_service_' needs to be running so it will process the queued async_resolve() call!
         resolving_ = true;
         boost::asio::ip::tcp::resolver::query query(currentSettings_.GetHost(), currentSettings_.GetPort());
-        resolver_->async_resolve(query, boost::bind(&MumbleClient::OnConnected, this, boost::asio::placeholders::error, boost::asio::placeholders::iterator));
+        resolver_->async_resolve(query, strand_->wrap(Track(boost::bind(&MumbleClient::OnConnected, this, boost::asio::placeholders::error, boost::asio::placeholders::iterator))));
     }
 
     void MumbleClient::OnConnected(const boost::system::error_code& resolveError, boost::asio::ip::tcp::resolver::iterator endpoint_iterator)
     {
         resolving_ = false;
-        boost::asio::ip::tcp::resolver::iterator end;
+        if (state_ == kStateDisconnected)
+            return;
+
+        if (resolveError)
+        {
+            HandleConnectError(resolveError, "resolve");
+            return;
+        }
 
         // Prepare connection
 #if SSL
-        boost::asio::ssl::context ctx(*io_service_, boost::asio::ssl::context::tlsv1);
+        // Negotiates the highest TLS version both ends support
+        boost::asio::ssl::context ctx(boost::asio::ssl::context::sslv23);
         tcp_socket_ = new boost::asio::ssl::stream<boost::asio::ip::tcp::socket>(*io_service_, ctx);
 #else
         tcp_socket_ = new boost::asio::ip::tcp::socket(*io_service_);
 #endif
+        if (!connect_timer_)
+            connect_timer_ = new boost::asio::deadline_timer(*io_service_);
+
+        ConnectNext(endpoint_iterator, boost::asio::error::host_not_found);
+    }
 
-        // Try to connect TCP
-        boost::system::error_code error = boost::asio::error::host_not_found;
-        while (error && endpoint_iterator != end) 
+    void MumbleClient::ConnectNext(boost::asio::ip::tcp::resolver::iterator endpoint_iterator, const boost::system::error_code& last_error)
+    {
+        boost::asio::ip::tcp::resolver::iterator end;
+        if (endpoint_iterator == end)
         {
-            LOG(INFO) << "libmumble: Connecting to " << (*endpoint_iterator).endpoint().address();
-#if SSL
-            tcp_socket_->lowest_layer().close();
-            tcp_socket_->lowest_layer().connect(*endpoint_iterator++, error);
-#else
-            tcp_socket_->close();
-            tcp_socket_->connect(*endpoint_iterator++, error);
-#endif
+            HandleConnectError(last_error, "connection");
+            return;
         }
 
-        // Handle errors
+        // Try to connect TCP, one endpoint per attempt
+        LOG(INFO) << "libmumble: Connecting to " << (*endpoint_iterator).endpoint().address();
+        boost::asio::ip::tcp::endpoint endpoint = *endpoint_iterator;
+        tcp_socket_->lowest_layer().close();
+        StartConnectTimer();
+        tcp_socket_->lowest_layer().async_connect(endpoint, strand_->wrap(Track(boost::bind(&MumbleClient::HandleConnect, this, boost::asio::placeholders::error, ++endpoint_iterator))));
+    }
+
+    void MumbleClient::HandleConnect(const boost::system::error_code& error, boost::asio::ip::tcp::resolver::iterator endpoint_iterator)
+    {
+        if (state_ == kStateDisconnected)
+            return;
+        StopConnectTimer();
+
         if (error)
         {
-            if (error_callback_)
-                error_callback_(error);
-            else
-                LOG(ERROR) << "libmumble: Connection error: " << error.message();
+            // An aborted attempt means our connect timer closed the socket
+            boost::system::error_code attempt_error = error;
+            if (error == boost::asio::error::operation_aborted)
+                attempt_error = boost::asio::error::timed_out;
 
-            if (connected_callback_)
-                connected_callback_(false, currentSettings_, error.message());
-            else
-                LOG(ERROR) << "libmumble: Connected successfully but not callback has been set, use SetConnectedCallback() to set one!";
+            LOG(WARNING) << "libmumble: Connection attempt failed: " << attempt_error.message();
+            ConnectNext(endpoint_iterator, attempt_error);
             return;
         }
 
-#if SSL
-        // Do SSL handshake
+        boost::system::error_code udp_error;
         boost::asio::ip::udp::endpoint udp_endpoint(tcp_socket_->lowest_layer().remote_endpoint().address(), tcp_socket_->lowest_layer().remote_endpoint().port());
         udp_socket_ = new boost::asio::ip::udp::socket(*io_service_);
-        udp_socket_->connect(udp_endpoint, error);
+        udp_socket_->connect(udp_endpoint, udp_error);
+        if (udp_error)
+            LOG(WARNING) << "libmumble: UDP socket setup failed: " << udp_error.message();
 
-        tcp_socket_->handshake(boost::asio::ssl::stream_base::client, error);
-        if (error) 
-        {
-            if (error_callback_)
-                error_callback_(error);
-            else
-                LOG(ERROR) << "libmumble: handshake error: " << error.message();
+#if SSL
+        // Do SSL handshake
+        StartConnectTimer();
+        tcp_socket_->async_handshake(boost::asio::ssl::stream_base::client, strand_->wrap(Track(boost::bind(&MumbleClient::HandleHandshake, this, boost::asio::placeholders::error))));
+#else
+        HandleHandshake(boost::system::error_code());
+#endif
+    }
+
+    void MumbleClient::HandleHandshake(const boost::system::error_code& error)
+    {
+        if (state_ == kStateDisconnected)
+            return;
+        StopConnectTimer();
 
-            if (connected_callback_)
-                connected_callback_(false, currentSettings_, error.message());
+        if (error)
+        {
+            if (error == boost::asio::error::operation_aborted)
+                HandleConnectError(boost::asio::error::timed_out, "handshake");
             else
-                LOG(ERROR) << "libmumble: Connected successfully but not callback has been set, use SetConnectedCallback() to set one!";
+                HandleConnectError(error, "handshake");
             return;
         }
-#endif
 
         state_ = kStateHandshakeCompleted;
 
         // Setup connection params
-        boost::asio::socket_base::non_blocking_io nbio_command(true);
         boost::asio::ip::tcp::no_delay no_delay_option(true);
 
 #if SSL
-        tcp_socket_->lowest_layer().io_control(nbio_command);
+        tcp_socket_->lowest_layer().non_blocking(true);
         tcp_socket_->lowest_layer().set_option(no_delay_option);
 #else
-        tcp_socket_->io_control(nbio_command);
+        tcp_socket_->non_blocking(true);
         tcp_socket_->set_option(no_delay_option);
 #endif
 
@@ -239,23 +473,138 @@ namespace MumbleClient
         MumbleProto::Version v;
         v.set_version(MUMBLE_VERSION(1, 2, 2));
         v.set_release("libmumbleclient-0.0.2");
-        SendMessage(PbMessageType::Version, v, true);
+        QueueMessage(PbMessageType::Version, v, true);
 
         MumbleProto::Authenticate a;
         a.set_username(currentSettings_.GetUserName());
         a.set_password(currentSettings_.GetPassword());
         a.add_celt_versions(0x8000000b); // FIXME(pcgod): hardcoded version number
-        SendMessage(PbMessageType::Authenticate, a, true);
+        QueueMessage(PbMessageType::Authenticate, a, true);
 
-        boost::asio::async_read(*tcp_socket_, recv_buffer_, boost::asio::transfer_at_least(6), boost::bind(&MumbleClient::ReadHandler, this, boost::asio::placeholders::error));
+        recv_framer_->Reset();
+        tcp_socket_->async_read_some(recv_framer_->Prepare(), strand_->wrap(Track(boost::bind(&MumbleClient::ReadHandler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred))));
+        StartUdpReceive();
 
-        if (connected_callback_)
+        if (connected_callback_ && callback_executor_)
+            PostCallback(boost::bind(connected_callback_, true, currentSettings_, std::string()));
+        else if (connected_callback_)
+        {
+            CallbackTimer timer(*callback_time_);
             connected_callback_(true, currentSettings_, "");
+        }
         else
             LOG(ERROR) << "libmumble: Connected successfully but not callback has been set, use SetConnectedCallback() to set one!";
     }
 
-    void MumbleClient::Disconnect() 
+    void MumbleClient::HandleConnectError(const boost::system::error_code& error, const char* stage)
+    {
+        if (error_callback_)
+            DispatchError(error);
+        else
+            LOG(ERROR) << "libmumble: " << stage << " error: " << error.message();
+
+        if (connected_callback_ && callback_executor_)
+            PostCallback(boost::bind(connected_callback_, false, currentSettings_, error.message()));
+        else if (connected_callback_)
+        {
+            CallbackTimer timer(*callback_time_);
+            connected_callback_(false, currentSettings_, error.message());
+        }
+        else
+            LOG(ERROR) << "libmumble: Connection failed but not callback has been set, use SetConnectedCallback() to set one!";
+    }
+
+    void MumbleClient::StartConnectTimer()
+    {
+        connect_timer_->expires_from_now(boost::posix_time::seconds(connect_timeout_));
+        connect_timer_->async_wait(strand_->wrap(Track(boost::bind(&MumbleClient::ConnectTimeout, this, boost::asio::placeholders::error, ++connect_attempt_))));
+    }
+
+    void MumbleClient::StopConnectTimer()
+    {
+        // Bumping the attempt also invalidates an expiry that is already queued
+        ++connect_attempt_;
+        connect_timer_->cancel();
+    }
+
+    void MumbleClient::ConnectTimeout(const boost::system::error_code& error, uint32_t attempt)
+    {
+        // Timer was cancelled or belongs to an attempt that already finished
+        if (error || attempt != connect_attempt_ || state_ == kStateDisconnected || !tcp_socket_)
+            return;
+
+        LOG(WARNING) << "libmumble: Connection attempt timed out after " << connect_timeout_ << " seconds";
+        // Closing the socket aborts the pending connect or handshake
+        boost::system::error_code ignored;
+        tcp_socket_->lowest_layer().close(ignored);
+    }
+
+    void MumbleClient::Disconnect(const DisconnectedCallbackType& done) 
+    {
+        strand_->post(Track(boost::bind(&MumbleClient::ApplyDisconnectRequest, this, done)));
+    }
+
+    void MumbleClient::ApplyDisconnectRequest(const DisconnectedCallbackType& done) 
+    {
+        ApplyDisconnect();
+
+        if (done && callback_executor_)
+            PostCallback(done);
+        else if (done)
+        {
+            CallbackTimer timer(*callback_time_);
+            done();
+        }
+    }
+
+    void MumbleClient::ApplyTeardown() 
+    {
+        if (state_ != kStateDisconnected)
+            ApplyDisconnect();
+    }
+
+    bool MumbleClient::HandlersIdle() const 
+    {
+        // Every pending or running handler holds a reference
+        if (handler_state_.use_count() > 1)
+            return false;
+
+        // Pairs with the release of the last handler's reference, so what
+        // the handlers wrote is visible to the caller
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        return true;
+    }
+
+    void MumbleClient::WaitForHandlers() 
+    {
+        while (!HandlersIdle())
+        {
+            // Nobody else runs the io_service, as under Poll() or before
+            // Run(), or this thread is running it already
+            bool run_here = !lib_ || !lib_->IsShardRunning(shard_);
+
+            if (io_service_->stopped())
+            {
+                // Handlers left on a stopped io_service of the caller are
+                // destroyed with it unrun. The library resets the shards it
+                // runs, and an io_service stops whenever a poll runs out of
+                // work, so their handlers would still run later.
+                if (!run_here)
+                    return;
+                io_service_->reset();
+            }
+
+#if BOOST_VERSION >= 106600
+            run_here = run_here || io_service_->get_executor().running_in_this_thread();
+#endif
+            if (run_here && io_service_->poll_one() > 0)
+                continue;
+
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+    }
+
+    void MumbleClient::ApplyDisconnect() 
     {
         state_ = kStateDisconnected;
 
@@ -275,10 +624,21 @@ namespace MumbleClient
             SAFE_DELETE(ping_timer_);
         }
 
+        if (connect_timer_)
+        {
+            try { connect_timer_->cancel(); }
+            catch(boost::system::system_error &error) { std::cout << "   Error: connect_timer_->cancel() : " << error.what() << std::endl; }
+        }
+
+        if (resolving_ && resolver_)
+            resolver_->cancel();
+
         std::cout << "-- Clearing user/channel lists" << std::endl;
-        send_queue_.clear();
-        user_list_.clear();
-        channel_list_.clear();
+        ClearSendQueue();
+        processing_tcp_queue_ = false;
+        users_.clear();
+        channels_.clear();
+        PublishRegistrySizes();
 
         if (udp_socket_)
         {
@@ -309,112 +669,185 @@ namespace MumbleClient
         if (error) 
         {
             if (error_callback_)
-                error_callback_(error);
+                DispatchError(error);
             else
                 LOG(ERROR) << "libmumble::SendPing: " << error.message();
             return;
         }
 
         MumbleProto::Ping p;
-        p.set_timestamp(std::time(NULL));
-        SendMessage(PbMessageType::Ping, p, false);
+        p.set_timestamp(CurrentMicroseconds());
+        p.set_good(cs_->getGood());
+        p.set_late(cs_->getLate());
+        p.set_lost(cs_->getLost());
+        p.set_resync(cs_->getResync());
+        if (udp_ping_samples_ > 0) 
+        {
+            p.set_udp_ping_avg(udp_ping_avg_.load(boost::memory_order_relaxed));
+            p.set_udp_ping_var(udp_ping_var_.load(boost::memory_order_relaxed));
+        }
+        QueueMessage(PbMessageType::Ping, p, false);
+
+        // Fall back to tunnelling voice once UDP pings stop coming back
+        if (udp_active_ && CurrentMicroseconds() - udp_last_ping_reply_ > kUdpPingTimeout * 1000000ULL) 
+        {
+            udp_active_ = false;
+            LOG(WARNING) << "libmumble: No UDP ping reply, tunnelling voice over TCP";
+        }
+        SendUdpPing();
 
         // Requeue ping
         if (!ping_timer_)
             ping_timer_ = new boost::asio::deadline_timer(*io_service_);
 
-        ping_timer_->expires_from_now(boost::posix_time::seconds(5));
-        ping_timer_->async_wait(boost::bind(&MumbleClient::SendPing, this, boost::asio::placeholders::error));
+        ping_timer_->expires_from_now(boost::posix_time::seconds(kPingInterval));
+        ping_timer_->async_wait(strand_->wrap(Track(boost::bind(&MumbleClient::SendPing, this, boost::asio::placeholders::error))));
+    }
+
+    // Bound to a const reference by posix_time::seconds(), so it needs storage
+    const int32_t MumbleClient::kPingInterval;
+
+    // Indexed by PbMessageType
+    const MumbleClient::MessageRoute MumbleClient::kMessageRoutes[] = 
+    {
+        { false, 0 },                                       // Version
+        { false, &MumbleClient::HasTunnelCallback },        // UDPTunnel
+        { false, 0 },                                       // Authenticate
+        { true, 0 },                                        // Ping
+        { false, 0 },                                       // Reject
+        { true, 0 },                                        // ServerSync
+        { true, 0 },                                        // ChannelRemove
+        { true, 0 },                                        // ChannelState
+        { true, 0 },                                        // UserRemove
+        { true, 0 },                                        // UserState
+        { false, 0 },                                       // BanList
+        { false, &MumbleClient::HasTextMessageCallback },   // TextMessage
+        { false, 0 },                                       // PermissionDenied
+        { false, 0 },                                       // ACL
+        { false, 0 },                                       // QueryUsers
+        { true, 0 },                                        // CryptSetup
+        { false, 0 },                                       // ContextActionAdd
+        { false, 0 },                                       // ContextAction
+        { false, 0 },                                       // UserList
+        { false, 0 },                                       // VoiceTarget
+        { false, 0 },                                       // PermissionQuery
+        { false, 0 },                                       // CodecVersion
+        { false, 0 },                                       // UserStats
+        { false, 0 },                                       // RequestBlob
+        { false, 0 }                                        // ServerConfig
+    };
+
+    bool MumbleClient::WantsMessage(int32_t type) const
+    {
+        BOOST_STATIC_ASSERT(sizeof(kMessageRoutes) / sizeof(kMessageRoutes[0]) == kPbMessageTypeCount);
+
+        if (type < 0 || type >= kPbMessageTypeCount)
+            return false;
+
+        const MessageRoute& route = kMessageRoutes[type];
+        return route.internal || (route.has_callback && (this->*route.has_callback)());
     }
 
     void MumbleClient::ParseMessage(const MessageHeader& msg_header, void* buffer) 
     {
+        MC_TRACE_SCOPE_ID("ParseMessage", this);
+
         switch (msg_header.type()) 
         {
-        case PbMessageType::Version: 
-        {
-            MumbleProto::Version v = ConstructProtobufObject<MumbleProto::Version>(buffer, msg_header.length(), true);
-            // NOT_IMPLEMENTED
-            LOG(INFO) << "libmumble: PbMessageType::Version handling not implemented!";
-            break;
-        }
         case PbMessageType::Ping:
         {
-            MumbleProto::Ping p = ConstructProtobufObject<MumbleProto::Ping>(buffer, msg_header.length(), false);
-            // NOT_IMPLEMENTED
-            //LOG(INFO) << "PbMessageType::Ping handling not implemented!";
+            wire_decoder::PingView p;
+            DecodeMessage(parsed_->ping, buffer, msg_header.length(), p, false);
+
+            // The server echoes our timestamp
+            uint64_t now = CurrentMicroseconds();
+            if (p.has_timestamp && p.timestamp <= now)
+                tcp_rtt_.Record(now - p.timestamp);
+            if (p.has_good)
+            {
+                cs_->setRemoteStats(p.good, p.late, p.lost, p.resync);
+                PublishCryptStats();
+            }
             break;
         }
         case PbMessageType::ChannelRemove: 
         {
-            MumbleProto::ChannelRemove cr = ConstructProtobufObject<MumbleProto::ChannelRemove>(buffer, msg_header.length(), true);
+            const MumbleProto::ChannelRemove& cr = ParseProtobufObject(parsed_->channel_remove, buffer, msg_header.length(), true);
             HandleChannelRemove(cr);
             break;
         }
         case PbMessageType::ChannelState: 
         {
-            MumbleProto::ChannelState cs = ConstructProtobufObject<MumbleProto::ChannelState>(buffer, msg_header.length(), true);
+            const MumbleProto::ChannelState& cs = ParseProtobufObject(parsed_->channel_state, buffer, msg_header.length(), true);
             HandleChannelState(cs);
             break;
         }
         case PbMessageType::UserRemove: 
         {
-            MumbleProto::UserRemove ur = ConstructProtobufObject<MumbleProto::UserRemove>(buffer, msg_header.length(), true);
+            const MumbleProto::UserRemove& ur = ParseProtobufObject(parsed_->user_remove, buffer, msg_header.length(), true);
             HandleUserRemove(ur);
             break;
         }
         case PbMessageType::UserState: 
         {
-            MumbleProto::UserState us = ConstructProtobufObject<MumbleProto::UserState>(buffer, msg_header.length(), true);
+            wire_decoder::UserStateView us;
+            DecodeMessage(parsed_->user_state, buffer, msg_header.length(), us, true);
             HandleUserState(us);
             break;
         }
         case PbMessageType::TextMessage: 
         {
-            MumbleProto::TextMessage tm = ConstructProtobufObject<MumbleProto::TextMessage>(buffer, msg_header.length(), true);
-            if (text_message_callback_)
+            const MumbleProto::TextMessage& tm = ParseProtobufObject(parsed_->text_message, buffer, msg_header.length(), true);
+            if (text_message_callback_ && callback_executor_)
+                PostCallback(boost::bind(text_message_callback_, tm.message()));
+            else if (text_message_callback_) {
+                CallbackTimer timer(*callback_time_);
                 text_message_callback_(tm.message());
+            }
             break;
         }
         case PbMessageType::CryptSetup: 
         {
-            MumbleProto::CryptSetup cs = ConstructProtobufObject<MumbleProto::CryptSetup>(buffer, msg_header.length(), true);
+            MumbleProto::CryptSetup& cs = ParseProtobufObject(parsed_->crypt_setup, buffer, msg_header.length(), true);
             if (cs.has_key() && cs.has_client_nonce() && cs.has_server_nonce()) {
                 cs_->setKey(reinterpret_cast<const unsigned char *>(cs.key().data()), reinterpret_cast<const unsigned char *>(cs.client_nonce().data()), reinterpret_cast<const unsigned char *>(cs.server_nonce().data()));
             } else if (cs.has_server_nonce()) {
                 LOG(WARNING) << "Crypt resync";
                 cs_->setDecryptIV(reinterpret_cast<const unsigned char *>(cs.server_nonce().data()));
+                PublishCryptStats();
             } else {
                 cs.Clear();
                 cs.set_client_nonce(reinterpret_cast<const char *>(cs_->getEncryptIV()));
-                SendMessage(PbMessageType::CryptSetup, cs, true);
+                QueueMessage(PbMessageType::CryptSetup, cs, true);
             }
             break;
         }
-        case PbMessageType::CodecVersion: 
-        {
-            MumbleProto::CodecVersion cv = ConstructProtobufObject<MumbleProto::CodecVersion>(buffer, msg_header.length(), true);
-            // NOT_IMPLEMENTED
-            LOG(INFO) << "PbMessageType::CodecVersion handling not implemented!";
-            break;
-        }
         case PbMessageType::ServerSync: 
         {
-            MumbleProto::ServerSync ss = ConstructProtobufObject<MumbleProto::ServerSync>(buffer, msg_header.length(), true);
+            const MumbleProto::ServerSync& ss = ParseProtobufObject(parsed_->server_sync, buffer, msg_header.length(), true);
             state_ = kStateAuthenticated;
             session_ = ss.session();
 
             // Enqueue ping
             SendPing(boost::system::error_code());
 
-            if (auth_callback_)
+            if (auth_callback_ && callback_executor_)
+                PostCallback(auth_callback_);
+            else if (auth_callback_) {
+                CallbackTimer timer(*callback_time_);
                 auth_callback_();
+            }
             break;
         }
         case PbMessageType::UDPTunnel: 
         {
-            if (raw_udp_tunnel_callback_)
-                raw_udp_tunnel_callback_(msg_header.length(), buffer);
+            if (voice_slice_callback_) {
+                // The framer reuses its buffer, so the packet is copied once into a slab
+                boost::intrusive_ptr<SliceBuffer> slice_buffer = recv_pool_->Allocate(msg_header.length());
+                memcpy(slice_buffer->data(), buffer, msg_header.length());
+                DispatchSlice(VoiceSlice(slice_buffer, msg_header.length()));
+            } else if (raw_udp_tunnel_callback_)
+                DispatchPacket(raw_udp_tunnel_callback_, msg_header.length(), buffer);
             break;
         }
         default:
@@ -422,109 +855,194 @@ namespace MumbleClient
         }
     }
 
-    boost::shared_ptr<User> MumbleClient::FindUser(int32_t session) {
-        for (user_list_iterator it = user_list_.begin(); it != user_list_.end(); ++it) {
-            if ((*it)->session == session)
-                return *it;
+    boost::shared_ptr<User> MumbleClient::GetUser(int32_t session) const {
+        user_map::const_iterator it = users_.find(session);
+        if (it == users_.end())
+            return boost::shared_ptr<User>();
+
+        return it->second;
+    }
+
+    boost::shared_ptr<Channel> MumbleClient::GetChannel(int32_t id) const {
+        channel_map::const_iterator it = channels_.find(id);
+        if (it == channels_.end())
+            return boost::shared_ptr<Channel>();
+
+        return it->second;
+    }
+
+    // The maps themselves are only touched on the strand
+    void MumbleClient::PublishRegistrySizes() {
+        user_count_.Set(users_.size());
+        channel_count_.Set(channels_.size());
+    }
+
+    void MumbleClient::PostCallback(const CallbackExecutor::Task& task) {
+        callback_executor_->Post(boost::bind(&RunTimedCallback, callback_time_, task));
+    }
+
+    void MumbleClient::DispatchError(const boost::system::error_code& error) {
+        if (callback_executor_) {
+            PostCallback(boost::bind(error_callback_, error));
+            return;
+        }
+
+        CallbackTimer timer(*callback_time_);
+        error_callback_(error);
+    }
+
+    void MumbleClient::DispatchPacket(const RawUdpTunnelCallbackType& callback, int32_t length, void* buffer) {
+        if (!callback_executor_) {
+            MC_TRACE_SCOPE_ID("PacketCallback", this);
+            CallbackTimer timer(*callback_time_);
+            callback(length, buffer);
+            return;
+        }
+
+        const char* data = static_cast<const char*>(buffer);
+        boost::shared_ptr< std::vector<char> > packet = boost::make_shared< std::vector<char> >(data, data + length);
+        PostCallback(boost::bind(&CallWithPacket, callback, packet));
+    }
+
+    void MumbleClient::DispatchSlice(const VoiceSlice& slice) {
+        if (callback_executor_) {
+            // The slice keeps the buffer alive until the executor runs it
+            PostCallback(boost::bind(voice_slice_callback_, slice));
+            return;
+        }
+
+        MC_TRACE_SCOPE_ID("PacketCallback", this);
+        CallbackTimer timer(*callback_time_);
+        voice_slice_callback_(slice);
+    }
+
+    void MumbleClient::DispatchUser(const UserJoinedCallbackType& callback, const User& user) {
+        if (callback_executor_) {
+            PostCallback(boost::bind(&CallWithUser, callback, SnapshotUser(user)));
+            return;
+        }
+
+        CallbackTimer timer(*callback_time_);
+        callback(user);
+    }
+
+    void MumbleClient::DispatchUserMoved(const User& user, const Channel& channel) {
+        if (callback_executor_) {
+            PostCallback(boost::bind(&CallWithUserMoved, user_moved_callback_, SnapshotUser(user), SnapshotChannel(channel)));
+            return;
         }
 
-        return boost::shared_ptr<User>();
+        CallbackTimer timer(*callback_time_);
+        user_moved_callback_(user, channel);
     }
 
-    boost::shared_ptr<Channel> MumbleClient::FindChannel(int32_t id) {
-        for (channel_list_iterator it = channel_list_.begin(); it != channel_list_.end(); ++it) {
-            if ((*it)->id == id)
-                return *it;
+    void MumbleClient::DispatchChannel(const ChannelAddCallbackType& callback, const Channel& channel) {
+        if (callback_executor_) {
+            PostCallback(boost::bind(&CallWithChannel, callback, SnapshotChannel(channel)));
+            return;
         }
 
-        return boost::shared_ptr<Channel>();
+        CallbackTimer timer(*callback_time_);
+        callback(channel);
     }
 
     void MumbleClient::HandleUserRemove(const MumbleProto::UserRemove& ur) {
-        boost::shared_ptr<User> u = FindUser(ur.session());
+        MC_TRACE_SCOPE_ID("HandleUserRemove", this);
+
+        boost::shared_ptr<User> u = GetUser(ur.session());
         assert(u);
 
         if (u) {
-            user_list_.remove(u);
+            users_.erase(ur.session());
+            PublishRegistrySizes();
 
             if (user_left_callback_)
-                user_left_callback_(*u);
+                DispatchUser(user_left_callback_, *u);
         }
     }
 
-    void MumbleClient::HandleUserState(const MumbleProto::UserState& us) {
-        boost::shared_ptr<User> u = FindUser(us.session());
+    void MumbleClient::HandleUserState(const wire_decoder::UserStateView& us) {
+        MC_TRACE_SCOPE_ID("HandleUserState", this);
+
+        boost::shared_ptr<User> u = GetUser(us.session);
         if (!u) {
             // New user
-            boost::shared_ptr<Channel> c = FindChannel(us.channel_id());
+            boost::shared_ptr<Channel> c = GetChannel(us.channel_id);
             assert(c);
 
-            boost::shared_ptr<User> nu = boost::make_shared<User>(us.session(), c);
-            nu->name = us.name();
-            if (us.has_hash())
-                nu->hash = us.hash();
+            boost::shared_ptr<User> nu = boost::make_shared<User>(us.session, c);
+            nu->name.assign(us.name.data, us.name.size);
+            if (us.has_hash)
+                nu->hash.assign(us.hash.data, us.hash.size);
 
-            if (us.has_comment())
-                nu->comment = us.comment();
+            if (us.has_comment)
+                nu->comment.assign(us.comment.data, us.comment.size);
 
             DLOG(INFO) << "New user " << nu->name;
-            user_list_.push_back(nu);
+            users_.insert(std::make_pair(nu->session, nu));
+            PublishRegistrySizes();
 
             if (user_joined_callback_)
-                user_joined_callback_(*nu);
+                DispatchUser(user_joined_callback_, *nu);
 
             return;
         }
 
         DLOG(INFO) << "Found user " << u->name;
-        if (us.has_channel_id()) {
+        if (us.has_channel_id) {
             // Channel changed
-            boost::shared_ptr<Channel> c = FindChannel(us.channel_id());
+            boost::shared_ptr<Channel> c = GetChannel(us.channel_id);
             assert(c);
 
             boost::shared_ptr<Channel> oc = u->channel.lock();
             u->channel = c;
 
             if (user_moved_callback_)
-                user_moved_callback_(*u, *oc);
+                DispatchUserMoved(*u, *oc);
         }
 
-        if (us.has_comment()) {
-            u->comment = us.comment();
+        if (us.has_comment) {
+            u->comment.assign(us.comment.data, us.comment.size);
             // user_comment_changed_callback_
         }
     }
 
     void MumbleClient::HandleChannelRemove(const MumbleProto::ChannelRemove& cr) {
-        boost::shared_ptr<Channel> c = FindChannel(cr.channel_id());
+        MC_TRACE_SCOPE_ID("HandleChannelRemove", this);
+
+        boost::shared_ptr<Channel> c = GetChannel(cr.channel_id());
         assert(c);
 
         if (c) {
-            channel_list_.remove(c);
+            channels_.erase(cr.channel_id());
+            PublishRegistrySizes();
 
             if (channel_remove_callback_)
-                channel_remove_callback_(*c);
+                DispatchChannel(channel_remove_callback_, *c);
         }
     }
 
     void MumbleClient::HandleChannelState(const MumbleProto::ChannelState& cs) {
-        boost::shared_ptr<Channel> c = FindChannel(cs.channel_id());
+        MC_TRACE_SCOPE_ID("HandleChannelState", this);
+
+        boost::shared_ptr<Channel> c = GetChannel(cs.channel_id());
         if (!c) {
             // New channel
             boost::shared_ptr<Channel> nc = boost::make_shared<Channel>(cs.channel_id());
             nc->name = cs.name();
 
             if (cs.parent() != 0) {
-                boost::shared_ptr<Channel> p = FindChannel(cs.parent());
+                boost::shared_ptr<Channel> p = GetChannel(cs.parent());
                 assert(p);
                 nc->parent = p;
             }
 
             DLOG(INFO) << "New channel " << nc->name;
-            channel_list_.push_back(nc);
+            channels_.insert(std::make_pair(nc->id, nc));
+            PublishRegistrySizes();
 
             if (channel_add_callback_)
-                channel_add_callback_(*nc);
+                DispatchChannel(channel_add_callback_, *nc);
 
             return;
         }
@@ -535,16 +1053,16 @@ namespace MumbleClient
     #if !defined(NDEBUG)
     void MumbleClient::PrintChannelList() {
         DLOG(INFO) << "-- Channel list --";
-        for (channel_list_iterator it = channel_list_.begin(); it != channel_list_.end(); ++it) {
-            DLOG(INFO) << "Channel " << (*it)->name;
+        for (channel_map_iterator it = channels_.begin(); it != channels_.end(); ++it) {
+            DLOG(INFO) << "Channel " << it->second->name;
         }
         DLOG(INFO) << "-- Channel list end --";
     }
 
     void MumbleClient::PrintUserList() {
         DLOG(INFO) << "-- User list --";
-        for (user_list_iterator it = user_list_.begin(); it != user_list_.end(); ++it) {
-            DLOG(INFO) << "User " << (*it)->name << " on " << (*it)->channel.lock()->name;
+        for (user_map_iterator it = users_.begin(); it != users_.end(); ++it) {
+            DLOG(INFO) << "User " << it->second->name << " on " << it->second->channel.lock()->name;
         }
         DLOG(INFO) << "-- User list end --";
     }
@@ -553,112 +1071,348 @@ namespace MumbleClient
 
     void MumbleClient::ProcessTCPSendQueue(const boost::system::error_code& error, const size_t /*bytes_transferred*/) 
     {
+        MC_TRACE_SCOPE_ID("ProcessTCPSendQueue", this);
+
         if (state_ == kStateDisconnected)
             return;
 
         if (!error) 
         {
-            send_queue_.pop_front();
-            if (send_queue_.empty())
+            if (control_queue_.empty() && voice_queue_.empty())
             {
                 processing_tcp_queue_ = false;
                 return;
             }
 
-            SendFirstQueued();
+            SendQueued();
         } 
         else 
         {
             processing_tcp_queue_ = false;
             if (error_callback_)
-                error_callback_(error);
+                DispatchError(error);
             else
                 LOG(ERROR) << "Write error: " << error.message();
         }
     }
 
-    void MumbleClient::SendFirstQueued() 
+    void MumbleClient::SendQueued() 
     {
+        MC_TRACE_SCOPE_ID("SendQueued", this);
+
+        // Header and body of as many queued messages as fit go into one
+        // contiguous buffer, so the TLS layer makes one record for the lot
+        // instead of two per message. A message larger than the buffer is
+        // sent on its own. Control messages go first, voice fills the rest.
+        tcp_write_buffer_.clear();
+        size_t count = PackFrames(control_queue_, 0);
+        DropStaleVoice();
+        count = PackFrames(voice_queue_, count);
+
+        if (count == 0)
+        {
+            // Everything left was stale voice
+            processing_tcp_queue_ = false;
+            return;
+        }
         processing_tcp_queue_ = true;
-        boost::shared_ptr<Message>& msg = send_queue_.front();
 
-        std::vector<boost::asio::const_buffer> bufs;
-        bufs.push_back(boost::asio::buffer(msg->header_.data(), 6));
-        bufs.push_back(boost::asio::buffer(msg->msg_, msg->msg_.size()));
+        PublishQueueDepths();
+        tcp_writes_.Add(1);
+        tcp_bytes_sent_.Add(tcp_write_buffer_.size());
+        tcp_messages_sent_.Add(count);
 
-        async_write(*tcp_socket_, bufs, boost::bind(&MumbleClient::ProcessTCPSendQueue, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-        DLOG(INFO) << "<< ASYNC Type: " << msg->header_.type() << " Length: 6+" << msg->msg_.size();
+        async_write(*tcp_socket_, boost::asio::buffer(tcp_write_buffer_), strand_->wrap(MakeMemoryHandler(handler_state_->tcp_write_memory, Track(boost::bind(&MumbleClient::ProcessTCPSendQueue, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)))));
+        DLOG(INFO) << "<< ASYNC " << count << " messages, " << tcp_write_buffer_.size() << " bytes";
     }
 
-    bool MumbleClient::HandleMessageContent(std::istream& is, const MessageHeader& msg_header) {
-        if (static_cast<int32_t>(recv_buffer_.size()) < msg_header.length()) {
-            // The message is incomplete, read the rest
-            if (tcp_socket_)
-                async_read(*tcp_socket_, recv_buffer_, boost::asio::transfer_at_least(msg_header.length() - recv_buffer_.size()), boost::bind(&MumbleClient::ReadHandlerContinue, this, msg_header, boost::asio::placeholders::error));
-            return false;
+    size_t MumbleClient::PackFrames(boost::circular_buffer<QueuedFrame>& queue, size_t packed) 
+    {
+        // The write buffer keeps its own copy, so frames are released as
+        // soon as they are packed
+        while (!queue.empty())
+        {
+            const QueuedFrame& frame = queue.front();
+            if (packed > 0 && tcp_write_buffer_.size() + frame.length > kTcpWriteBufferSize)
+                break;
+
+            tcp_write_buffer_.insert(tcp_write_buffer_.end(), frame.data, frame.data + frame.length);
+            CountMessage(messages_out_, bytes_out_, MessageHeader(frame.data).type(), frame.length);
+            ReleaseFrame(frame);
+            queue.pop_front();
+            ++packed;
         }
 
-        // Receive message body
-        char* buffer = new char[msg_header.length()];
-        is.read(buffer, msg_header.length());
-        ParseMessage(msg_header, buffer);
-        delete[] buffer;
+        return packed;
+    }
+
+    void MumbleClient::DropStaleVoice() 
+    {
+        if (voice_queue_.empty() || voice_max_age_ == 0)
+            return;
 
-        return true;
+        uint64_t cutoff = CurrentMicroseconds();
+        uint64_t max_age = static_cast<uint64_t>(voice_max_age_) * 1000;
+        cutoff = cutoff > max_age ? cutoff - max_age : 0;
+
+        while (!voice_queue_.empty() && voice_queue_.front().queued_at < cutoff)
+        {
+            ReleaseFrame(voice_queue_.front());
+            voice_queue_.pop_front();
+            voice_dropped_age_.Add(1);
+        }
     }
 
-    void MumbleClient::ReadHandler(const boost::system::error_code& error) 
+    void MumbleClient::ReadHandler(const boost::system::error_code& error, const size_t bytes_transferred) 
     {
+        MC_TRACE_SCOPE_ID("ReadHandler", this);
+
         if (state_ == kStateDisconnected)
             return;
 
         if (error) 
         {
             if (error_callback_)
-                error_callback_(error);
+                DispatchError(error);
             else
                 LOG(ERROR) << "read error: " << error.message();
             return;
         }
 
-        std::istream is(&recv_buffer_);
-        do {
-            // Receive message header
-            MessageHeader msg_header;
-            is >> msg_header;
+        recv_framer_->Commit(bytes_transferred);
 
-            if (msg_header.length() >= 0x7FFFF)
-                assert(false);
+        // Hand every complete frame to the parser straight from the receive buffer
+        MessageHeader msg_header;
+        char* body = 0;
+        MessageFramer::Result result;
+        while ((result = recv_framer_->Next(msg_header, body)) == MessageFramer::kFrame) 
+        {
+            CountMessage(messages_in_, bytes_in_, msg_header.type(), MessageHeader::kSize + msg_header.length());
+            if (!WantsMessage(msg_header.type()))
+            {
+                CountMessage(messages_skipped_, bytes_skipped_, msg_header.type(), MessageHeader::kSize + msg_header.length());
+                continue;
+            }
 
-            if (!HandleMessageContent(is, msg_header))
+            ParseMessage(msg_header, body);
+            if (state_ == kStateDisconnected)
                 return;
-        } while (recv_buffer_.size() >= 6);
+        }
+
+        if (result == MessageFramer::kInvalid)
+        {
+            // Frame boundaries are lost, nothing after this header can be trusted
+            LOG(ERROR) << "libmumble: Invalid message - Type: " << msg_header.type() << " Length: " << msg_header.length();
+            if (error_callback_)
+                DispatchError(boost::system::errc::make_error_code(boost::system::errc::bad_message));
+            ApplyDisconnect();
+            return;
+        }
 
         // Requeue read
         if (tcp_socket_)
-            async_read(*tcp_socket_, recv_buffer_, boost::asio::transfer_at_least(6), boost::bind(&MumbleClient::ReadHandler, this, boost::asio::placeholders::error));
+            tcp_socket_->async_read_some(recv_framer_->Prepare(), strand_->wrap(Track(boost::bind(&MumbleClient::ReadHandler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred))));
     }
 
-    void MumbleClient::ReadHandlerContinue(const MessageHeader msg_header, const boost::system::error_code& error) 
+    void MumbleClient::StartUdpReceive() 
     {
-        if (state_ == kStateDisconnected)
+        if (!udp_socket_)
+            return;
+
+        if (udp_batching_)
+            udp_socket_->async_receive(boost::asio::null_buffers(), strand_->wrap(Track(boost::bind(&MumbleClient::HandleUdpReadable, this, boost::asio::placeholders::error))));
+        else
+            udp_socket_->async_receive(boost::asio::buffer(udp_recv_buffer_, kUdpBufferSize), strand_->wrap(Track(boost::bind(&MumbleClient::HandleUdpReceive, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred))));
+    }
+
+    void MumbleClient::HandleUdpReceive(const boost::system::error_code& error, const size_t bytes_transferred) 
+    {
+        MC_TRACE_SCOPE_ID("HandleUdpReceive", this);
+
+        if (state_ == kStateDisconnected || error == boost::asio::error::operation_aborted)
             return;
 
         if (error) 
-        {    
-            if (error_callback_)
-                error_callback_(error);
-            else
-                LOG(ERROR) << "read error: " << error.message();
+        {
+            // Errors on the UDP path (ICMP unreachable etc.) are not fatal, voice can still be tunnelled
+            DLOG(WARNING) << "libmumble: UDP receive error: " << error.message();
+            StartUdpReceive();
             return;
         }
 
-        std::istream is(&recv_buffer_);
-        HandleMessageContent(is, msg_header);
+        udp_recv_syscalls_.Add(1);
+        udp_packets_received_.Add(1);
 
-        // Requeue read
-        if (tcp_socket_)
-            async_read(*tcp_socket_, recv_buffer_, boost::asio::transfer_at_least(6), boost::bind(&MumbleClient::ReadHandler, this, boost::asio::placeholders::error));
+        // Packets arriving before CryptSetup or failing authentication are dropped
+        int32_t crypted_length = static_cast<int32_t>(bytes_transferred);
+        if (cs_->isValid() && crypted_length > 4) 
+        {
+            // Voice for the slice callback is decrypted straight into a slab
+            boost::intrusive_ptr<SliceBuffer> slice_buffer;
+            unsigned char* plain = udp_plain_buffer_;
+            if (WantsUdpSlices()) 
+            {
+                slice_buffer = recv_pool_->Allocate(crypted_length - 4);
+                plain = slice_buffer->data();
+            }
+
+            bool decrypted = cs_->decrypt(udp_recv_buffer_, plain, crypted_length);
+            PublishCryptStats();
+            if (decrypted)
+                DispatchUdpPacket(plain, crypted_length - 4, slice_buffer);
+        }
+
+        StartUdpReceive();
+    }
+
+    void MumbleClient::HandleUdpReadable(const boost::system::error_code& error) 
+    {
+        MC_TRACE_SCOPE_ID("HandleUdpReadable", this);
+
+        if (state_ == kStateDisconnected || error == boost::asio::error::operation_aborted)
+            return;
+
+        if (error) 
+        {
+            DLOG(WARNING) << "libmumble: UDP receive error: " << error.message();
+            StartUdpReceive();
+            return;
+        }
+
+        unsigned char* recv[kUdpBatchSize];
+        unsigned char* plain[kUdpBatchSize];
+        const unsigned char* sources[kUdpBatchSize];
+        unsigned int crypted_lengths[kUdpBatchSize];
+        size_t lengths[kUdpBatchSize];
+        bool results[kUdpBatchSize];
+
+        for (int32_t i = 0; i < kUdpBatchSize; ++i) 
+        {
+            recv[i] = &udp_batch_recv_[i * kUdpBufferSize];
+            plain[i] = &udp_batch_plain_[i * kUdpBufferSize];
+        }
+
+        // Drain what is queued on the socket, but give other sockets a turn
+        // if this one is flooded
+        for (int32_t round = 0; round < kUdpMaxBatchRounds; ++round) 
+        {
+            int received = udp_batch::Receive(udp_socket_->native_handle(), recv, kUdpBufferSize, lengths, kUdpBatchSize);
+            udp_recv_syscalls_.Add(1);
+            if (received <= 0)
+                break;
+            udp_packets_received_.Add(received);
+
+            if (cs_->isValid()) 
+            {
+                boost::intrusive_ptr<SliceBuffer> slice_buffers[kUdpBatchSize];
+                unsigned char* targets[kUdpBatchSize];
+                bool slices = WantsUdpSlices();
+                unsigned int count = 0;
+                for (int i = 0; i < received; ++i) 
+                {
+                    if (lengths[i] <= 4)
+                        continue;
+                    sources[count] = recv[i];
+                    crypted_lengths[count] = static_cast<unsigned int>(lengths[i]);
+                    if (slices) 
+                    {
+                        slice_buffers[count] = recv_pool_->Allocate(lengths[i] - 4);
+                        targets[count] = slice_buffers[count]->data();
+                    } 
+                    else
+                        targets[count] = plain[count];
+                    ++count;
+                }
+
+                cs_->decryptBatch(sources, targets, crypted_lengths, results, count);
+                PublishCryptStats();
+                for (unsigned int i = 0; i < count && state_ != kStateDisconnected; ++i) 
+                {
+                    if (results[i])
+                        DispatchUdpPacket(targets[i], static_cast<int32_t>(crypted_lengths[i]) - 4, slice_buffers[i]);
+                }
+            }
+
+            if (received < kUdpBatchSize || state_ == kStateDisconnected)
+                break;
+        }
+
+        StartUdpReceive();
+    }
+
+    void MumbleClient::DispatchUdpPacket(const unsigned char* buffer, int32_t length, const boost::intrusive_ptr<SliceBuffer>& slice_buffer) 
+    {
+        MC_TRACE_SCOPE_ID("DispatchUdpPacket", this);
+
+        int32_t type = (buffer[0] >> 5) & 0x7;
+        if (type == UdpMessageType::UDPPing) 
+        {
+            HandleUdpPing(buffer, length);
+        } 
+        else if (udp_voice_callback_) 
+        {
+            DispatchPacket(udp_voice_callback_, length, const_cast<unsigned char*>(buffer));
+        } 
+        else if (slice_buffer) 
+        {
+            DispatchSlice(VoiceSlice(slice_buffer, length));
+        } 
+        else if (raw_udp_tunnel_callback_) 
+        {
+            DispatchPacket(raw_udp_tunnel_callback_, length, const_cast<unsigned char*>(buffer));
+        }
+    }
+
+    void MumbleClient::SendUdpPing() 
+    {
+        if (!udp_socket_ || !cs_->isValid())
+            return;
+
+        unsigned char* buffer = AcquireUdpBuffer();
+        if (!buffer)
+            return;
+
+        unsigned char* data = buffer + kUdpCryptHeader;
+        data[0] = static_cast<unsigned char>(UdpMessageType::UDPPing << 5);
+        PacketDataStream pds(data + 1, kUdpBufferSize - kUdpCryptHeader - 1);
+        pds << CurrentMicroseconds();
+        TransmitUdpBuffer(buffer, pds.size() + 1);
+    }
+
+    void MumbleClient::HandleUdpPing(const unsigned char* buffer, int32_t length) 
+    {
+        // The server echoes our own ping, so the timestamp is ours
+        uint64_t timestamp = 0;
+        PacketDataStream pds(buffer + 1, length - 1);
+        pds >> timestamp;
+
+        uint64_t now = CurrentMicroseconds();
+        if (!pds.isValid() || timestamp > now)
+            return;
+
+        udp_rtt_.Record(now - timestamp);
+
+        // Smoothed round trip time and deviation in milliseconds, as in RFC 6298
+        float rtt = static_cast<float>(now - timestamp) / 1000.0f;
+        float avg = rtt;
+        float var = rtt / 2.0f;
+        if (udp_ping_samples_ > 0) 
+        {
+            avg = udp_ping_avg_.load(boost::memory_order_relaxed);
+            float deviation = avg > rtt ? avg - rtt : rtt - avg;
+            var = 0.75f * udp_ping_var_.load(boost::memory_order_relaxed) + 0.25f * deviation;
+            avg = 0.875f * avg + 0.125f * rtt;
+        }
+        udp_ping_avg_.store(avg, boost::memory_order_relaxed);
+        udp_ping_var_.store(var, boost::memory_order_relaxed);
+        ++udp_ping_samples_;
+        udp_last_ping_reply_ = now;
+
+        if (!udp_active_) 
+        {
+            udp_active_ = true;
+            LOG(INFO) << "libmumble: UDP ping reply received, sending voice over UDP";
+        }
     }
 
     void MumbleClient::SendMessage(PbMessageType::MessageType type, const ::google::protobuf::Message& new_msg, bool print) {
@@ -667,62 +1421,551 @@ namespace MumbleClient
             DLOG(INFO) << new_msg.DebugString();
         }
 
-        int32_t length = new_msg.ByteSize();
+        Submission submission;
+        submission.kind = Submission::kControl;
+        if (SerializeFrame(type, new_msg, submission.frame))
+            Submit(submission);
+    }
+
+    void MumbleClient::QueueMessage(PbMessageType::MessageType type, const ::google::protobuf::Message& new_msg, bool print) {
+        if (print) {
+            DLOG(INFO) << "<< ENQUEUE: " << type;
+            DLOG(INFO) << new_msg.DebugString();
+        }
+
+        QueuedFrame frame;
+        if (SerializeFrame(type, new_msg, frame))
+            QueueFrame(frame);
+    }
+
+    bool MumbleClient::SerializeFrame(PbMessageType::MessageType type, const ::google::protobuf::Message& msg, QueuedFrame& frame) {
+        // ByteSizeLong() caches the sizes that the serializer below relies on
+        size_t length = msg.ByteSizeLong();
+        if (length > static_cast<size_t>(MessageFramer::kMaxMessageLength)) {
+            LOG(WARNING) << "libmumble: Message of type " << type << " and " << length << " bytes too large, dropped";
+            return false;
+        }
+
+        unsigned char* body = AllocateFrame(type, static_cast<int32_t>(length), frame);
+        msg.SerializeWithCachedSizesToArray(body);
+        return true;
+    }
+
+    void MumbleClient::SendRawUdpTunnel(const char* buffer, int32_t len) {
+        if (len < 0 || len > MessageFramer::kMaxMessageLength) {
+            LOG(WARNING) << "libmumble: Tunnelled packet of " << len << " bytes invalid, dropped";
+            return;
+        }
+
+        Submission submission;
+        submission.kind = Submission::kTunnel;
+        unsigned char* body = AllocateFrame(PbMessageType::UDPTunnel, len, submission.frame);
+        memcpy(body, buffer, len);
+
+        Submit(submission);
+    }
+
+    void MumbleClient::Submit(const Submission& submission) {
+        bool lossless = submission.kind == Submission::kControl || submission.kind == Submission::kTunnel;
+
+        // Control messages and tunnelled voice go to the spill list while it
+        // holds anything, so they never overtake an earlier send of theirs
+        if (lossless && spilling_.load(boost::memory_order_acquire)) {
+            Spill(submission);
+        } else if (!submissions_.push(submission)) {
+            // Only fails when the io_service thread is a whole queue behind
+            if (lossless) {
+                Spill(submission);
+            } else {
+                submissions_dropped_.fetch_add(1, boost::memory_order_relaxed);
+                DLOG(WARNING) << "libmumble: Submission queue full, dropped";
+                ReleaseSubmission(submission);
+            }
+        }
+
+        // One wakeup per batch: only the producer that finds no drain
+        // pending posts one
+        if (!drain_posted_.exchange(true))
+            strand_->post(MakeMemoryHandler(handler_state_->drain_memory, Track(boost::bind(&MumbleClient::DrainSubmissions, this))));
+    }
+
+    void MumbleClient::Spill(const Submission& submission) {
+        boost::mutex::scoped_lock lock(spill_mutex_);
+        spill_.push_back(submission);
+        spilling_.store(true, boost::memory_order_release);
+        submissions_spilled_.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    void MumbleClient::DrainSubmissions() {
+        MC_TRACE_SCOPE_ID("DrainSubmissions", this);
+
+        // Cleared before popping, so anything pushed after the last pop
+        // below posts a new drain
+        drain_posted_.store(false);
+
+        ProcessSubmissions();
+        while (spilling_.load(boost::memory_order_acquire)) {
+            {
+                boost::mutex::scoped_lock lock(spill_mutex_);
+                if (spill_.empty()) {
+                    // Producers go back to the queue from here on
+                    spilling_.store(false, boost::memory_order_release);
+                    break;
+                }
+                spill_drain_.swap(spill_);
+            }
+
+            // Whatever reached the queue meanwhile was sent before anything
+            // spilled by the same producer, which sees the flag set
+            ProcessSubmissions();
+            for (size_t i = 0; i < spill_drain_.size(); ++i)
+                ProcessSubmission(spill_drain_[i]);
+            spill_drain_.clear();
+        }
+    }
+
+    void MumbleClient::ProcessSubmissions() {
+        Submission submission;
+        while (submissions_.pop(submission))
+            ProcessSubmission(submission);
+    }
+
+    void MumbleClient::ProcessSubmission(Submission& submission) {
+        switch (submission.kind) {
+        case Submission::kControl:
+            QueueFrame(submission.frame);
+            break;
+        case Submission::kTunnel:
+            QueueVoiceFrame(submission.frame);
+            break;
+        case Submission::kUdp:
+            TransmitUdpBuffer(submission.buffer, submission.length);
+            break;
+        case Submission::kVoice:
+            RouteVoice(submission.buffer, submission.length);
+            break;
+        }
+    }
+
+    void MumbleClient::DiscardSubmissions() {
+        Submission submission;
+        while (submissions_.pop(submission))
+            ReleaseSubmission(submission);
+
+        boost::mutex::scoped_lock lock(spill_mutex_);
+        for (size_t i = 0; i < spill_.size(); ++i)
+            ReleaseSubmission(spill_[i]);
+        spill_.clear();
+        spilling_.store(false);
+    }
+
+    void MumbleClient::ReleaseSubmission(const Submission& submission) {
+        if (submission.kind == Submission::kControl || submission.kind == Submission::kTunnel)
+            ReleaseFrame(submission.frame);
+        else
+            udp_send_pool_->Release(submission.buffer);
+    }
+
+    unsigned char* MumbleClient::AllocateFrame(PbMessageType::MessageType type, int32_t length, QueuedFrame& frame) {
+        frame.length = MessageHeader::kSize + length;
+        frame.data = 0;
+        frame.pooled = frame.length <= kTcpFrameSlabSize;
+        frame.queued_at = 0;
+
+        if (frame.pooled)
+            frame.data = tcp_frame_pool_->Acquire();
+        if (!frame.data) {
+            // Too large for a slab, or every slab is queued already
+            frame.data = new unsigned char[frame.length];
+            frame.pooled = false;
+        }
+
         MessageHeader msg_header;
         msg_header.type(static_cast<int16_t>(type));
         msg_header.length(length);
+        memcpy(frame.data, msg_header.data(), MessageHeader::kSize);
+
+        return frame.data + MessageHeader::kSize;
+    }
 
-        std::string pb_message = new_msg.SerializeAsString();
-        boost::shared_ptr<Message> m = boost::make_shared<Message>(msg_header, pb_message);
-        send_queue_.push_back(m);
+    void MumbleClient::QueueFrame(const QueuedFrame& frame) {
+        if (control_queue_.full())
+            control_queue_.set_capacity(control_queue_.capacity() * 2);
+        control_queue_.push_back(frame);
+        PublishQueueDepths();
 
-        if (state_ >= kStateHandshakeCompleted && !processing_tcp_queue_) {
-            SendFirstQueued();
+        if (state_ >= kStateHandshakeCompleted && state_ != kStateDisconnected && !processing_tcp_queue_) {
+            SendQueued();
         }
     }
 
-    void MumbleClient::SendRawUdpTunnel(const char* buffer, int32_t len) {
-        MessageHeader msg_header;
-        msg_header.type(PbMessageType::UDPTunnel);
-        msg_header.length(len);
+    void MumbleClient::QueueVoiceFrame(QueuedFrame& frame) {
+        if (voice_queue_.capacity() == 0) {
+            ReleaseFrame(frame);
+            voice_dropped_depth_.Add(1);
+            return;
+        }
+
+        if (voice_queue_.full()) {
+            ReleaseFrame(voice_queue_.front());
+            voice_queue_.pop_front();
+            voice_dropped_depth_.Add(1);
+        }
+
+        frame.queued_at = CurrentMicroseconds();
+        voice_queue_.push_back(frame);
+        PublishQueueDepths();
+
+        if (state_ >= kStateHandshakeCompleted && state_ != kStateDisconnected && !processing_tcp_queue_) {
+            SendQueued();
+        }
+    }
+
+    void MumbleClient::SetVoiceQueueLimits(uint32_t max_age_ms, size_t max_frames) {
+        strand_->post(Track(boost::bind(&MumbleClient::ApplyVoiceQueueLimits, this, max_age_ms, max_frames)));
+    }
+
+    void MumbleClient::ApplyVoiceQueueLimits(uint32_t max_age_ms, size_t max_frames) {
+        voice_max_age_ = max_age_ms;
+
+        while (voice_queue_.size() > max_frames) {
+            ReleaseFrame(voice_queue_.front());
+            voice_queue_.pop_front();
+            voice_dropped_depth_.Add(1);
+        }
+        voice_queue_.set_capacity(max_frames);
+        PublishQueueDepths();
+    }
+
+    // The queues themselves are only touched on the strand
+    void MumbleClient::PublishQueueDepths() {
+        control_depth_.Set(control_queue_.size());
+        voice_depth_.Set(voice_queue_.size());
+        if (control_queue_.size() > control_high_water_.Get())
+            control_high_water_.Set(control_queue_.size());
+        if (voice_queue_.size() > voice_high_water_.Get())
+            voice_high_water_.Set(voice_queue_.size());
+    }
+
+    SendQueueStats MumbleClient::GetSendQueueStats() const {
+        SendQueueStats stats;
+        stats.control_depth = static_cast<size_t>(control_depth_.Get());
+        stats.control_high_water = static_cast<size_t>(control_high_water_.Get());
+        stats.voice_depth = static_cast<size_t>(voice_depth_.Get());
+        stats.voice_high_water = static_cast<size_t>(voice_high_water_.Get());
+        stats.voice_dropped_age = voice_dropped_age_.Get();
+        stats.voice_dropped_depth = voice_dropped_depth_.Get();
+        stats.submissions_dropped = submissions_dropped_.load(boost::memory_order_relaxed);
+        stats.submissions_spilled = submissions_spilled_.load(boost::memory_order_relaxed);
+        return stats;
+    }
+
+    NetworkStats MumbleClient::GetNetworkStats() const {
+        NetworkStats stats;
+        stats.udp_packets_sent = udp_packets_sent_.Get();
+        stats.udp_packets_received = udp_packets_received_.Get();
+        stats.udp_send_syscalls = udp_send_syscalls_.Get();
+        stats.udp_recv_syscalls = udp_recv_syscalls_.Get();
+        stats.tcp_writes = tcp_writes_.Get();
+        stats.tcp_bytes_sent = tcp_bytes_sent_.Get();
+        stats.tcp_messages_sent = tcp_messages_sent_.Get();
+        stats.udp_pool_fallbacks = udp_pool_fallbacks_.load(boost::memory_order_relaxed);
+        return stats;
+    }
+
+    void MumbleClient::CountMessage(MetricCounter* messages, MetricCounter* bytes, int32_t type, size_t length) {
+        if (type < 0 || type >= kPbMessageTypeCount)
+            return;
+
+        messages[type].Add(1);
+        bytes[type].Add(length);
+    }
 
-        std::string data(buffer, len);
-        boost::shared_ptr<Message> m = boost::make_shared<Message>(msg_header, data);
-        send_queue_.push_back(m);
+    void MumbleClient::PublishCryptStats() {
+        crypt_good_.Set(cs_->getGood());
+        crypt_late_.Set(cs_->getLate());
+        crypt_lost_.Set(cs_->getLost());
+        crypt_resync_.Set(cs_->getResync());
+        crypt_remote_good_.Set(cs_->getRemoteGood());
+        crypt_remote_late_.Set(cs_->getRemoteLate());
+        crypt_remote_lost_.Set(cs_->getRemoteLost());
+        crypt_remote_resync_.Set(cs_->getRemoteResync());
+    }
 
-        if (state_ >= kStateHandshakeCompleted && !processing_tcp_queue_) {
-            SendFirstQueued();
+    MetricsSnapshot MumbleClient::GetMetrics() const {
+        MetricsSnapshot snapshot;
+        ClearMetrics(snapshot);
+        snapshot.clients = 1;
+
+        for (int32_t i = 0; i < kPbMessageTypeCount; ++i) {
+            snapshot.messages[i].messages_in = messages_in_[i].Get();
+            snapshot.messages[i].bytes_in = bytes_in_[i].Get();
+            snapshot.messages[i].messages_out = messages_out_[i].Get();
+            snapshot.messages[i].bytes_out = bytes_out_[i].Get();
+            snapshot.messages[i].messages_skipped = messages_skipped_[i].Get();
+            snapshot.messages[i].bytes_skipped = bytes_skipped_[i].Get();
         }
+
+        snapshot.network = GetNetworkStats();
+        snapshot.send_queue = GetSendQueueStats();
+
+        snapshot.crypt_local.good = crypt_good_.Get();
+        snapshot.crypt_local.late = crypt_late_.Get();
+        snapshot.crypt_local.lost = crypt_lost_.Get();
+        snapshot.crypt_local.resync = crypt_resync_.Get();
+        snapshot.crypt_remote.good = crypt_remote_good_.Get();
+        snapshot.crypt_remote.late = crypt_remote_late_.Get();
+        snapshot.crypt_remote.lost = crypt_remote_lost_.Get();
+        snapshot.crypt_remote.resync = crypt_remote_resync_.Get();
+
+        tcp_rtt_.Read(snapshot.tcp_rtt);
+        udp_rtt_.Read(snapshot.udp_rtt);
+        callback_time_->Read(snapshot.callback_time);
+        return snapshot;
+    }
+
+    void MumbleClient::ReleaseFrame(const QueuedFrame& frame) {
+        if (frame.pooled)
+            tcp_frame_pool_->Release(frame.data);
+        else
+            delete[] frame.data;
+    }
+
+    void MumbleClient::ClearSendQueue() {
+        for (boost::circular_buffer<QueuedFrame>::const_iterator it = control_queue_.begin(); it != control_queue_.end(); ++it)
+            ReleaseFrame(*it);
+        control_queue_.clear();
+
+        for (boost::circular_buffer<QueuedFrame>::const_iterator it = voice_queue_.begin(); it != voice_queue_.end(); ++it)
+            ReleaseFrame(*it);
+        voice_queue_.clear();
+        PublishQueueDepths();
     }
 
     void MumbleClient::SendUdpMessage(const char* buffer, int32_t len) {
-        assert(cs_->isValid());
+        if (len < 0 || len > kUdpBufferSize - kUdpCryptHeader) {
+            LOG(WARNING) << "libmumble: UDP packet of " << len << " bytes too large, dropped";
+            return;
+        }
 
-        unsigned char* buf = new unsigned char[len + 4];
-        cs_->encrypt(reinterpret_cast<const unsigned char *>(buffer), buf, len);
-        udp_socket_->send(boost::asio::buffer(buf, len + 4));
+        unsigned char* buf = AcquireUdpBuffer();
+        if (!buf)
+            return;
 
-        delete[] buf;
+        memcpy(buf + kUdpCryptHeader, buffer, len);
+        SendUdpBuffer(buf, len);
     }
 
-    void MumbleClient::SetComment(const std::string& text) {
-        BOOST_ASSERT(state_ >= kStateAuthenticated);
+    unsigned char* MumbleClient::AcquireUdpBuffer() {
+        unsigned char* buffer = udp_send_pool_->Acquire();
+        if (!buffer)
+            DLOG(WARNING) << "libmumble: UDP send pool exhausted";
+        return buffer;
+    }
+
+    void MumbleClient::ReleaseUdpBuffer(unsigned char* buffer) {
+        udp_send_pool_->Release(buffer);
+    }
+
+    void MumbleClient::SendUdpBuffer(unsigned char* buffer, int32_t len) {
+        Submission submission;
+        submission.kind = Submission::kUdp;
+        submission.buffer = buffer;
+        submission.length = len;
+
+        Submit(submission);
+    }
+
+    void MumbleClient::TransmitUdpBuffer(unsigned char* buffer, int32_t len) {
+        if (!udp_socket_ || !cs_->isValid() || len < 0 || len > kUdpBufferSize - kUdpCryptHeader) {
+            udp_send_pool_->Release(buffer);
+            return;
+        }
+
+        // Packets are encrypted in queue order, so keep queueing until the
+        // batch is flushed even if batching was just turned off
+        if (udp_batching_ || !udp_send_batch_.empty()) {
+            udp_send_batch_.push_back(std::make_pair(buffer, len));
+            if (!udp_flush_posted_) {
+                udp_flush_posted_ = true;
+                strand_->post(Track(boost::bind(&MumbleClient::FlushUdpSendBatch, this)));
+            }
+            return;
+        }
+
+        // OCB handles source == destination + header, so no second buffer is needed
+        cs_->encrypt(buffer + kUdpCryptHeader, buffer, len);
+        SendUdpEncrypted(buffer, len + kUdpCryptHeader);
+    }
+
+    void MumbleClient::SendUdpEncrypted(unsigned char* buffer, size_t length) {
+        udp_send_syscalls_.Add(1);
+        udp_packets_sent_.Add(1);
+        udp_socket_->async_send(boost::asio::buffer(buffer, length), strand_->wrap(MakeMemoryHandler(handler_state_->udp_send_memory, Track(boost::bind(&MumbleClient::HandleUdpSend, this, boost::asio::placeholders::error, buffer)))));
+    }
+
+    void MumbleClient::FlushUdpSendBatch() {
+        udp_flush_posted_ = false;
+
+        if (!udp_socket_ || !cs_->isValid()) {
+            for (size_t i = 0; i < udp_send_batch_.size(); ++i)
+                udp_send_pool_->Release(udp_send_batch_[i].first);
+            udp_send_batch_.clear();
+            return;
+        }
+
+        const unsigned char* sources[kUdpBatchSize];
+        unsigned char* buffers[kUdpBatchSize];
+        unsigned int plain_lengths[kUdpBatchSize];
+        size_t lengths[kUdpBatchSize];
+
+        for (size_t start = 0; start < udp_send_batch_.size(); start += kUdpBatchSize) {
+            int count = static_cast<int>(std::min<size_t>(kUdpBatchSize, udp_send_batch_.size() - start));
+            for (int i = 0; i < count; ++i) {
+                buffers[i] = udp_send_batch_[start + i].first;
+                sources[i] = buffers[i] + kUdpCryptHeader;
+                plain_lengths[i] = static_cast<unsigned int>(udp_send_batch_[start + i].second);
+                lengths[i] = plain_lengths[i] + kUdpCryptHeader;
+            }
+            cs_->encryptBatch(sources, buffers, plain_lengths, count);
+
+            int sent = 0;
+            while (sent < count) {
+                int n = udp_batch::Send(udp_socket_->native_handle(), buffers + sent, lengths + sent, count - sent);
+                udp_send_syscalls_.Add(1);
+                if (n <= 0)
+                    break;
+                sent += n;
+            }
+            udp_packets_sent_.Add(sent);
+
+            for (int i = 0; i < sent; ++i)
+                udp_send_pool_->Release(buffers[i]);
+
+            // The socket buffer is full or the call failed. Asio waits for
+            // the socket to become writable and reports errors.
+            for (int i = sent; i < count; ++i)
+                SendUdpEncrypted(buffers[i], lengths[i]);
+        }
+
+        udp_send_batch_.clear();
+    }
+
+    bool MumbleClient::SetUdpBatching(bool enable) {
+        if (enable && !udp_batch::Supported())
+            return false;
+
+        strand_->post(Track(boost::bind(&MumbleClient::ApplyUdpBatching, this, enable)));
+        return true;
+    }
+
+    void MumbleClient::ApplyUdpBatching(bool enable) {
+        if (enable && udp_batch_recv_.empty()) {
+            udp_batch_recv_.resize(kUdpBatchSize * kUdpBufferSize);
+            udp_batch_plain_.resize(kUdpBatchSize * kUdpBufferSize);
+            udp_send_batch_.reserve(kUdpSendPoolSize);
+        }
+
+        // Takes effect when the pending receive completes
+        udp_batching_ = enable;
+    }
+
+    void MumbleClient::HandleUdpSend(const boost::system::error_code& error, unsigned char* buffer) {
+        udp_send_pool_->Release(buffer);
+
+        if (error && error != boost::asio::error::operation_aborted)
+            DLOG(WARNING) << "libmumble: UDP send failed: " << error.message();
+    }
+
+    bool MumbleClient::GetNativeSockets(boost::asio::ip::tcp::socket::native_handle_type& tcp, boost::asio::ip::udp::socket::native_handle_type& udp) {
+        if (!tcp_socket_ || !udp_socket_)
+            return false;
+
+        tcp = tcp_socket_->lowest_layer().native_handle();
+        udp = udp_socket_->native_handle();
+        return true;
+    }
+
+    BufferPoolStats MumbleClient::GetUdpPoolStats() const {
+        return udp_send_pool_->Stats();
+    }
 
+    BufferPoolStats MumbleClient::GetReceivePoolStats() const {
+        return recv_pool_->Stats();
+    }
+
+    void MumbleClient::SendVoice(const char* buffer, int32_t len) {
+        if (len < 0 || len > MessageFramer::kMaxMessageLength) {
+            LOG(WARNING) << "libmumble: Voice packet of " << len << " bytes invalid, dropped";
+            return;
+        }
+        // Too large for a UDP buffer, but still fits a TCP frame
+        if (len > kUdpBufferSize - kUdpCryptHeader) {
+            SendRawUdpTunnel(buffer, len);
+            return;
+        }
+
+        // Whether UDP works is only known on the io_service thread, so the
+        // packet is staged in a UDP buffer and routed there
+        Submission submission;
+        submission.kind = Submission::kVoice;
+        submission.buffer = AcquireUdpBuffer();
+        submission.length = len;
+        if (!submission.buffer) {
+            // Every UDP buffer is in flight; late voice is worse than tunnelled voice
+            udp_pool_fallbacks_.fetch_add(1, boost::memory_order_relaxed);
+            SendRawUdpTunnel(buffer, len);
+            return;
+        }
+
+        memcpy(submission.buffer + kUdpCryptHeader, buffer, len);
+        Submit(submission);
+    }
+
+    void MumbleClient::RouteVoice(unsigned char* buffer, int32_t len) {
+        if (udp_active_ && udp_socket_ && cs_->isValid()) {
+            TransmitUdpBuffer(buffer, len);
+            return;
+        }
+
+        QueuedFrame frame;
+        unsigned char* body = AllocateFrame(PbMessageType::UDPTunnel, len, frame);
+        memcpy(body, buffer + kUdpCryptHeader, len);
+        udp_send_pool_->Release(buffer);
+
+        QueueVoiceFrame(frame);
+    }
+
+    void MumbleClient::SetConnectTimeout(int32_t seconds) {
+        strand_->post(Track(boost::bind(&MumbleClient::ApplyConnectTimeout, this, seconds)));
+    }
+
+    void MumbleClient::ApplyConnectTimeout(int32_t seconds) {
+        // Used from the next connect attempt on
+        connect_timeout_ = seconds;
+    }
+
+    void MumbleClient::SetComment(const std::string& text) {
         MumbleProto::UserState us;
-        us.set_session(session_);
         us.set_comment(text);
 
-        SendMessage(PbMessageType::UserState, us, true);
+        strand_->post(Track(boost::bind(&MumbleClient::ApplyUserState, this, us)));
     }
 
     void MumbleClient::JoinChannel(int32_t channel_id) {
-        BOOST_ASSERT(state_ >= kStateAuthenticated);
-
         MumbleProto::UserState us;
-        us.set_session(session_);
         us.set_channel_id(channel_id);
 
-        SendMessage(PbMessageType::UserState, us, true);
+        strand_->post(Track(boost::bind(&MumbleClient::ApplyUserState, this, us)));
+    }
+
+    void MumbleClient::ApplyUserState(const MumbleProto::UserState& change) {
+        // The session is only known, and only read, on the strand
+        BOOST_ASSERT(state_ >= kStateAuthenticated);
+
+        MumbleProto::UserState us(change);
+        us.set_session(session_);
+        QueueMessage(PbMessageType::UserState, us, true);
     }
 
 }  // namespace MumbleClient
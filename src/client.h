@@ -1,20 +1,31 @@
 #ifndef _LIBMUMBLECLIENT_CLIENT_H_
 #define _LIBMUMBLECLIENT_CLIENT_H_
 
-#include <list>
 #include <deque>
+#include <utility>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
+#include <boost/atomic.hpp>
+#include <boost/circular_buffer.hpp>
 #include <boost/function.hpp>
+#include <boost/lockfree/queue.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/system/error_code.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
 
+#include "buffer_pool.h"
+#include "callback_executor.h"
 #include "libmumble_stdint.h"
 #include "messages.h"
+#include "metrics.h"
 #include "Mumble.pb.h"
 #include "visibility.h"
 #include "settings.h"
+#include "tracked_handler.h"
+#include "voice_slice.h"
 
 namespace MumbleClient {
 
@@ -22,17 +33,27 @@ namespace MumbleClient {
 
 class Channel;
 class CryptState;
-class Message;
+class MessageFramer;
+class MumbleClientLib;
 class MessageHeader;
 class Settings;
 class User;
 
-typedef std::list< boost::shared_ptr<User> >::iterator user_list_iterator;
-typedef std::list< boost::shared_ptr<Channel> >::iterator channel_list_iterator;
+namespace wire_decoder {
+struct UserStateView;
+}
+
+typedef boost::unordered_map< int32_t, boost::shared_ptr<User> > user_map;
+typedef boost::unordered_map< int32_t, boost::shared_ptr<Channel> > channel_map;
+typedef user_map::iterator user_map_iterator;
+typedef channel_map::iterator channel_map_iterator;
 
 typedef boost::function<void (const std::string& text)> TextMessageCallbackType;
 typedef boost::function<void ()> AuthCallbackType;
+typedef boost::function<void ()> DisconnectedCallbackType;
 typedef boost::function<void (int32_t length, void* buffer)> RawUdpTunnelCallbackType;
+typedef boost::function<void (int32_t length, void* buffer)> UdpVoiceCallbackType;
+typedef boost::function<void (const VoiceSlice& slice)> VoiceSliceCallbackType;
 typedef boost::function<void (const User& user)> UserJoinedCallbackType;
 typedef boost::function<void (const User& user)> UserLeftCallbackType;
 typedef boost::function<void (const User& user, const Channel& channel)> UserMovedCallbackType;
@@ -52,18 +73,164 @@ class DLL_PUBLIC MumbleClient
         kStateDisconnected
     };
 
+    static const int32_t kDefaultConnectTimeout = 5;
+    static const int32_t kUdpBufferSize = 1024;
+    static const int32_t kUdpSendPoolSize = 64;
+    static const int32_t kUdpBatchSize = 16;
+    static const int32_t kUdpMaxBatchRounds = 8;
+    // One TLS record carries at most 16 KiB of plaintext
+    static const size_t kTcpWriteBufferSize = 16 * 1024;
+    // Holds any tunnelled voice frame and most control messages
+    static const size_t kTcpFrameSlabSize = 2048;
+    static const int32_t kTcpFramePoolSize = 256;
+    // Slabs for received voice handed out as slices
+    static const size_t kRecvSlabSize = kTcpFrameSlabSize;
+    static const int32_t kRecvPoolSize = 256;
+    static const size_t kSendQueueInitialCapacity = 64;
+    static const uint32_t kDefaultVoiceMaxAge = 500;
+    static const size_t kSubmissionQueueSize = 1024;
+    static const size_t kDefaultVoiceMaxFrames = 50;
+
+    // A serialized message waiting in the send queue: header and body in
+    // one buffer taken from the frame pool, or from the heap when too large
+    struct QueuedFrame
+    {
+        unsigned char* data;
+        size_t length;
+        bool pooled;
+        uint64_t queued_at;
+    };
+
+    // Outgoing data handed from the calling thread to the io_service thread.
+    // Frames are serialized by the caller; UDP packets carry their payload at
+    // buffer + kUdpCryptHeader in a buffer from the UDP send pool.
+    struct Submission
+    {
+        enum Kind
+        {
+            kControl,
+            kTunnel,
+            kUdp,
+            kVoice
+        };
+
+        Kind kind;
+        QueuedFrame frame;
+        unsigned char* buffer;
+        int32_t length;
+    };
+    struct ParsedMessages;
+    struct HandlerState;
+
+    // Who needs the payload of a message type: the library itself, or a
+    // callback when one is set. Messages nobody needs are not parsed.
+    struct MessageRoute
+    {
+        bool internal;
+        bool (MumbleClient::*has_callback)() const;
+    };
+    static const MessageRoute kMessageRoutes[];
+
+    static const int32_t kPingInterval = 5;
+    static const int32_t kUdpPingTimeout = 12;
+
 public:
+    // The Send* calls may be made from any thread. They serialize or copy
+    // the data on the calling thread and hand it to the io_service thread
+    // through a lock-free queue. When the queue is full, control messages
+    // and tunnelled voice wait in a locked overflow list instead, while UDP
+    // voice is dropped and counted.
+    //
+    // Connect, Disconnect, SetConnectTimeout, SetComment, JoinChannel,
+    // SetVoiceQueueLimits and SetUdpBatching may also be made from any
+    // thread. They are applied on the client's strand in the order they were
+    // made, after the call has returned. Disconnect() calls |done|, on the
+    // strand or the callback executor, once the disconnect has been applied.
+    //
+    // Deleting the client applies a disconnect after every call made before
+    // it, then blocks until no handler of the client is pending or running.
+    // So "client->Disconnect(); delete client;" is safe from any thread but
+    // the client's own callbacks. The handlers run on the threads running
+    // the io_service, or on the deleting thread when none is, as with
+    // MumbleClientLib::Poll() or before Run(). An external io_service must
+    // be running or stopped; once stopped it must not run again, as it may
+    // still hold handlers of the deleted client.
+
+    // Bytes in front of a UDP packet that encryption writes its header into
+    static const int32_t kUdpCryptHeader = 4;
+
     ~MumbleClient();
 
     void Connect(const Settings& s);
-    void Disconnect();
+    void Disconnect(const DisconnectedCallbackType& done = DisconnectedCallbackType());
     void SendMessage(PbMessageType::MessageType type, const ::google::protobuf::Message& msg, bool print);
     void SetComment(const std::string& text);
     void SendRawUdpTunnel(const char* buffer, int32_t len);
     void SendUdpMessage(const char* buffer, int32_t len);
+    // Sends a voice packet over UDP while UDP pings are answered,
+    // otherwise through the TCP tunnel. Also tunnelled, and counted in
+    // NetworkStats::udp_pool_fallbacks, when every UDP buffer is in use.
+    void SendVoice(const char* buffer, int32_t len);
+
+    // Zero copy UDP send. AcquireUdpBuffer() returns a pooled buffer of
+    // GetUdpBufferSize() bytes, or NULL when all buffers are in flight. Write
+    // the plain packet at buffer + kUdpCryptHeader and pass it to
+    // SendUdpBuffer(), which encrypts it in place, sends it and returns the
+    // buffer to the pool. Buffers that are not sent go back with
+    // ReleaseUdpBuffer().
+    unsigned char* AcquireUdpBuffer();
+    void SendUdpBuffer(unsigned char* buffer, int32_t len);
+    void ReleaseUdpBuffer(unsigned char* buffer);
+    int32_t GetUdpBufferSize() const { return kUdpBufferSize; }
+    BufferPoolStats GetUdpPoolStats() const;
+    // Slabs behind the slices given to the voice slice callback. Slabs in
+    // use are held by slices the application has not released yet.
+    BufferPoolStats GetReceivePoolStats() const;
+
+    // Batched UDP I/O with recvmmsg()/sendmmsg() on Linux. Ready datagrams
+    // are drained several per call and outgoing packets are flushed once per
+    // event loop pass. Returns false if the platform has no batched calls.
+    // The switch is applied on the client's strand, so IsUdpBatching()
+    // reports the new setting once that has run.
+    bool SetUdpBatching(bool enable);
+    bool IsUdpBatching() const { return udp_batching_; }
+    NetworkStats GetNetworkStats() const;
+
+    // Bounds tunnelled voice waiting behind a congested TCP connection.
+    // Frames older than |max_age_ms| are dropped before they are written,
+    // and once |max_frames| are queued the oldest makes room for the newest.
+    void SetVoiceQueueLimits(uint32_t max_age_ms, size_t max_frames);
+    SendQueueStats GetSendQueueStats() const;
+
+    // Message, queue, crypt, round trip and callback metrics of this client.
+    // May be called from any thread; MumbleClientLib::GetMetrics() merges
+    // them over all clients.
+    MetricsSnapshot GetMetrics() const;
     void JoinChannel(int32_t channel_id);
 
-    
+    // Time allowed for each TCP connect attempt and for the TLS handshake.
+    void SetConnectTimeout(int32_t seconds);
+
+    // UDP path state and smoothed UDP round trip time in milliseconds.
+    // May be called from any thread.
+    bool IsUdpActive() const { return udp_active_.load(boost::memory_order_relaxed); }
+    float GetUdpPingAverage() const { return udp_ping_avg_.load(boost::memory_order_relaxed); }
+    float GetUdpPingVariance() const { return udp_ping_var_.load(boost::memory_order_relaxed); }
+
+    // Users by session and channels by id, or an empty pointer if unknown.
+    // The objects stay valid for as long as the caller holds on to them, even
+    // after the server removed them.
+    boost::shared_ptr<User> GetUser(int32_t session) const;
+    boost::shared_ptr<Channel> GetChannel(int32_t id) const;
+    // The counts may be read from any thread.
+    size_t GetUserCount() const { return static_cast<size_t>(user_count_.Get()); }
+    size_t GetChannelCount() const { return static_cast<size_t>(channel_count_.Get()); }
+
+    // Native socket handles, for hosts that drive the library with
+    // MumbleClientLib::Poll() from their own poller: poll when either is
+    // readable, and at least every 100 ms for timers and queued sends.
+    // Returns false while not connected.
+    bool GetNativeSockets(boost::asio::ip::tcp::socket::native_handle_type& tcp, boost::asio::ip::udp::socket::native_handle_type& udp);
 
     // Get current connection settings
     Settings CurrentSettings() { return currentSettings_; }
@@ -75,6 +242,14 @@ public:
     void SetTextMessageCallback(TextMessageCallbackType tm) { text_message_callback_ = tm; }
     void SetAuthCallback(AuthCallbackType a) { auth_callback_ = a; }
     void SetRawUdpTunnelCallback(RawUdpTunnelCallbackType rut) { raw_udp_tunnel_callback_ = rut; }
+    // Voice received over UDP, decrypted, in the same layout as the tunnel callback.
+    // If no UDP voice callback is set the raw UDP tunnel callback receives these packets.
+    void SetUdpVoiceCallback(UdpVoiceCallbackType uvc) { udp_voice_callback_ = uvc; }
+    // Alternative to the raw UDP tunnel callback that receives the same
+    // packets as ref-counted slices of pooled receive buffers, which can be
+    // kept or passed on without copying. Replaces the raw UDP tunnel
+    // callback while set.
+    void SetVoiceSliceCallback(VoiceSliceCallbackType vsc) { voice_slice_callback_ = vsc; }
     void SetUserJoinedCallback(UserJoinedCallbackType ujt) { user_joined_callback_ = ujt; }
     void SetUserLeftCallback(UserJoinedCallbackType ult) { user_left_callback_ = ult; }
     void SetUserMovedCallback(UserMovedCallbackType umt) { user_moved_callback_ = umt; }
@@ -82,6 +257,11 @@ public:
     void SetChannelRemoveCallback(ChannelRemoveCallbackType crt) { channel_remove_callback_ = crt; }
     void SetErrorCallback(ErrorCallbackType ec) { error_callback_ = ec; }
 
+    // Delivers callbacks on |executor| instead of the network thread. Events
+    // carry copies of packets, users and channels. NULL restores inline
+    // delivery. The executor must outlive the client.
+    void SetCallbackExecutor(CallbackExecutor* executor) { callback_executor_ = executor; }
+
 #ifndef NDEBUG
     void PrintChannelList();
     void PrintUserList();
@@ -93,22 +273,85 @@ private:
     DLL_LOCAL MumbleClient(boost::asio::io_service* io_service);
     DLL_LOCAL MumbleClient(const MumbleClient&);
     DLL_LOCAL void operator=(const MumbleClient&);
+    DLL_LOCAL bool Rebind(boost::asio::io_service* io_service);
 
+    DLL_LOCAL void ApplyConnect(const Settings& s);
+    DLL_LOCAL void ApplyDisconnect();
+    DLL_LOCAL void ApplyDisconnectRequest(const DisconnectedCallbackType& done);
+    DLL_LOCAL void ApplyTeardown();
+    DLL_LOCAL bool HandlersIdle() const;
+    DLL_LOCAL void WaitForHandlers();
+
+    // Every handler given to Boost.Asio goes through here, so the
+    // destructor can wait for the last of them
+    template <typename Handler>
+    TrackedHandler<Handler> Track(const Handler& handler) { return MakeTrackedHandler(handler_state_, handler); }
+
+    DLL_LOCAL void ApplyConnectTimeout(int32_t seconds);
+    DLL_LOCAL void ApplyUserState(const MumbleProto::UserState& change);
     DLL_LOCAL void OnConnected(const boost::system::error_code& resolveError, boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
+    DLL_LOCAL void ConnectNext(boost::asio::ip::tcp::resolver::iterator endpoint_iterator, const boost::system::error_code& last_error);
+    DLL_LOCAL void HandleConnect(const boost::system::error_code& error, boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
+    DLL_LOCAL void HandleHandshake(const boost::system::error_code& error);
+    DLL_LOCAL void HandleConnectError(const boost::system::error_code& error, const char* stage);
+    DLL_LOCAL void StartConnectTimer();
+    DLL_LOCAL void StopConnectTimer();
+    DLL_LOCAL void ConnectTimeout(const boost::system::error_code& error, uint32_t attempt);
 
     DLL_LOCAL void SendPing(const boost::system::error_code& error);
+    DLL_LOCAL bool WantsMessage(int32_t type) const;
+    DLL_LOCAL bool HasTunnelCallback() const { return !raw_udp_tunnel_callback_.empty() || !voice_slice_callback_.empty(); }
+    // UDP voice goes to the voice slice callback, so decrypt it straight into a slab
+    DLL_LOCAL bool WantsUdpSlices() const { return !voice_slice_callback_.empty() && udp_voice_callback_.empty(); }
+    DLL_LOCAL bool HasTextMessageCallback() const { return !text_message_callback_.empty(); }
     DLL_LOCAL void ParseMessage(const MessageHeader& msg_header, void* buffer);
     DLL_LOCAL void ProcessTCPSendQueue(const boost::system::error_code& error, const size_t bytes_transferred);
-    DLL_LOCAL void SendFirstQueued();
-    DLL_LOCAL bool HandleMessageContent(std::istream& is, const MessageHeader& msg_header);
-    DLL_LOCAL void ReadHandler(const boost::system::error_code& error);
-    DLL_LOCAL void ReadHandlerContinue(const MessageHeader msg_header, const boost::system::error_code& error);
+    DLL_LOCAL void Submit(const Submission& submission);
+    DLL_LOCAL void Spill(const Submission& submission);
+    DLL_LOCAL void DrainSubmissions();
+    DLL_LOCAL void ProcessSubmissions();
+    DLL_LOCAL void ProcessSubmission(Submission& submission);
+    DLL_LOCAL void DiscardSubmissions();
+    DLL_LOCAL void ReleaseSubmission(const Submission& submission);
+    DLL_LOCAL bool SerializeFrame(PbMessageType::MessageType type, const ::google::protobuf::Message& msg, QueuedFrame& frame);
+    DLL_LOCAL void QueueMessage(PbMessageType::MessageType type, const ::google::protobuf::Message& msg, bool print);
+    DLL_LOCAL void TransmitUdpBuffer(unsigned char* buffer, int32_t len);
+    DLL_LOCAL void RouteVoice(unsigned char* buffer, int32_t len);
+    DLL_LOCAL void ApplyVoiceQueueLimits(uint32_t max_age_ms, size_t max_frames);
+    DLL_LOCAL void SendQueued();
+    DLL_LOCAL unsigned char* AllocateFrame(PbMessageType::MessageType type, int32_t length, QueuedFrame& frame);
+    DLL_LOCAL void QueueFrame(const QueuedFrame& frame);
+    DLL_LOCAL void QueueVoiceFrame(QueuedFrame& frame);
+    DLL_LOCAL size_t PackFrames(boost::circular_buffer<QueuedFrame>& queue, size_t packed);
+    DLL_LOCAL void DropStaleVoice();
+    DLL_LOCAL void ReleaseFrame(const QueuedFrame& frame);
+    DLL_LOCAL void ClearSendQueue();
+    DLL_LOCAL void PublishQueueDepths();
+    DLL_LOCAL void ReadHandler(const boost::system::error_code& error, const size_t bytes_transferred);
+    DLL_LOCAL void StartUdpReceive();
+    DLL_LOCAL void HandleUdpReceive(const boost::system::error_code& error, const size_t bytes_transferred);
+    DLL_LOCAL void HandleUdpReadable(const boost::system::error_code& error);
+    DLL_LOCAL void DispatchUdpPacket(const unsigned char* buffer, int32_t length, const boost::intrusive_ptr<SliceBuffer>& slice_buffer);
+    DLL_LOCAL void SendUdpEncrypted(unsigned char* buffer, size_t length);
+    DLL_LOCAL void FlushUdpSendBatch();
+    DLL_LOCAL void ApplyUdpBatching(bool enable);
+    DLL_LOCAL void HandleUdpSend(const boost::system::error_code& error, unsigned char* buffer);
+    DLL_LOCAL void SendUdpPing();
+    DLL_LOCAL void HandleUdpPing(const unsigned char* buffer, int32_t length);
+    DLL_LOCAL void CountMessage(MetricCounter* messages, MetricCounter* bytes, int32_t type, size_t length);
+    DLL_LOCAL void PublishCryptStats();
+    DLL_LOCAL void PublishRegistrySizes();
+    DLL_LOCAL void PostCallback(const CallbackExecutor::Task& task);
+    DLL_LOCAL void DispatchError(const boost::system::error_code& error);
+    DLL_LOCAL void DispatchPacket(const RawUdpTunnelCallbackType& callback, int32_t length, void* buffer);
+    DLL_LOCAL void DispatchSlice(const VoiceSlice& slice);
+    DLL_LOCAL void DispatchUser(const UserJoinedCallbackType& callback, const User& user);
+    DLL_LOCAL void DispatchUserMoved(const User& user, const Channel& channel);
+    DLL_LOCAL void DispatchChannel(const ChannelAddCallbackType& callback, const Channel& channel);
     DLL_LOCAL void HandleUserRemove(const MumbleProto::UserRemove& ur);
-    DLL_LOCAL void HandleUserState(const MumbleProto::UserState& us);
+    DLL_LOCAL void HandleUserState(const wire_decoder::UserStateView& us);
     DLL_LOCAL void HandleChannelState(const MumbleProto::ChannelState& cs);
     DLL_LOCAL void HandleChannelRemove(const MumbleProto::ChannelRemove& cr);
-    DLL_LOCAL boost::shared_ptr<User> FindUser(int32_t session);
-    DLL_LOCAL boost::shared_ptr<Channel> FindChannel(int32_t id);
 
     // Internal state
     Settings currentSettings_;
@@ -122,24 +365,111 @@ private:
     // Boost
     boost::asio::ip::tcp::resolver *resolver_;
     boost::asio::io_service* io_service_;
+    // Serializes every handler of this client when several threads run the io_service
+    boost::asio::io_service::strand* strand_;
+    // Library context and shard the io_service belongs to
+    MumbleClientLib* lib_;
+    int32_t shard_;
 #if SSL
     boost::asio::ssl::stream<boost::asio::ip::tcp::socket>* tcp_socket_;
 #else
     boost::asio::ip::tcp::socket* tcp_socket_;
 #endif
     boost::asio::ip::udp::socket* udp_socket_;
-    boost::asio::streambuf recv_buffer_;
+    MessageFramer* recv_framer_;
+    ParsedMessages* parsed_;
+    unsigned char udp_recv_buffer_[kUdpBufferSize];
+    unsigned char udp_plain_buffer_[kUdpBufferSize];
+    BufferPool* udp_send_pool_;
+    // Shared with the slices still held by the application
+    boost::intrusive_ptr<ReceivePool> recv_pool_;
+    // Written on the strand, read from any thread by IsUdpBatching()
+    boost::atomic<bool> udp_batching_;
+    bool udp_flush_posted_;
+    std::vector<unsigned char> udp_batch_recv_;
+    std::vector<unsigned char> udp_batch_plain_;
+    std::vector< std::pair<unsigned char*, int32_t> > udp_send_batch_;
+    // Written on the strand, read from any thread by IsUdpActive() and
+    // GetUdpPing*()
+    boost::atomic<bool> udp_active_;
+    uint32_t udp_ping_samples_;
+    uint64_t udp_last_ping_reply_;
+    boost::atomic<float> udp_ping_avg_;
+    boost::atomic<float> udp_ping_var_;
     boost::asio::deadline_timer* ping_timer_;
+    boost::asio::deadline_timer* connect_timer_;
+    int32_t connect_timeout_;
+    uint32_t connect_attempt_;
 
     // Containers
-    std::deque< boost::shared_ptr<Message> > send_queue_;
-    std::list< boost::shared_ptr<User> > user_list_;
-    std::list< boost::shared_ptr<Channel> > channel_list_;
+    // Fixed array, so producers never allocate
+    boost::lockfree::queue< Submission, boost::lockfree::capacity<kSubmissionQueueSize> > submissions_;
+    boost::atomic<bool> drain_posted_;
+    // Incremented by any producer thread, unlike the counters below
+    boost::atomic<uint64_t> submissions_dropped_;
+    boost::atomic<uint64_t> submissions_spilled_;
+    // Control messages and tunnelled voice that found the queue full. Once
+    // anything is spilled producers append here until the drain empties
+    // it, so each producer's sends stay in order.
+    boost::mutex spill_mutex_;
+    std::vector<Submission> spill_;
+    std::vector<Submission> spill_drain_;
+    boost::atomic<bool> spilling_;
+    boost::atomic<uint64_t> udp_pool_fallbacks_;
+    // Shared with every pending handler, see Track()
+    boost::shared_ptr<HandlerState> handler_state_;
+    boost::circular_buffer<QueuedFrame> control_queue_;
+    boost::circular_buffer<QueuedFrame> voice_queue_;
+    BufferPool* tcp_frame_pool_;
+    std::vector<char> tcp_write_buffer_;
+    uint32_t voice_max_age_;
+    user_map users_;
+    channel_map channels_;
+
+    // Metrics, written on the strand and read from any thread
+    MetricCounter messages_in_[kPbMessageTypeCount];
+    MetricCounter bytes_in_[kPbMessageTypeCount];
+    MetricCounter messages_out_[kPbMessageTypeCount];
+    MetricCounter bytes_out_[kPbMessageTypeCount];
+    MetricCounter messages_skipped_[kPbMessageTypeCount];
+    MetricCounter bytes_skipped_[kPbMessageTypeCount];
+    MetricCounter crypt_good_;
+    MetricCounter crypt_late_;
+    MetricCounter crypt_lost_;
+    MetricCounter crypt_resync_;
+    MetricCounter crypt_remote_good_;
+    MetricCounter crypt_remote_late_;
+    MetricCounter crypt_remote_lost_;
+    MetricCounter crypt_remote_resync_;
+    // Network and send queue stats, published here for GetNetworkStats()
+    // and GetSendQueueStats()
+    MetricCounter udp_packets_sent_;
+    MetricCounter udp_packets_received_;
+    MetricCounter udp_send_syscalls_;
+    MetricCounter udp_recv_syscalls_;
+    MetricCounter tcp_writes_;
+    MetricCounter tcp_bytes_sent_;
+    MetricCounter tcp_messages_sent_;
+    MetricCounter control_depth_;
+    MetricCounter control_high_water_;
+    MetricCounter voice_depth_;
+    MetricCounter voice_high_water_;
+    MetricCounter voice_dropped_age_;
+    MetricCounter voice_dropped_depth_;
+    // Sizes of users_ and channels_, for GetUserCount() and GetChannelCount()
+    MetricCounter user_count_;
+    MetricCounter channel_count_;
+    MetricHistogram tcp_rtt_;
+    MetricHistogram udp_rtt_;
+    // Shared with callbacks still queued on an executor
+    boost::shared_ptr<MetricHistogram> callback_time_;
     
     // Callbacks
     TextMessageCallbackType text_message_callback_;
     AuthCallbackType auth_callback_;
     RawUdpTunnelCallbackType raw_udp_tunnel_callback_;
+    UdpVoiceCallbackType udp_voice_callback_;
+    VoiceSliceCallbackType voice_slice_callback_;
     UserJoinedCallbackType user_joined_callback_;
     UserLeftCallbackType user_left_callback_;
     UserMovedCallbackType user_moved_callback_;
@@ -147,6 +477,7 @@ private:
     ChannelRemoveCallbackType channel_remove_callback_;
     ErrorCallbackType error_callback_;
     ConnectedCallback connected_callback_;
+    CallbackExecutor* callback_executor_;
 
 
 };
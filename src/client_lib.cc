@@ -1,24 +1,110 @@
 #include "client_lib.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include "client.h"
 #include "logging.h"
 #include "settings.h"
 
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/system/system_error.hpp>
+#include <boost/thread.hpp>
+#include <boost/version.hpp>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace
+{
+#if defined(__linux__)
+    typedef cpu_set_t AffinityMask;
+#elif defined(_WIN32)
+    typedef DWORD_PTR AffinityMask;
+#else
+    typedef int AffinityMask;
+#endif
+
+    // Binds the calling thread to |cpu|. |previous|, unless NULL, receives
+    // the affinity the thread had before.
+    void PinCurrentThread(int32_t cpu, AffinityMask* previous)
+    {
+#if defined(__linux__)
+        if (previous)
+            pthread_getaffinity_np(pthread_self(), sizeof(*previous), previous);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+        DWORD_PTR old_mask = SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu);
+        if (previous)
+            *previous = old_mask;
+#else
+        (void)cpu;
+        (void)previous;
+#endif
+    }
+
+    // Counts the calling thread as a runner of a shard while in scope
+    class RunnerScope
+    {
+    public:
+        explicit RunnerScope(boost::atomic<int32_t>& runners) : runners_(runners) { ++runners_; }
+        ~RunnerScope() { --runners_; }
+
+    private:
+        boost::atomic<int32_t>& runners_;
+    };
+
+    void RestoreCurrentThread(const AffinityMask& mask)
+    {
+#if defined(__linux__)
+        pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+#elif defined(_WIN32)
+        if (mask)
+            SetThreadAffinityMask(GetCurrentThread(), mask);
+#else
+        (void)mask;
+#endif
+    }
+}
 
 namespace MumbleClient 
 {
     MumbleClientLib* MumbleClientLib::instance_ = 0;
 
-    MumbleClientLib::MumbleClientLib() 
+    MumbleClientLib::MumbleClientLib() :
+        pin_threads_(false),
+        clients_created_(false),
+        external_(false),
+        host_driven_(false)
     {
+        ClearMetrics(retired_metrics_);
+        shards_.push_back(new Shard(0));
+    }
+
+    MumbleClientLib::MumbleClientLib(boost::asio::io_service& io_service) :
+        pin_threads_(false),
+        clients_created_(false),
+        external_(true),
+        host_driven_(false)
+    {
+        ClearMetrics(retired_metrics_);
+        shards_.push_back(new Shard(&io_service));
     }
 
     MumbleClientLib::~MumbleClientLib() 
     {
-        delete instance_;
+        for (size_t i = 0; i < shards_.size(); ++i)
+            delete shards_[i];
+        if (instance_ == this)
+            instance_ = 0;
     }
 
     MumbleClientLib* MumbleClientLib::instance() 
@@ -30,17 +116,148 @@ namespace MumbleClient
 
     MumbleClient* MumbleClientLib::NewClient() 
     {
-        return new MumbleClient(&io_service_);
+        boost::mutex::scoped_lock lock(metrics_mutex_);
+        clients_created_ = true;
+
+        int32_t shard = 0;
+        for (int32_t i = 1; i < GetShardCount(); ++i)
+        {
+            if (shards_[i]->clients < shards_[shard]->clients)
+                shard = i;
+        }
+
+        MumbleClient* client = new MumbleClient(shards_[shard]->io_service);
+        client->lib_ = this;
+        client->shard_ = shard;
+        ++shards_[shard]->clients;
+        clients_.push_back(client);
+        return client;
+    }
+
+    bool MumbleClientLib::SetShardCount(int32_t shards, bool pin_threads) 
+    {
+        if (clients_created_ || external_ || shards < 1)
+            return false;
+
+        for (size_t i = 0; i < shards_.size(); ++i)
+            delete shards_[i];
+        shards_.clear();
+
+        for (int32_t i = 0; i < shards; ++i)
+            shards_.push_back(new Shard(0));
+        pin_threads_ = pin_threads;
+        return true;
+    }
+
+    int32_t MumbleClientLib::GetShardLoad(int32_t shard) const 
+    {
+        if (shard < 0 || shard >= GetShardCount())
+            return 0;
+
+        return shards_[shard]->clients;
     }
 
-    void MumbleClientLib::Run() 
+    bool MumbleClientLib::MoveClient(MumbleClient* client, int32_t shard) 
     {
+        if (!client || client->lib_ != this || shard < 0 || shard >= GetShardCount())
+            return false;
+        if (client->shard_ == shard)
+            return true;
+
+        if (!client->Rebind(shards_[shard]->io_service))
+            return false;
+
+        boost::mutex::scoped_lock lock(metrics_mutex_);
+        --shards_[client->shard_]->clients;
+        ++shards_[shard]->clients;
+        client->shard_ = shard;
+        return true;
+    }
+
+    // Called from ~MumbleClient() once no handler is left, while the client
+    // is still whole
+    void MumbleClientLib::ClientDestroyed(MumbleClient* client) 
+    {
+        boost::mutex::scoped_lock lock(metrics_mutex_);
+        if (client->shard_ >= 0 && client->shard_ < GetShardCount())
+            --shards_[client->shard_]->clients;
+
+        // Keep the counters monotonic across clients coming and going
+        MetricsSnapshot final_metrics = client->GetMetrics();
+        final_metrics.clients = 0;
+        final_metrics.send_queue.control_depth = 0;
+        final_metrics.send_queue.voice_depth = 0;
+
+        clients_.erase(std::remove(clients_.begin(), clients_.end(), client), clients_.end());
+        MergeMetrics(retired_metrics_, final_metrics);
+    }
+
+    bool MumbleClientLib::IsShardRunning(int32_t shard) const 
+    {
+        if (shard < 0 || shard >= GetShardCount())
+            return false;
+        if (shards_[shard]->runners > 0)
+            return true;
+
+        // An io_service of the caller is run by the caller, unless the
+        // caller drives it through Poll() and RunOne()
+        return !shards_[shard]->owned && !host_driven_;
+    }
+
+    MetricsSnapshot MumbleClientLib::GetMetrics() 
+    {
+        boost::mutex::scoped_lock lock(metrics_mutex_);
+        MetricsSnapshot snapshot = retired_metrics_;
+        for (size_t i = 0; i < clients_.size(); ++i)
+            MergeMetrics(snapshot, clients_[i]->GetMetrics());
+        return snapshot;
+    }
+
+    void MumbleClientLib::Run(int32_t threads) 
+    {
+        //LOG(INFO) << "MumbleClientLib::Run() - Networking started";
+        if (threads < 1)
+            threads = 1;
+
+        unsigned int cpus = boost::thread::hardware_concurrency();
+        if (cpus == 0)
+            cpus = 1;
+
+        // Thread t of shard i gets CPU i * threads + t, so the threads of a
+        // shard only share a CPU when there are more threads than CPUs
+        boost::thread_group workers;
+        for (size_t i = 0; i < shards_.size(); ++i)
+        {
+            shards_[i]->io_service->reset();
+
+            for (int32_t t = (i == 0 ? 1 : 0); t < threads; ++t)
+            {
+                int32_t cpu = pin_threads_ ? static_cast<int32_t>((i * threads + t) % cpus) : -1;
+                workers.create_thread(boost::bind(&MumbleClientLib::RunWorker, this, shards_[i], cpu));
+            }
+        }
+
+        // The calling thread serves the first shard on CPU 0, and gets its
+        // own affinity back when done
+        AffinityMask caller_mask;
+        if (pin_threads_)
+            PinCurrentThread(0, &caller_mask);
+        RunWorker(shards_[0], -1);
+        if (pin_threads_)
+            RestoreCurrentThread(caller_mask);
+        workers.join_all();
+        //LOG(INFO) << "MumbleClientLib::Run() - Networking stopped";
+    }
+
+    void MumbleClientLib::RunWorker(Shard* shard, int32_t cpu) 
+    {
+        if (cpu >= 0)
+            PinCurrentThread(cpu, 0);
+
         try
         {
-            //LOG(INFO) << "MumbleClientLib::Run() - Networking started";
-            io_service_.reset();
-            io_service_.run();
-            //LOG(INFO) << "MumbleClientLib::Run() - Networking stopped";
+            RunnerScope runner(shard->runners);
+            shard->io_service->run();
         }
         catch (boost::system::system_error &error)
         {
@@ -48,6 +265,60 @@ namespace MumbleClient
         }
     }
 
+    size_t MumbleClientLib::Poll(size_t max_handlers) 
+    {
+        host_driven_ = true;
+        size_t handled = 0;
+        for (size_t i = 0; i < shards_.size(); ++i)
+        {
+            boost::asio::io_service* io_service = shards_[i]->io_service;
+            RunnerScope runner(shards_[i]->runners);
+            io_service->reset();
+
+            if (max_handlers == 0)
+            {
+                handled += io_service->poll();
+                continue;
+            }
+
+            while (handled < max_handlers && io_service->poll_one())
+                ++handled;
+        }
+
+        return handled;
+    }
+
+    size_t MumbleClientLib::RunOne(int32_t timeout_ms) 
+    {
+        host_driven_ = true;
+        boost::asio::io_service* io_service = shards_[0]->io_service;
+        RunnerScope runner(shards_[0]->runners);
+        io_service->reset();
+
+        if (timeout_ms <= 0)
+            return io_service->poll_one();
+
+#if BOOST_VERSION >= 106600
+        return io_service->run_one_for(boost::asio::chrono::milliseconds(timeout_ms));
+#else
+        // There is no run_one_for(), so a timer bounds the wait. The flag is
+        // shared with its handler, which still runs on a later call when a
+        // real handler came first and the timer was cancelled.
+        boost::shared_ptr<bool> expired = boost::make_shared<bool>(false);
+        boost::asio::deadline_timer timer(*io_service, boost::posix_time::milliseconds(timeout_ms));
+        timer.async_wait(boost::bind(&MumbleClientLib::TimerDone, boost::asio::placeholders::error, expired));
+
+        size_t handled = io_service->run_one();
+        return *expired ? 0 : handled;
+#endif
+    }
+
+    void MumbleClientLib::TimerDone(const boost::system::error_code& error, const boost::shared_ptr<bool>& expired) 
+    {
+        if (!error)
+            *expired = true;
+    }
+
     void MumbleClientLib::Shutdown() 
     {
         //LOG(INFO) << "MumbleClientLib::Shutdown() - Shutting down protobuf library";
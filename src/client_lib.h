@@ -3,8 +3,14 @@
 
 #include "visibility.h"
 #include "libmumble_stdint.h"
+#include "metrics.h"
+
+#include <vector>
 
 #include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 namespace MumbleClient 
 {
@@ -15,20 +21,97 @@ namespace MumbleClient
     public:
         static MumbleClientLib* instance();
 
+        // A library context around an io_service owned and run by the
+        // caller, independent of instance(). It has a single shard and must
+        // outlive its clients.
+        explicit MumbleClientLib(boost::asio::io_service& io_service);
+        ~MumbleClientLib();
+
+        // Places the client on the shard with the fewest clients.
         MumbleClient* NewClient();
         
-        void Run();
+        // Runs the event loop until there is no more work, on the calling
+        // thread plus |threads| - 1 worker threads per shard. Each client's
+        // handlers and callbacks are serialized, but callbacks of different
+        // clients may run concurrently when more than one thread is used.
+        void Run(int32_t threads = 1);
         void Shutdown();
 
+        // Host driven operation, for callers that run their own frame loop
+        // instead of Run(). Poll() runs the handlers that are ready without
+        // blocking, at most |max_handlers| of them unless it is 0. RunOne()
+        // runs at most one handler of the first shard, waiting up to
+        // |timeout_ms| for one to become ready. Both return the number of
+        // handlers run, and must not be mixed with Run() threads on the
+        // same shard.
+        size_t Poll(size_t max_handlers = 0);
+        size_t RunOne(int32_t timeout_ms);
+
+        // Splits the library into |shards| independent io_services, each run
+        // by its own threads. A client's sockets, timers and handlers all
+        // stay on one shard. With |pin_threads| Run() binds each of its
+        // threads to its own CPU, shard after shard, wrapping around when
+        // there are more threads than CPUs. The calling thread is bound to
+        // CPU 0 while it runs the first shard and gets its previous affinity
+        // back when Run() returns. Only possible before the first NewClient().
+        bool SetShardCount(int32_t shards, bool pin_threads);
+        int32_t GetShardCount() const { return static_cast<int32_t>(shards_.size()); }
+        // Number of clients placed on |shard|
+        int32_t GetShardLoad(int32_t shard) const;
+        // Moves a client that is not connected to |shard|. Returns false
+        // while any call made on the client is still queued, or any of its
+        // handlers is pending or running on the current shard; wait for a
+        // Disconnect() callback first. No other call may be made on the
+        // client during the move.
+        bool MoveClient(MumbleClient* client, int32_t shard);
+
+        // Metrics of every client, including those already destroyed.
+        // Format with FormatPrometheusMetrics() to serve them over HTTP.
+        MetricsSnapshot GetMetrics();
+
         static int32_t GetLogLevel();
         static void SetLogLevel(int32_t level);
 
     private:
+        friend class MumbleClient;
+
+        struct Shard
+        {
+            explicit Shard(boost::asio::io_service* external) :
+                io_service(external ? external : new boost::asio::io_service()),
+                owned(external == 0),
+                clients(0),
+                runners(0) { }
+            ~Shard() { if (owned) delete io_service; }
+
+            boost::asio::io_service* io_service;
+            bool owned;
+            boost::atomic<int32_t> clients;
+            // Threads inside Run(), Poll() or RunOne() for this shard
+            boost::atomic<int32_t> runners;
+        };
+
         DLL_LOCAL MumbleClientLib();
-        DLL_LOCAL ~MumbleClientLib();
+        DLL_LOCAL void RunWorker(Shard* shard, int32_t cpu);
+        DLL_LOCAL void ClientDestroyed(MumbleClient* client);
+        // Whether some other thread runs the io_service of |shard|, so a
+        // client being deleted can wait for its handlers there
+        DLL_LOCAL bool IsShardRunning(int32_t shard) const;
+        DLL_LOCAL static void TimerDone(const boost::system::error_code& error, const boost::shared_ptr<bool>& expired);
 
         DLL_LOCAL static MumbleClientLib* instance_;
-        boost::asio::io_service io_service_;
+        std::vector<Shard*> shards_;
+        bool pin_threads_;
+        bool clients_created_;
+        bool external_;
+        // Set once Poll() or RunOne() drive the shards
+        boost::atomic<bool> host_driven_;
+
+        // Live clients, and the final counts of destroyed ones. Also guards
+        // the client counts of the shards.
+        boost::mutex metrics_mutex_;
+        std::vector<MumbleClient*> clients_;
+        MetricsSnapshot retired_metrics_;
 
         MumbleClientLib(const MumbleClientLib&);
         void operator=(const MumbleClientLib&);
@@ -0,0 +1,84 @@
+#ifndef _LIBMUMBLECLIENT_HANDLER_MEMORY_H_
+#define _LIBMUMBLECLIENT_HANDLER_MEMORY_H_
+
+#include <cstddef>
+#include <new>
+
+#include <boost/aligned_storage.hpp>
+#include <boost/atomic.hpp>
+
+namespace MumbleClient {
+
+// Memory for the pending operation of a handler that is started over and
+// over, one at a time, such as a posted drain or a UDP send. Boost.Asio
+// gets operation memory through the asio_handler_allocate() hook, which
+// handlers made by MakeMemoryHandler() point here instead of at the heap.
+// While the block is taken, or an operation does not fit, the heap is used.
+// It may be allocated on one thread and freed on another.
+class HandlerMemory
+{
+public:
+    // Holds the composed operation of a TLS write, the largest one
+    static const size_t kSize = 512;
+
+    HandlerMemory() : in_use_(false) { }
+
+    void* Allocate(size_t size)
+    {
+        if (size <= kSize && !in_use_.exchange(true, boost::memory_order_acquire))
+            return storage_.address();
+        return ::operator new(size);
+    }
+
+    void Deallocate(void* pointer)
+    {
+        if (pointer == storage_.address())
+            in_use_.store(false, boost::memory_order_release);
+        else
+            ::operator delete(pointer);
+    }
+
+private:
+    boost::aligned_storage<kSize> storage_;
+    boost::atomic<bool> in_use_;
+
+    HandlerMemory(const HandlerMemory&);
+    void operator=(const HandlerMemory&);
+};
+
+template <typename Handler>
+class MemoryHandler
+{
+public:
+    MemoryHandler(HandlerMemory* memory, const Handler& handler) : memory_(memory), handler_(handler) { }
+
+    void operator()() { handler_(); }
+    template <typename Arg1>
+    void operator()(const Arg1& arg1) { handler_(arg1); }
+    template <typename Arg1, typename Arg2>
+    void operator()(const Arg1& arg1, const Arg2& arg2) { handler_(arg1, arg2); }
+
+    friend void* asio_handler_allocate(size_t size, MemoryHandler* self)
+    {
+        return self->memory_->Allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, size_t /*size*/, MemoryHandler* self)
+    {
+        self->memory_->Deallocate(pointer);
+    }
+
+private:
+    HandlerMemory* memory_;
+    Handler handler_;
+};
+
+template <typename Handler>
+inline MemoryHandler<Handler> MakeMemoryHandler(HandlerMemory& memory, const Handler& handler)
+{
+    return MemoryHandler<Handler>(&memory, handler);
+}
+
+}  // namespace MumbleClient
+
+#endif
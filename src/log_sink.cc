@@ -0,0 +1,295 @@
+#include "log_sink.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+#include <stdlib.h>
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/stack.hpp>
+#include <boost/thread.hpp>
+
+namespace MumbleClient {
+
+namespace logging {
+
+namespace {
+
+// A slot for one queued record. Slots are made by StartAsyncLogging() and
+// reused, and the line keeps its capacity, so queueing a record of usual
+// length allocates nothing.
+struct LogRecord {
+    LogRecord() : severity(LOG_INFO) { line.reserve(kLineReserve); }
+
+    static const size_t kLineReserve = 256;
+
+    LogSeverity severity;
+    std::string line;
+};
+
+// How long the writer thread sleeps when it may have missed a wakeup
+const int32_t kWriterIdleWait = 100;
+
+StderrLogSink default_sink;
+
+// Serialises Write() calls and guards |sinks|
+boost::mutex sink_mutex;
+std::vector<LogSink*> sinks;
+
+boost::lockfree::queue<LogRecord*> ring(0);
+// Slots not in the ring. Every slot ever made is in one or the other, or
+// held by a thread between the two.
+boost::lockfree::stack<LogRecord*> free_slots(0);
+size_t ring_reserved = 0;
+boost::atomic<bool> async_running(false);
+boost::atomic<uint64_t> dropped(0);
+
+boost::mutex writer_mutex;
+boost::condition_variable writer_wake;
+boost::atomic<bool> writer_sleeping(false);
+boost::thread* writer = NULL;
+bool exit_handler_registered = false;
+
+// Called with sink_mutex held
+void WriteToSinks(LogSeverity severity, const std::string& line) {
+    if (sinks.empty()) {
+        default_sink.Write(severity, line);
+        return;
+    }
+    for (std::vector<LogSink*>::iterator it = sinks.begin(); it != sinks.end(); ++it)
+        (*it)->Write(severity, line);
+}
+
+// Called with sink_mutex held
+void FlushSinks() {
+    if (sinks.empty()) {
+        default_sink.Flush();
+        return;
+    }
+    for (std::vector<LogSink*>::iterator it = sinks.begin(); it != sinks.end(); ++it)
+        (*it)->Flush();
+}
+
+// Called with sink_mutex held. Returns the number of records written.
+size_t DrainRing() {
+    size_t written = 0;
+    LogRecord* record;
+    while (ring.pop(record)) {
+        WriteToSinks(record->severity, record->line);
+        free_slots.bounded_push(record);
+        ++written;
+    }
+    return written;
+}
+
+void RunWriter() {
+    for (;;) {
+        {
+            boost::mutex::scoped_lock lock(sink_mutex);
+            if (DrainRing() > 0)
+                FlushSinks();
+        }
+
+        if (!async_running)
+            break;
+
+        boost::mutex::scoped_lock lock(writer_mutex);
+        writer_sleeping = true;
+        if (ring.empty() && async_running)
+            writer_wake.timed_wait(lock, boost::posix_time::milliseconds(kWriterIdleWait));
+        writer_sleeping = false;
+    }
+}
+
+void StopAsyncLoggingAtExit() {
+    StopAsyncLogging();
+}
+
+}  // namespace
+
+void StderrLogSink::Write(LogSeverity /*severity*/, const std::string& line) {
+#if defined(_WIN32)
+    OutputDebugString(line.c_str());
+#endif
+    fprintf(stderr, "%s", line.c_str());
+}
+
+void StderrLogSink::Flush() {
+    fflush(stderr);
+}
+
+RotatingFileLogSink::RotatingFileLogSink(const std::string& path, uint64_t max_bytes, int32_t max_files) :
+    path_(path),
+    max_bytes_(max_bytes),
+    max_files_(max_files),
+    file_(NULL),
+    size_(0) {
+    Open();
+}
+
+RotatingFileLogSink::~RotatingFileLogSink() {
+    if (file_)
+        fclose(file_);
+}
+
+void RotatingFileLogSink::Open() {
+    file_ = fopen(path_.c_str(), "ab");
+    if (file_ == NULL)
+        return;
+
+    fseek(file_, 0, SEEK_END);
+    long position = ftell(file_);
+    size_ = position > 0 ? static_cast<uint64_t>(position) : 0;
+}
+
+void RotatingFileLogSink::Rotate() {
+    if (file_)
+        fclose(file_);
+    file_ = NULL;
+
+    if (max_files_ <= 0) {
+        remove(path_.c_str());
+    } else {
+        std::ostringstream oldest;
+        oldest << path_ << '.' << max_files_;
+        remove(oldest.str().c_str());
+
+        for (int32_t i = max_files_ - 1; i >= 1; --i) {
+            std::ostringstream from, to;
+            from << path_ << '.' << i;
+            to << path_ << '.' << i + 1;
+            rename(from.str().c_str(), to.str().c_str());
+        }
+
+        std::ostringstream first;
+        first << path_ << ".1";
+        rename(path_.c_str(), first.str().c_str());
+    }
+
+    Open();
+}
+
+void RotatingFileLogSink::Write(LogSeverity /*severity*/, const std::string& line) {
+    if (file_ == NULL)
+        return;
+
+    fwrite(line.data(), 1, line.size(), file_);
+    size_ += line.size();
+
+    if (max_bytes_ > 0 && size_ >= max_bytes_)
+        Rotate();
+}
+
+void RotatingFileLogSink::Flush() {
+    if (file_)
+        fflush(file_);
+}
+
+void CallbackLogSink::Write(LogSeverity severity, const std::string& line) {
+    if (callback_)
+        callback_(severity, line);
+}
+
+void AddLogSink(LogSink* sink) {
+    boost::mutex::scoped_lock lock(sink_mutex);
+    if (std::find(sinks.begin(), sinks.end(), sink) == sinks.end())
+        sinks.push_back(sink);
+}
+
+void RemoveLogSink(LogSink* sink) {
+    boost::mutex::scoped_lock lock(sink_mutex);
+    sinks.erase(std::remove(sinks.begin(), sinks.end(), sink), sinks.end());
+}
+
+void StartAsyncLogging(size_t capacity) {
+    boost::mutex::scoped_lock lock(writer_mutex);
+    if (writer)
+        return;
+
+    // The ring and its slots only ever grow, and are reused across restarts
+    if (capacity > ring_reserved) {
+        ring.reserve(capacity - ring_reserved);
+        free_slots.reserve(capacity - ring_reserved);
+        for (size_t i = ring_reserved; i < capacity; ++i)
+            free_slots.bounded_push(new LogRecord());
+        ring_reserved = capacity;
+    }
+
+    if (!exit_handler_registered) {
+        atexit(StopAsyncLoggingAtExit);
+        exit_handler_registered = true;
+    }
+
+    async_running = true;
+    writer = new boost::thread(RunWriter);
+}
+
+void StopAsyncLogging() {
+    boost::thread* thread;
+    {
+        boost::mutex::scoped_lock lock(writer_mutex);
+        thread = writer;
+        writer = NULL;
+        async_running = false;
+    }
+    if (thread == NULL)
+        return;
+
+    writer_wake.notify_all();
+    thread->join();
+    delete thread;
+
+    boost::mutex::scoped_lock lock(sink_mutex);
+    if (DrainRing() > 0)
+        FlushSinks();
+}
+
+uint64_t GetDroppedLogCount() {
+    return dropped;
+}
+
+void DeliverLogRecord(LogSeverity severity, const std::string& line) {
+    if (severity != LOG_FATAL && async_running) {
+        LogRecord* record;
+        if (!free_slots.pop(record)) {
+            ++dropped;
+            return;
+        }
+        record->severity = severity;
+        record->line.assign(line);
+        if (!ring.bounded_push(record)) {
+            free_slots.bounded_push(record);
+            ++dropped;
+            return;
+        }
+        if (writer_sleeping) {
+            boost::mutex::scoped_lock lock(writer_mutex);
+            writer_wake.notify_one();
+        }
+        // StopAsyncLogging() may have made its last drain between the check
+        // above and the push, so the record would sit in the ring for good
+        if (!async_running) {
+            boost::mutex::scoped_lock lock(sink_mutex);
+            if (DrainRing() > 0)
+                FlushSinks();
+        }
+        return;
+    }
+
+    boost::mutex::scoped_lock lock(sink_mutex);
+    // Anything logged before a fatal record must reach the sinks first
+    if (severity == LOG_FATAL)
+        DrainRing();
+    WriteToSinks(severity, line);
+    FlushSinks();
+}
+
+}  // namespace logging
+
+}  // namespace MumbleClient
@@ -0,0 +1,92 @@
+#ifndef _LIBMUMBLECLIENT_LOG_SINK_H_
+#define _LIBMUMBLECLIENT_LOG_SINK_H_
+
+#include <stdio.h>
+
+#include <string>
+
+#include <boost/function.hpp>
+
+#include "libmumble_stdint.h"
+#include "logging.h"
+#include "visibility.h"
+
+namespace MumbleClient {
+
+namespace logging {
+
+// Destination of finished log records. |line| is fully formatted and ends
+// with a newline. Write() is never called from two threads at once.
+class DLL_PUBLIC LogSink {
+public:
+    virtual ~LogSink() { }
+
+    virtual void Write(LogSeverity severity, const std::string& line) = 0;
+    virtual void Flush() { }
+};
+
+class DLL_PUBLIC StderrLogSink : public LogSink {
+public:
+    virtual void Write(LogSeverity severity, const std::string& line);
+    virtual void Flush();
+};
+
+// Appends to |path|. Once the file grows past |max_bytes| it is renamed to
+// path.1, older files shift up by one and path.|max_files| is removed.
+class DLL_PUBLIC RotatingFileLogSink : public LogSink {
+public:
+    RotatingFileLogSink(const std::string& path, uint64_t max_bytes, int32_t max_files);
+    virtual ~RotatingFileLogSink();
+
+    virtual void Write(LogSeverity severity, const std::string& line);
+    virtual void Flush();
+
+private:
+    void Open();
+    void Rotate();
+
+    const std::string path_;
+    const uint64_t max_bytes_;
+    const int32_t max_files_;
+    FILE* file_;
+    uint64_t size_;
+
+    RotatingFileLogSink(const RotatingFileLogSink&);
+    void operator=(const RotatingFileLogSink&);
+};
+
+class DLL_PUBLIC CallbackLogSink : public LogSink {
+public:
+    typedef boost::function<void (LogSeverity severity, const std::string& line)> Callback;
+
+    explicit CallbackLogSink(const Callback& callback) : callback_(callback) { }
+
+    virtual void Write(LogSeverity severity, const std::string& line);
+
+private:
+    Callback callback_;
+};
+
+// Records go to every added sink, or to stderr when none has been added.
+// Sinks are owned by the caller and must outlive their registration.
+void DLL_PUBLIC AddLogSink(LogSink* sink);
+void DLL_PUBLIC RemoveLogSink(LogSink* sink);
+
+// Moves sink writes to a background thread. Records are copied into one of
+// |capacity| preallocated slots and queued in a lock free ring; when every
+// slot is taken new records are dropped and counted. FATAL records are
+// always written synchronously after the ring has been drained. Without
+// this, records are written on the logging thread.
+void DLL_PUBLIC StartAsyncLogging(size_t capacity);
+// Writes out what is queued and joins the background thread.
+void DLL_PUBLIC StopAsyncLogging();
+uint64_t DLL_PUBLIC GetDroppedLogCount();
+
+// Used by LogMessage
+void DeliverLogRecord(LogSeverity severity, const std::string& line);
+
+}  // namespace logging
+
+}  // namespace MumbleClient
+
+#endif  // _LIBMUMBLECLIENT_LOG_SINK_H_
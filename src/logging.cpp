@@ -21,6 +21,7 @@
 #include <iomanip>
 
 #include "logging.h"
+#include "log_sink.h"
 
 namespace MumbleClient {
 
@@ -38,14 +39,33 @@ int32_t CurrentProcessId() {
 #endif
 }
 
+#if defined(_MSC_VER)
+#define MC_THREAD_LOCAL __declspec(thread)
+#else
+#define MC_THREAD_LOCAL __thread
+#endif
+
+namespace {
+
+// Per thread caches so formatting a record makes no system calls beyond
+// time(). The broken down local time is refreshed once per second.
+MC_THREAD_LOCAL int32_t cached_thread_id = 0;
+MC_THREAD_LOCAL time_t cached_time = 0;
+MC_THREAD_LOCAL struct tm cached_local_time;
+
+}  // namespace
+
 int32_t CurrentThreadId() {
+    if (cached_thread_id == 0) {
 #if defined(_WIN32)
-    return GetCurrentThreadId();
+        cached_thread_id = GetCurrentThreadId();
 #elif defined(__APPLE__)
-    return mach_thread_self();
+        cached_thread_id = mach_thread_self();
 #elif defined(__linux)
-    return syscall(__NR_gettid);
+        cached_thread_id = syscall(__NR_gettid);
 #endif
+    }
+    return cached_thread_id;
 }
 
 void SetLogLevel(int32_t level) {
@@ -74,14 +94,15 @@ void LogMessage::Init(const char* file, int32_t line) {
     stream_ << CurrentThreadId() << ':';
 
     time_t t = time(NULL);
-
-    struct tm local_time;
+    if (t != cached_time) {
 #if defined(_WIN32)
-    localtime_s(&local_time, &t);
+        localtime_s(&cached_local_time, &t);
 #else
-    localtime_r(&t, &local_time);
+        localtime_r(&t, &cached_local_time);
 #endif
-    struct tm* tm_time = &local_time;
+        cached_time = t;
+    }
+    struct tm* tm_time = &cached_local_time;
     stream_ << std::setfill('0')
             << std::setw(2) << 1 + tm_time->tm_mon
             << std::setw(2) << tm_time->tm_mday
@@ -102,13 +123,7 @@ LogMessage::~LogMessage() {
         return;
 
     stream_ << std::endl;
-    std::string str_newline(stream_.str());
-
-#if defined(_WIN32)
-    OutputDebugString(str_newline.c_str());
-#endif
-    fprintf(stderr, "%s", str_newline.c_str());
-    fflush(stderr);
+    DeliverLogRecord(severity_, stream_.str());
 
     if (severity_ == LOG_FATAL) {
 #if _WIN32
@@ -12,6 +12,10 @@ namespace logging {
 void DLL_PUBLIC SetLogLevel(int32_t level);
 int32_t DLL_PUBLIC GetLogLevel();
 
+// Ids that prefix every log line, also used by the tracer
+int32_t CurrentProcessId();
+int32_t CurrentThreadId();
+
 typedef int32_t LogSeverity;
 const LogSeverity LOG_INFO = 0;
 const LogSeverity LOG_WARNING = 1;
@@ -19,17 +23,29 @@ const LogSeverity LOG_ERROR = 2;
 const LogSeverity LOG_FATAL = 3;
 const LogSeverity LOG_NUM_SEVERITIES = 4;
 
+// Current threshold, read inline by the logging macros. Use SetLogLevel()
+// to change it.
+extern DLL_PUBLIC int32_t log_level;
+
 #define MC_LOG_INFO ::MumbleClient::logging::LogMessage(__FILE__, __LINE__, ::MumbleClient::logging::LOG_INFO)
 #define MC_LOG_WARNING ::MumbleClient::logging::LogMessage(__FILE__, __LINE__, ::MumbleClient::logging::LOG_WARNING)
 #define MC_LOG_ERROR ::MumbleClient::logging::LogMessage(__FILE__, __LINE__, ::MumbleClient::logging::LOG_ERROR)
 #define MC_LOG_FATAL ::MumbleClient::logging::LogMessage(__FILE__, __LINE__, ::MumbleClient::logging::LOG_FATAL)
 
-#define LOG(severity) MC_LOG_ ## severity.stream()
+#define MC_LOG_IS_ON(severity) \
+    (::MumbleClient::logging::LOG_ ## severity >= ::MumbleClient::logging::log_level)
+
+// The severity is checked before the LogMessage is constructed, so a
+// suppressed statement costs one compare and evaluates none of its operands.
+#define LOG(severity) \
+    !MC_LOG_IS_ON(severity) ? static_cast<void>(0) : \
+    ::MumbleClient::logging::LogMessageVoidify() & MC_LOG_ ## severity.stream()
 
 #if !defined(NDEBUG)
-#define DLOG(severity) MC_LOG_ ## severity.stream()
+#define DLOG(severity) LOG(severity)
 #else
-#define DLOG(severity) true ? 0 : ::MumbleClient::logging::LogMessageVoidify() & LOG(severity)
+#define DLOG(severity) \
+    true ? static_cast<void>(0) : ::MumbleClient::logging::LogMessageVoidify() & MC_LOG_ ## severity.stream()
 #endif
 
 class DLL_PUBLIC LogMessage {
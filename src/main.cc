@@ -102,12 +102,7 @@ int frames = scanPacket(buffer, l);
 buffer[0] = MumbleClient::UdpMessageType::UDPVoiceCELTAlpha | 0;
 memcpy(&buffer[1], &buffer[2], l - 1);
 
-#define TCP 0
-#if TCP
-mc->SendRawUdpTunnel(buffer, l - 1);
-#else
-mc->SendUdpMessage(buffer, l - 1);
-#endif
+mc->SendVoice(buffer, l - 1);
 
 boost::this_thread::sleep(boost::posix_time::milliseconds(frames * 10));
 free(buffer);
@@ -212,12 +207,7 @@ pds.append(s);
 packet_list.pop_front();
 }
 
-#define TCP 0
-#if TCP
-mc->SendRawUdpTunnel(data, pds.size() + 1);
-#else
-mc->SendUdpMessage(data, pds.size() + 1);
-#endif
+mc->SendVoice(data, pds.size() + 1);
 boost::this_thread::sleep(boost::posix_time::milliseconds((frames) * 10));
 }
 
@@ -274,36 +264,47 @@ fs.write(reinterpret_cast<char *>(buffer), length);
 fs.close();
 }
 
+// Queued packets hold a slice of the receive buffer, not a copy
 struct RelayMessage {
 MumbleClient::MumbleClient* mc;
-const std::string message;
-RelayMessage(MumbleClient::MumbleClient* mc_, const std::string& message_) : mc(mc_), message(message_) { }
+MumbleClient::VoiceSlice packet;
+RelayMessage(MumbleClient::MumbleClient* mc_, const MumbleClient::VoiceSlice& packet_) : mc(mc_), packet(packet_) { }
 };
 
 boost::condition_variable cond;
 boost::mutex mut;
-std::deque< boost::shared_ptr<RelayMessage> > relay_queue;
+std::deque<RelayMessage> relay_queue;
 
 void RelayThread() {
+// Reused for every packet, so relaying allocates nothing once it has grown
+std::vector<char> out;
 boost::unique_lock<boost::mutex> lock(mut);
 while (true) {
 while (relay_queue.empty()) {
 cond.wait(lock);
 }
 
-boost::shared_ptr<RelayMessage>& r = relay_queue.front();
-r->mc->SendRawUdpTunnel(r->message.data(), r->message.size());
+RelayMessage r = relay_queue.front();
 relay_queue.pop_front();
+lock.unlock();
+
+// Drop the sender's session, which follows the header byte
+const char* data = r.packet.data();
+size_t session_len = r.packet.size() > 1 ? pds_int_len(const_cast<char *>(&data[1])) : 0;
+if (r.packet.size() > 1 + session_len) {
+out.assign(data, data + 1);
+out.insert(out.end(), data + 1 + session_len, data + r.packet.size());
+r.mc->SendRawUdpTunnel(&out[0], static_cast<int32_t>(out.size()));
+}
+
+lock.lock();
 }
 }
 
-void RelayTunnelCallback(int32_t length, void* buffer, MumbleClient::MumbleClient* mc) {
-std::string s(static_cast<char *>(buffer), length);
-s.erase(1, pds_int_len(&static_cast<char *>(buffer)[1]));
-boost::shared_ptr<RelayMessage> r = boost::make_shared<RelayMessage>(mc, s);
+void RelayTunnelCallback(const MumbleClient::VoiceSlice& packet, MumbleClient::MumbleClient* mc) {
 {
 boost::lock_guard<boost::mutex> lock(mut);
-relay_queue.push_back(r);
+relay_queue.push_back(RelayMessage(mc, packet));
 }
 cond.notify_all();
 }
@@ -327,8 +328,12 @@ mc->SetAuthCallback(boost::bind(&AuthCallback));
 mc->SetTextMessageCallback(boost::bind(&TextMessageCallback, _1, mc));
 mc->SetRawUdpTunnelCallback(boost::bind(&RawUdpTunnelCallback, _1, _2));
 
-//mc->SetRawUdpTunnelCallback(boost::bind(&RelayTunnelCallback, _1, _2, mc2));
-//mc2->SetRawUdpTunnelCallback(boost::bind(&RelayTunnelCallback, _1, _2, mc));
+// The recording callback writes to disk, keep it off the network thread
+MumbleClient::CallbackExecutor executor(256, MumbleClient::CallbackExecutor::kDropOldest);
+mc->SetCallbackExecutor(&executor);
+
+//mc->SetVoiceSliceCallback(boost::bind(&RelayTunnelCallback, _1, mc2));
+//mc2->SetVoiceSliceCallback(boost::bind(&RelayTunnelCallback, _1, mc));
 
 //boost::thread relay_thread = boost::thread(RelayThread);
 
@@ -0,0 +1,97 @@
+#include "message_framer.h"
+
+#include <string.h>
+
+namespace MumbleClient
+{
+    namespace
+    {
+        // Never issue socket reads smaller than this, even when only a few
+        // bytes are missing from the current frame.
+        const size_t kMinReadSize = 4096;
+    }
+
+    MessageFramer::MessageFramer(size_t initial_capacity) :
+        data_(new char[initial_capacity]),
+        capacity_(initial_capacity),
+        read_pos_(0),
+        write_pos_(0)
+    {
+    }
+
+    MessageFramer::~MessageFramer()
+    {
+        delete[] data_;
+    }
+
+    size_t MessageFramer::Needed() const
+    {
+        size_t buffered = Buffered();
+        if (buffered < static_cast<size_t>(MessageHeader::kSize))
+            return MessageHeader::kSize - buffered;
+
+        MessageHeader header(reinterpret_cast<const unsigned char*>(data_ + read_pos_));
+        size_t frame = MessageHeader::kSize + static_cast<size_t>(header.length());
+        return frame > buffered ? frame - buffered : 0;
+    }
+
+    boost::asio::mutable_buffers_1 MessageFramer::Prepare()
+    {
+        size_t want = Needed();
+        if (want < kMinReadSize)
+            want = kMinReadSize;
+
+        if (capacity_ - write_pos_ < want)
+        {
+            size_t buffered = Buffered();
+            if (capacity_ - buffered >= want)
+            {
+                // Enough room once the partial frame is moved to the front
+                memmove(data_, data_ + read_pos_, buffered);
+            }
+            else
+            {
+                size_t new_capacity = capacity_ * 2;
+                while (new_capacity - buffered < want)
+                    new_capacity *= 2;
+
+                char* new_data = new char[new_capacity];
+                memcpy(new_data, data_ + read_pos_, buffered);
+                delete[] data_;
+                data_ = new_data;
+                capacity_ = new_capacity;
+            }
+            read_pos_ = 0;
+            write_pos_ = buffered;
+        }
+
+        return boost::asio::buffer(data_ + write_pos_, capacity_ - write_pos_);
+    }
+
+    void MessageFramer::Commit(size_t bytes)
+    {
+        write_pos_ += bytes;
+    }
+
+    MessageFramer::Result MessageFramer::Next(MessageHeader& header, char*& body)
+    {
+        size_t buffered = Buffered();
+        if (buffered < static_cast<size_t>(MessageHeader::kSize))
+            return kIncomplete;
+
+        header = MessageHeader(reinterpret_cast<const unsigned char*>(data_ + read_pos_));
+        if (header.length() < 0 || header.length() > kMaxMessageLength)
+            return kInvalid;
+
+        size_t frame = MessageHeader::kSize + static_cast<size_t>(header.length());
+        if (buffered < frame)
+            return kIncomplete;
+
+        body = data_ + read_pos_ + MessageHeader::kSize;
+        read_pos_ += frame;
+        if (read_pos_ == write_pos_)
+            read_pos_ = write_pos_ = 0;
+
+        return kFrame;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef _LIBMUMBLECLIENT_MESSAGE_FRAMER_H_
+#define _LIBMUMBLECLIENT_MESSAGE_FRAMER_H_
+
+#include <cstddef>
+
+#include <boost/asio/buffer.hpp>
+
+#include "libmumble_stdint.h"
+
+namespace MumbleClient {
+
+// Six byte TCP control stream header: 16 bit type, 32 bit length, big endian.
+class MessageHeader
+{
+public:
+    static const int32_t kSize = 6;
+
+    MessageHeader() { }
+    explicit MessageHeader(const unsigned char* d) { for (int i = 0; i < kSize; ++i) d_[i] = d[i]; }
+
+    int16_t type() const { return (d_[0] << 8) | d_[1]; }
+    int32_t length() const { return (d_[2] << 24) | (d_[3] << 16) | (d_[4] << 8) | d_[5]; }
+
+    void type(int16_t t_) { d_[0] = t_ >> 8; d_[1] = t_ & 0xFF; }
+    void length(int32_t l_)
+    {
+        d_[2] = static_cast<unsigned char>(l_ >> 24);
+        d_[3] = static_cast<unsigned char>(l_ >> 16);
+        d_[4] = static_cast<unsigned char>(l_ >> 8);
+        d_[5] = static_cast<unsigned char>(l_ & 0xFF);
+    }
+
+    const unsigned char* data() const { return d_; }
+
+private:
+    unsigned char d_[kSize];
+};
+
+// Splits the TCP control stream into messages without copying them.
+//
+// Socket reads go straight into one contiguous buffer. Complete frames are
+// handed out as pointers into that buffer and stay valid until the next
+// call to Prepare(). Unconsumed bytes are moved to the front only when the
+// free space at the end runs out, so a burst of small messages costs no
+// allocation or copy per message.
+class MessageFramer
+{
+public:
+    enum Result
+    {
+        kIncomplete,
+        kFrame,
+        kInvalid
+    };
+
+    // Largest message body we accept before treating the stream as corrupt.
+    static const int32_t kMaxMessageLength = 0x7FFFF;
+
+    explicit MessageFramer(size_t initial_capacity = 64 * 1024);
+    ~MessageFramer();
+
+    // Returns writable space for the next socket read. The space is at least
+    // large enough to complete the frame currently at the read position.
+    boost::asio::mutable_buffers_1 Prepare();
+    // Marks |bytes| of the buffer returned by Prepare() as received.
+    void Commit(size_t bytes);
+
+    // Extracts the next complete frame. On kFrame |body| points into the
+    // internal buffer and |header| describes it.
+    Result Next(MessageHeader& header, char*& body);
+
+    size_t Buffered() const { return write_pos_ - read_pos_; }
+    void Reset() { read_pos_ = write_pos_ = 0; }
+
+private:
+    size_t Needed() const;
+
+    char* data_;
+    size_t capacity_;
+    size_t read_pos_;
+    size_t write_pos_;
+
+    MessageFramer(const MessageFramer&);
+    void operator=(const MessageFramer&);
+};
+
+}  // namespace MumbleClient
+
+#endif
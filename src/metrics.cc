@@ -0,0 +1,203 @@
+#include "metrics.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace MumbleClient
+{
+    const uint64_t kLatencyBucketBounds[kLatencyBucketCount - 1] = {
+        100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000
+    };
+
+    namespace
+    {
+        const char* const kPbMessageTypeNames[kPbMessageTypeCount] = {
+            "Version", "UDPTunnel", "Authenticate", "Ping", "Reject", "ServerSync",
+            "ChannelRemove", "ChannelState", "UserRemove", "UserState", "BanList",
+            "TextMessage", "PermissionDenied", "ACL", "QueryUsers", "CryptSetup",
+            "ContextActionAdd", "ContextAction", "UserList", "VoiceTarget",
+            "PermissionQuery", "CodecVersion", "UserStats", "RequestBlob", "ServerConfig"
+        };
+
+        void MergeCrypt(CryptStats& into, const CryptStats& from)
+        {
+            into.good += from.good;
+            into.late += from.late;
+            into.lost += from.lost;
+            into.resync += from.resync;
+        }
+
+        void MergeHistogram(LatencyHistogram& into, const LatencyHistogram& from)
+        {
+            for (int32_t i = 0; i < kLatencyBucketCount; ++i)
+                into.buckets[i] += from.buckets[i];
+            into.count += from.count;
+            into.sum += from.sum;
+        }
+
+        void WriteHeader(std::ostream& out, const std::string& name, const char* type, const char* help)
+        {
+            out << "# HELP " << name << ' ' << help << '\n';
+            out << "# TYPE " << name << ' ' << type << '\n';
+        }
+
+        void WriteValue(std::ostream& out, const std::string& prefix, const char* name, const char* type, const char* help, uint64_t value)
+        {
+            std::string full = prefix + '_' + name;
+            WriteHeader(out, full, type, help);
+            out << full << ' ' << value << '\n';
+        }
+
+        void WriteMessages(std::ostream& out, const std::string& prefix, const MetricsSnapshot& snapshot, const char* name, const char* help, uint64_t MessageTypeStats::*field)
+        {
+            std::string full = prefix + '_' + name;
+            WriteHeader(out, full, "counter", help);
+            for (int32_t i = 0; i < kPbMessageTypeCount; ++i)
+                out << full << "{type=\"" << kPbMessageTypeNames[i] << "\"} " << snapshot.messages[i].*field << '\n';
+        }
+
+        void WriteCrypt(std::ostream& out, const std::string& prefix, const char* name, const char* help, const CryptStats& stats)
+        {
+            std::string full = prefix + '_' + name;
+            WriteHeader(out, full, "counter", help);
+            out << full << "{result=\"good\"} " << stats.good << '\n';
+            out << full << "{result=\"late\"} " << stats.late << '\n';
+            out << full << "{result=\"lost\"} " << stats.lost << '\n';
+            out << full << "{result=\"resync\"} " << stats.resync << '\n';
+        }
+
+        // Buckets are converted to cumulative counts and seconds
+        void WriteHistogram(std::ostream& out, const std::string& prefix, const char* name, const char* help, const LatencyHistogram& histogram)
+        {
+            std::string full = prefix + '_' + name;
+            WriteHeader(out, full, "histogram", help);
+
+            uint64_t cumulative = 0;
+            for (int32_t i = 0; i < kLatencyBucketCount - 1; ++i)
+            {
+                cumulative += histogram.buckets[i];
+                out << full << "_bucket{le=\"" << kLatencyBucketBounds[i] / 1e6 << "\"} " << cumulative << '\n';
+            }
+            cumulative += histogram.buckets[kLatencyBucketCount - 1];
+            out << full << "_bucket{le=\"+Inf\"} " << cumulative << '\n';
+            out << full << "_sum " << histogram.sum / 1e6 << '\n';
+            out << full << "_count " << histogram.count << '\n';
+        }
+    }
+
+    void ClearMetrics(MetricsSnapshot& snapshot)
+    {
+        memset(&snapshot, 0, sizeof(snapshot));
+    }
+
+    void MergeMetrics(MetricsSnapshot& into, const MetricsSnapshot& from)
+    {
+        into.clients += from.clients;
+
+        for (int32_t i = 0; i < kPbMessageTypeCount; ++i)
+        {
+            into.messages[i].messages_in += from.messages[i].messages_in;
+            into.messages[i].bytes_in += from.messages[i].bytes_in;
+            into.messages[i].messages_out += from.messages[i].messages_out;
+            into.messages[i].bytes_out += from.messages[i].bytes_out;
+            into.messages[i].messages_skipped += from.messages[i].messages_skipped;
+            into.messages[i].bytes_skipped += from.messages[i].bytes_skipped;
+        }
+
+        into.network.udp_packets_sent += from.network.udp_packets_sent;
+        into.network.udp_packets_received += from.network.udp_packets_received;
+        into.network.udp_send_syscalls += from.network.udp_send_syscalls;
+        into.network.udp_recv_syscalls += from.network.udp_recv_syscalls;
+        into.network.tcp_writes += from.network.tcp_writes;
+        into.network.tcp_bytes_sent += from.network.tcp_bytes_sent;
+        into.network.tcp_messages_sent += from.network.tcp_messages_sent;
+        into.network.udp_pool_fallbacks += from.network.udp_pool_fallbacks;
+
+        into.send_queue.control_depth += from.send_queue.control_depth;
+        into.send_queue.control_high_water = std::max(into.send_queue.control_high_water, from.send_queue.control_high_water);
+        into.send_queue.voice_depth += from.send_queue.voice_depth;
+        into.send_queue.voice_high_water = std::max(into.send_queue.voice_high_water, from.send_queue.voice_high_water);
+        into.send_queue.voice_dropped_age += from.send_queue.voice_dropped_age;
+        into.send_queue.voice_dropped_depth += from.send_queue.voice_dropped_depth;
+        into.send_queue.submissions_dropped += from.send_queue.submissions_dropped;
+        into.send_queue.submissions_spilled += from.send_queue.submissions_spilled;
+
+        MergeCrypt(into.crypt_local, from.crypt_local);
+        MergeCrypt(into.crypt_remote, from.crypt_remote);
+
+        MergeHistogram(into.tcp_rtt, from.tcp_rtt);
+        MergeHistogram(into.udp_rtt, from.udp_rtt);
+        MergeHistogram(into.callback_time, from.callback_time);
+    }
+
+    std::string FormatPrometheusMetrics(const MetricsSnapshot& snapshot, const std::string& prefix)
+    {
+        std::ostringstream out;
+        out << std::setprecision(12);
+
+        WriteValue(out, prefix, "clients", "gauge", "Clients the metrics cover", snapshot.clients);
+
+        WriteMessages(out, prefix, snapshot, "messages_received_total", "Control messages received", &MessageTypeStats::messages_in);
+        WriteMessages(out, prefix, snapshot, "message_bytes_received_total", "Control message bytes received, headers included", &MessageTypeStats::bytes_in);
+        WriteMessages(out, prefix, snapshot, "messages_sent_total", "Control messages sent", &MessageTypeStats::messages_out);
+        WriteMessages(out, prefix, snapshot, "message_bytes_sent_total", "Control message bytes sent, headers included", &MessageTypeStats::bytes_out);
+        WriteMessages(out, prefix, snapshot, "messages_skipped_total", "Control messages received but not parsed, as nothing consumes them", &MessageTypeStats::messages_skipped);
+        WriteMessages(out, prefix, snapshot, "message_bytes_skipped_total", "Control message bytes received but not parsed, headers included", &MessageTypeStats::bytes_skipped);
+
+        WriteValue(out, prefix, "udp_packets_sent_total", "counter", "UDP packets sent", snapshot.network.udp_packets_sent);
+        WriteValue(out, prefix, "udp_packets_received_total", "counter", "UDP packets received", snapshot.network.udp_packets_received);
+        WriteValue(out, prefix, "udp_send_syscalls_total", "counter", "System calls used to send UDP packets", snapshot.network.udp_send_syscalls);
+        WriteValue(out, prefix, "udp_recv_syscalls_total", "counter", "System calls used to receive UDP packets", snapshot.network.udp_recv_syscalls);
+        WriteValue(out, prefix, "tcp_writes_total", "counter", "TCP writes", snapshot.network.tcp_writes);
+        WriteValue(out, prefix, "tcp_bytes_sent_total", "counter", "Bytes written to the TCP connection", snapshot.network.tcp_bytes_sent);
+        WriteValue(out, prefix, "udp_pool_fallbacks_total", "counter", "Voice packets tunnelled because every UDP send buffer was in use", snapshot.network.udp_pool_fallbacks);
+
+        WriteValue(out, prefix, "control_queue_depth", "gauge", "Control messages waiting to be sent", snapshot.send_queue.control_depth);
+        WriteValue(out, prefix, "control_queue_high_water", "gauge", "Most control messages ever queued", snapshot.send_queue.control_high_water);
+        WriteValue(out, prefix, "voice_queue_depth", "gauge", "Tunnelled voice frames waiting to be sent", snapshot.send_queue.voice_depth);
+        WriteValue(out, prefix, "voice_queue_high_water", "gauge", "Most tunnelled voice frames ever queued", snapshot.send_queue.voice_high_water);
+        WriteValue(out, prefix, "voice_dropped_age_total", "counter", "Tunnelled voice frames dropped for age", snapshot.send_queue.voice_dropped_age);
+        WriteValue(out, prefix, "voice_dropped_depth_total", "counter", "Tunnelled voice frames dropped for queue depth", snapshot.send_queue.voice_dropped_depth);
+        WriteValue(out, prefix, "submissions_dropped_total", "counter", "Voice packets dropped because the submission queue was full", snapshot.send_queue.submissions_dropped);
+        WriteValue(out, prefix, "submissions_spilled_total", "counter", "Control messages and tunnelled voice that waited in the overflow list", snapshot.send_queue.submissions_spilled);
+
+        WriteCrypt(out, prefix, "crypt_packets_total", "UDP packets decrypted by this client", snapshot.crypt_local);
+        WriteCrypt(out, prefix, "crypt_remote_packets_total", "UDP packets decrypted by the server", snapshot.crypt_remote);
+
+        WriteHistogram(out, prefix, "tcp_rtt_seconds", "TCP ping round trip time", snapshot.tcp_rtt);
+        WriteHistogram(out, prefix, "udp_rtt_seconds", "UDP ping round trip time", snapshot.udp_rtt);
+        WriteHistogram(out, prefix, "callback_seconds", "Time spent in client callbacks", snapshot.callback_time);
+
+        return out.str();
+    }
+
+    MetricHistogram::MetricHistogram() :
+        count_(0),
+        sum_(0)
+    {
+        for (int32_t i = 0; i < kLatencyBucketCount; ++i)
+            buckets_[i].store(0, boost::memory_order_relaxed);
+    }
+
+    void MetricHistogram::Record(uint64_t microseconds)
+    {
+        int32_t bucket = 0;
+        while (bucket < kLatencyBucketCount - 1 && microseconds > kLatencyBucketBounds[bucket])
+            ++bucket;
+
+        buckets_[bucket].fetch_add(1, boost::memory_order_relaxed);
+        count_.fetch_add(1, boost::memory_order_relaxed);
+        sum_.fetch_add(microseconds, boost::memory_order_relaxed);
+    }
+
+    void MetricHistogram::Read(LatencyHistogram& histogram) const
+    {
+        for (int32_t i = 0; i < kLatencyBucketCount; ++i)
+            histogram.buckets[i] = buckets_[i].load(boost::memory_order_relaxed);
+        histogram.count = count_.load(boost::memory_order_relaxed);
+        histogram.sum = sum_.load(boost::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef _LIBMUMBLECLIENT_METRICS_H_
+#define _LIBMUMBLECLIENT_METRICS_H_
+
+#include <cstddef>
+#include <string>
+
+#include <boost/atomic.hpp>
+
+#include "libmumble_stdint.h"
+#include "messages.h"
+#include "visibility.h"
+
+namespace MumbleClient {
+
+const int32_t kPbMessageTypeCount = PbMessageType::ServerConfig + 1;
+
+// Upper bounds of the latency buckets in microseconds. One more bucket
+// collects everything above the last bound.
+const int32_t kLatencyBucketCount = 14;
+extern DLL_PUBLIC const uint64_t kLatencyBucketBounds[kLatencyBucketCount - 1];
+
+// Socket level counters. Packets over system calls gives the batching gain.
+struct NetworkStats
+{
+    uint64_t udp_packets_sent;
+    uint64_t udp_packets_received;
+    uint64_t udp_send_syscalls;
+    uint64_t udp_recv_syscalls;
+    uint64_t tcp_writes;
+    uint64_t tcp_bytes_sent;
+    uint64_t tcp_messages_sent;
+    // Voice sent through the TCP tunnel because every UDP buffer was in use
+    uint64_t udp_pool_fallbacks;
+};
+
+// TCP send queue state. Control messages are never dropped; tunnelled
+// voice is dropped oldest first once it is too old or the queue is too
+// deep. When the submission queue from other threads is full, control
+// messages and tunnelled voice are spilled to an overflow list and UDP
+// voice is dropped.
+struct SendQueueStats
+{
+    size_t control_depth;
+    size_t control_high_water;
+    size_t voice_depth;
+    size_t voice_high_water;
+    uint64_t voice_dropped_age;
+    uint64_t voice_dropped_depth;
+    uint64_t submissions_dropped;
+    uint64_t submissions_spilled;
+};
+
+// Control messages and their bytes, header included. Skipped messages are
+// received ones that nothing consumed, so they were never parsed.
+struct MessageTypeStats
+{
+    uint64_t messages_in;
+    uint64_t bytes_in;
+    uint64_t messages_out;
+    uint64_t bytes_out;
+    uint64_t messages_skipped;
+    uint64_t bytes_skipped;
+};
+
+// UDP packets decrypted in order, out of order, missing and crypt resyncs
+struct CryptStats
+{
+    uint64_t good;
+    uint64_t late;
+    uint64_t lost;
+    uint64_t resync;
+};
+
+// Per bucket counts, not cumulative. |sum| is in microseconds.
+struct LatencyHistogram
+{
+    uint64_t buckets[kLatencyBucketCount];
+    uint64_t count;
+    uint64_t sum;
+};
+
+struct MetricsSnapshot
+{
+    uint32_t clients;
+    MessageTypeStats messages[kPbMessageTypeCount];
+    NetworkStats network;
+    SendQueueStats send_queue;
+    // Packets we received, and the server's view from its pings
+    CryptStats crypt_local;
+    CryptStats crypt_remote;
+    LatencyHistogram tcp_rtt;
+    LatencyHistogram udp_rtt;
+    LatencyHistogram callback_time;
+};
+
+void DLL_PUBLIC ClearMetrics(MetricsSnapshot& snapshot);
+// Adds up counters and depths; high water marks take the larger value.
+void DLL_PUBLIC MergeMetrics(MetricsSnapshot& into, const MetricsSnapshot& from);
+// Prometheus text exposition format, every name starting with |prefix|_
+std::string DLL_PUBLIC FormatPrometheusMetrics(const MetricsSnapshot& snapshot, const std::string& prefix = "mumbleclient");
+
+// Counter written by one thread at a time, a client's strand, and read from
+// any. Updates are a plain load and store rather than a locked instruction.
+class MetricCounter
+{
+public:
+    MetricCounter() : value_(0) { }
+
+    void Add(uint64_t n) { value_.store(value_.load(boost::memory_order_relaxed) + n, boost::memory_order_relaxed); }
+    void Set(uint64_t n) { value_.store(n, boost::memory_order_relaxed); }
+    uint64_t Get() const { return value_.load(boost::memory_order_relaxed); }
+
+private:
+    boost::atomic<uint64_t> value_;
+
+    MetricCounter(const MetricCounter&);
+    void operator=(const MetricCounter&);
+};
+
+// Latency histogram that may be recorded from several threads, such as the
+// network thread and a callback executor.
+class MetricHistogram
+{
+public:
+    MetricHistogram();
+
+    void Record(uint64_t microseconds);
+    void Read(LatencyHistogram& histogram) const;
+
+private:
+    boost::atomic<uint64_t> buckets_[kLatencyBucketCount];
+    boost::atomic<uint64_t> count_;
+    boost::atomic<uint64_t> sum_;
+
+    MetricHistogram(const MetricHistogram&);
+    void operator=(const MetricHistogram&);
+};
+
+}  // namespace MumbleClient
+
+#endif
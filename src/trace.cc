@@ -0,0 +1,231 @@
+#include "trace.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "logging.h"
+
+#if defined(_MSC_VER)
+#define MC_THREAD_LOCAL __declspec(thread)
+#else
+#define MC_THREAD_LOCAL __thread
+#endif
+
+namespace MumbleClient {
+
+namespace trace {
+
+namespace {
+
+struct Event {
+    const char* name;
+    const void* id;
+    uint64_t start;
+    uint64_t duration;
+};
+
+// Ring of events written only by its own thread, without a lock. Readers
+// take a snapshot: they copy the events up to |recorded| and then drop the
+// ones the owner has started to overwrite meanwhile, which |started| tells.
+// The mutex only keeps |events| alive while it is read; the owner takes it
+// just to replace the ring on the first event of a new trace.
+struct ThreadBuffer {
+    boost::mutex mutex;
+    Event* events;
+    size_t capacity;
+    // Trace the ring belongs to; changed by the owner with the mutex held
+    uint64_t generation;
+    // Events begun and events completed; the ring wraps around once full
+    boost::atomic<uint64_t> started;
+    boost::atomic<uint64_t> recorded;
+    int32_t thread_id;
+};
+
+const size_t kDefaultEventsPerThread = 64 * 1024;
+const uint64_t kNoGeneration = ~0ULL;
+
+boost::atomic<bool> enabled(false);
+boost::atomic<size_t> events_per_thread(kDefaultEventsPerThread);
+// Bumped by every start or clear, which empties all rings
+boost::atomic<uint64_t> trace_generation(0);
+
+// Buffers of every thread that ever recorded; kept after the thread exits
+// so its events still show up in the dump
+boost::mutex registry_mutex;
+std::vector<ThreadBuffer*> buffers;
+
+MC_THREAD_LOCAL ThreadBuffer* current_buffer = NULL;
+
+uint64_t NowMicroseconds() {
+    static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return static_cast<uint64_t>((boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds());
+}
+
+ThreadBuffer* CurrentBuffer() {
+    if (current_buffer == NULL) {
+        ThreadBuffer* buffer = new ThreadBuffer();
+        buffer->events = NULL;
+        buffer->capacity = 0;
+        buffer->generation = kNoGeneration;
+        buffer->started = 0;
+        buffer->recorded = 0;
+        buffer->thread_id = logging::CurrentThreadId();
+
+        boost::mutex::scoped_lock lock(registry_mutex);
+        buffers.push_back(buffer);
+        current_buffer = buffer;
+    }
+    return current_buffer;
+}
+
+// Called by the owner on its first event of a new trace
+void ResetBuffer(ThreadBuffer* buffer, uint64_t generation) {
+    size_t capacity = events_per_thread;
+
+    boost::mutex::scoped_lock lock(buffer->mutex);
+    if (buffer->capacity != capacity) {
+        delete[] buffer->events;
+        buffer->events = new Event[capacity];
+        buffer->capacity = capacity;
+    }
+    buffer->started = 0;
+    buffer->recorded = 0;
+    buffer->generation = generation;
+}
+
+void Record(const char* name, const void* id, uint64_t start, uint64_t end) {
+    ThreadBuffer* buffer = CurrentBuffer();
+    uint64_t generation = trace_generation.load(boost::memory_order_acquire);
+    if (buffer->generation != generation)
+        ResetBuffer(buffer, generation);
+
+    Event event;
+    event.name = name;
+    event.id = id;
+    event.start = start;
+    event.duration = end > start ? end - start : 0;
+
+    // Readers learn of the overwrite before it happens
+    uint64_t n = buffer->recorded.load(boost::memory_order_relaxed);
+    buffer->started.store(n + 1, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+    buffer->events[n % buffer->capacity] = event;
+    buffer->recorded.store(n + 1, boost::memory_order_release);
+}
+
+// Appends the events of |buffer| that were complete and not overwritten
+// while they were copied, oldest first
+void SnapshotBuffer(ThreadBuffer* buffer, uint64_t generation, std::vector<Event>& events) {
+    boost::mutex::scoped_lock lock(buffer->mutex);
+    if (buffer->generation != generation || buffer->capacity == 0)
+        return;
+
+    uint64_t capacity = buffer->capacity;
+    uint64_t recorded = buffer->recorded.load(boost::memory_order_acquire);
+    uint64_t first = recorded > capacity ? recorded - capacity : 0;
+    size_t copied_from = events.size();
+    for (uint64_t n = first; n < recorded; ++n)
+        events.push_back(buffer->events[n % capacity]);
+
+    boost::atomic_thread_fence(boost::memory_order_acquire);
+    uint64_t started = buffer->started.load(boost::memory_order_relaxed);
+    uint64_t valid = started > capacity ? started - capacity : 0;
+    if (valid > first) {
+        size_t torn = static_cast<size_t>(std::min(valid, recorded) - first);
+        events.erase(events.begin() + copied_from, events.begin() + copied_from + torn);
+    }
+}
+
+void WriteEvent(std::ostream& out, const Event& event, int32_t pid, int32_t tid) {
+    out << "{\"name\":\"" << event.name << "\",\"cat\":\"mumbleclient\",\"ph\":\"X\""
+        << ",\"ts\":" << event.start << ",\"dur\":" << event.duration
+        << ",\"pid\":" << pid << ",\"tid\":" << tid;
+    if (event.id)
+        out << ",\"args\":{\"id\":\"" << event.id << "\"}";
+    out << '}';
+}
+
+}  // namespace
+
+void StartTracing(size_t events) {
+    // The size is in place before the new generation makes rings pick it up
+    events_per_thread = events > 0 ? events : 1;
+    ClearTrace();
+    enabled = true;
+}
+
+void StopTracing() {
+    enabled = false;
+}
+
+void ClearTrace() {
+    // Rings are emptied by their owners on their next event; until then the
+    // dump skips them
+    trace_generation.fetch_add(1);
+}
+
+bool IsTracingCompiledIn() {
+#if defined(WITH_TRACING)
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::string GetTraceJson() {
+    std::ostringstream out;
+    int32_t pid = logging::CurrentProcessId();
+    bool first = true;
+
+    out << "{\"traceEvents\":[";
+
+    uint64_t generation = trace_generation;
+    std::vector<Event> events;
+
+    boost::mutex::scoped_lock registry_lock(registry_mutex);
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        events.clear();
+        SnapshotBuffer(buffers[i], generation, events);
+        for (size_t n = 0; n < events.size(); ++n) {
+            if (!first)
+                out << ",\n";
+            first = false;
+            WriteEvent(out, events[n], pid, buffers[i]->thread_id);
+        }
+    }
+
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+    return out.str();
+}
+
+bool WriteTraceJson(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+
+    std::string json = GetTraceJson();
+    bool written = fwrite(json.data(), 1, json.size(), file) == json.size();
+    return fclose(file) == 0 && written;
+}
+
+Scope::Scope(const char* name, const void* id) :
+    name_(name),
+    id_(id),
+    start_(enabled ? NowMicroseconds() : 0) {
+}
+
+Scope::~Scope() {
+    if (start_ != 0 && enabled)
+        Record(name_, id_, start_, NowMicroseconds());
+}
+
+}  // namespace trace
+
+}  // namespace MumbleClient
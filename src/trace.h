@@ -0,0 +1,61 @@
+#ifndef _LIBMUMBLECLIENT_TRACE_H_
+#define _LIBMUMBLECLIENT_TRACE_H_
+
+#include <cstddef>
+#include <string>
+
+#include "libmumble_stdint.h"
+#include "visibility.h"
+
+namespace MumbleClient {
+
+namespace trace {
+
+// Trace points are compiled in with the WITH_TRACING CMake option. Each
+// thread records into a buffer of its own without taking a lock, so
+// recording never waits on another thread, not even on a dump. A buffer
+// keeps the newest |events_per_thread| events. Starting or clearing may
+// happen while threads record; their buffers are emptied, and resized, by
+// the threads themselves on their next event.
+void DLL_PUBLIC StartTracing(size_t events_per_thread);
+void DLL_PUBLIC StopTracing();
+void DLL_PUBLIC ClearTrace();
+bool DLL_PUBLIC IsTracingCompiledIn();
+
+// Events of every thread in the Chrome trace event format, for
+// chrome://tracing or Perfetto. Events carry the id passed to
+// MC_TRACE_SCOPE_ID, usually the client.
+std::string DLL_PUBLIC GetTraceJson();
+bool DLL_PUBLIC WriteTraceJson(const std::string& path);
+
+// Records the time from construction to destruction as one event
+class DLL_PUBLIC Scope {
+public:
+    explicit Scope(const char* name, const void* id = 0);
+    ~Scope();
+
+private:
+    const char* name_;
+    const void* id_;
+    uint64_t start_;
+
+    Scope(const Scope&);
+    void operator=(const Scope&);
+};
+
+}  // namespace trace
+
+}  // namespace MumbleClient
+
+#define MC_TRACE_CONCAT_INNER(a, b) a ## b
+#define MC_TRACE_CONCAT(a, b) MC_TRACE_CONCAT_INNER(a, b)
+
+#if defined(WITH_TRACING)
+#define MC_TRACE_SCOPE(name) ::MumbleClient::trace::Scope MC_TRACE_CONCAT(mc_trace_scope_, __LINE__)(name)
+#define MC_TRACE_SCOPE_ID(name, id) ::MumbleClient::trace::Scope MC_TRACE_CONCAT(mc_trace_scope_, __LINE__)(name, id)
+#else
+#define MC_TRACE_SCOPE(name) static_cast<void>(0)
+#define MC_TRACE_SCOPE_ID(name, id) static_cast<void>(0)
+#endif
+
+#endif  // _LIBMUMBLECLIENT_TRACE_H_
@@ -0,0 +1,39 @@
+#ifndef _LIBMUMBLECLIENT_TRACKED_HANDLER_H_
+#define _LIBMUMBLECLIENT_TRACKED_HANDLER_H_
+
+#include <boost/shared_ptr.hpp>
+
+namespace MumbleClient {
+
+// Handler that holds a reference to a token for as long as Boost.Asio holds
+// the handler, so the owner of the token can tell whether any of its
+// handlers are still pending or running: they are when the token has more
+// than one owner. Operations that complete or are destroyed unrun release
+// their reference. Memory and invocation hooks are left to the handlers
+// around it.
+template <typename Handler>
+class TrackedHandler
+{
+public:
+    TrackedHandler(const boost::shared_ptr<void>& token, const Handler& handler) : token_(token), handler_(handler) { }
+
+    void operator()() { handler_(); }
+    template <typename Arg1>
+    void operator()(const Arg1& arg1) { handler_(arg1); }
+    template <typename Arg1, typename Arg2>
+    void operator()(const Arg1& arg1, const Arg2& arg2) { handler_(arg1, arg2); }
+
+private:
+    boost::shared_ptr<void> token_;
+    Handler handler_;
+};
+
+template <typename Handler>
+inline TrackedHandler<Handler> MakeTrackedHandler(const boost::shared_ptr<void>& token, const Handler& handler)
+{
+    return TrackedHandler<Handler>(token, handler);
+}
+
+}  // namespace MumbleClient
+
+#endif
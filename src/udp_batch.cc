@@ -0,0 +1,105 @@
+#include "udp_batch.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+namespace MumbleClient
+{
+namespace udp_batch
+{
+    namespace
+    {
+        // Matches the batch size used by MumbleClient, larger requests are split
+        const int kMaxBatch = 16;
+    }
+
+#if defined(__linux__)
+
+    bool Supported()
+    {
+        return true;
+    }
+
+    int Receive(int fd, unsigned char* const* buffers, size_t buffer_size, size_t* lengths, int count)
+    {
+        if (count > kMaxBatch)
+            count = kMaxBatch;
+
+        struct mmsghdr msgs[kMaxBatch];
+        struct iovec iovs[kMaxBatch];
+        memset(msgs, 0, sizeof(msgs[0]) * count);
+        for (int i = 0; i < count; ++i)
+        {
+            iovs[i].iov_base = buffers[i];
+            iovs[i].iov_len = buffer_size;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int received;
+        do
+        {
+            received = recvmmsg(fd, msgs, count, MSG_DONTWAIT, 0);
+        } while (received < 0 && errno == EINTR);
+
+        if (received < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+        // A datagram larger than its buffer was cut short; it could never
+        // authenticate, so it is reported empty instead of being decrypted
+        for (int i = 0; i < received; ++i)
+            lengths[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : msgs[i].msg_len;
+        return received;
+    }
+
+    int Send(int fd, const unsigned char* const* buffers, const size_t* lengths, int count)
+    {
+        if (count > kMaxBatch)
+            count = kMaxBatch;
+
+        struct mmsghdr msgs[kMaxBatch];
+        struct iovec iovs[kMaxBatch];
+        memset(msgs, 0, sizeof(msgs[0]) * count);
+        for (int i = 0; i < count; ++i)
+        {
+            iovs[i].iov_base = const_cast<unsigned char*>(buffers[i]);
+            iovs[i].iov_len = lengths[i];
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int sent;
+        do
+        {
+            sent = sendmmsg(fd, msgs, count, MSG_DONTWAIT);
+        } while (sent < 0 && errno == EINTR);
+
+        if (sent < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        return sent;
+    }
+
+#else
+
+    bool Supported()
+    {
+        return false;
+    }
+
+    int Receive(int, unsigned char* const*, size_t, size_t*, int)
+    {
+        return -1;
+    }
+
+    int Send(int, const unsigned char* const*, const size_t*, int)
+    {
+        return -1;
+    }
+
+#endif
+}
+}
@@ -0,0 +1,28 @@
+#ifndef _LIBMUMBLECLIENT_UDP_BATCH_H_
+#define _LIBMUMBLECLIENT_UDP_BATCH_H_
+
+#include <cstddef>
+
+namespace MumbleClient {
+
+// Moves several datagrams per system call with recvmmsg()/sendmmsg(). Only
+// available on Linux; elsewhere Supported() is false and the calls fail.
+namespace udp_batch {
+
+bool Supported();
+
+// Receives up to |count| datagrams without blocking. Returns the number
+// received, 0 when nothing is pending or -1 on error. Datagrams that did not
+// fit |buffer_size| are returned with a length of 0.
+int Receive(int fd, unsigned char* const* buffers, size_t buffer_size, size_t* lengths, int count);
+
+// Sends up to |count| datagrams on a connected socket without blocking.
+// Returns the number the kernel accepted, 0 when the send buffer is full
+// or -1 on error.
+int Send(int fd, const unsigned char* const* buffers, const size_t* lengths, int count);
+
+}  // namespace udp_batch
+
+}  // namespace MumbleClient
+
+#endif
@@ -10,7 +10,7 @@ class Channel;
 
 class User {
 public:
-    User(int32_t session_, boost::shared_ptr<Channel> channel_) : session(session_), channel(channel_) { }
+    User(int32_t session_, boost::shared_ptr<Channel> channel_) : session(session_), user_id(-1), channel(channel_), mute(false), deaf(false), suppress(false), self_mute(false), self_deaf(false) { }
     ~User() { DLOG(INFO) << "User " << name << " destroyed"; }
     int32_t session;
     int32_t user_id;
@@ -0,0 +1,91 @@
+#include "voice_slice.h"
+
+#include <new>
+
+namespace MumbleClient
+{
+    // Keeps the payload 16 byte aligned within the slab
+    const size_t SliceBuffer::kHeaderSize = (sizeof(SliceBuffer) + 15) & ~static_cast<size_t>(15);
+
+    void intrusive_ptr_add_ref(SliceBuffer* buffer)
+    {
+        buffer->refs_.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    void intrusive_ptr_release(SliceBuffer* buffer)
+    {
+        if (buffer->refs_.fetch_sub(1, boost::memory_order_release) != 1)
+            return;
+
+        // Writes through other references happen before the slab is reused
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        if (buffer->pool_)
+        {
+            buffer->pool_->Release(buffer);
+            return;
+        }
+
+        buffer->~SliceBuffer();
+        delete[] reinterpret_cast<unsigned char*>(buffer);
+    }
+
+    VoiceSlice VoiceSlice::Slice(size_t offset, size_t length) const
+    {
+        VoiceSlice slice(*this);
+        if (offset > size_)
+            offset = size_;
+        if (length > size_ - offset)
+            length = size_ - offset;
+
+        slice.data_ = data_ + offset;
+        slice.size_ = length;
+        return slice;
+    }
+
+    ReceivePool::ReceivePool(size_t payload_size, size_t max_slabs) :
+        slabs_(SliceBuffer::kHeaderSize + payload_size, max_slabs),
+        refs_(0)
+    {
+    }
+
+    boost::intrusive_ptr<SliceBuffer> ReceivePool::Allocate(size_t length)
+    {
+        size_t payload_size = slabs_.slab_size() - SliceBuffer::kHeaderSize;
+        unsigned char* slab = length <= payload_size ? slabs_.Acquire() : 0;
+        if (slab)
+        {
+            // The buffer keeps the pool alive until it comes back
+            intrusive_ptr_add_ref(this);
+            return boost::intrusive_ptr<SliceBuffer>(new (slab) SliceBuffer(this, payload_size));
+        }
+
+        slab = new unsigned char[SliceBuffer::kHeaderSize + length];
+        return boost::intrusive_ptr<SliceBuffer>(new (slab) SliceBuffer(0, length));
+    }
+
+    BufferPoolStats ReceivePool::Stats() const
+    {
+        return slabs_.Stats();
+    }
+
+    void ReceivePool::Release(SliceBuffer* buffer)
+    {
+        buffer->~SliceBuffer();
+        slabs_.Release(reinterpret_cast<unsigned char*>(buffer));
+        intrusive_ptr_release(this);
+    }
+
+    void intrusive_ptr_add_ref(ReceivePool* pool)
+    {
+        pool->refs_.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    void intrusive_ptr_release(ReceivePool* pool)
+    {
+        if (pool->refs_.fetch_sub(1, boost::memory_order_release) != 1)
+            return;
+
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        delete pool;
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef _LIBMUMBLECLIENT_VOICE_SLICE_H_
+#define _LIBMUMBLECLIENT_VOICE_SLICE_H_
+
+#include <cstddef>
+
+#include <boost/atomic.hpp>
+#include <boost/intrusive_ptr.hpp>
+
+#include "buffer_pool.h"
+#include "libmumble_stdint.h"
+#include "visibility.h"
+
+namespace MumbleClient {
+
+class ReceivePool;
+class SliceBuffer;
+
+void DLL_PUBLIC intrusive_ptr_add_ref(SliceBuffer* buffer);
+void DLL_PUBLIC intrusive_ptr_release(SliceBuffer* buffer);
+void intrusive_ptr_add_ref(ReceivePool* pool);
+void intrusive_ptr_release(ReceivePool* pool);
+
+// Reference counted buffer holding one received packet. The count lives in
+// front of the payload in the same allocation, a slab of the receive pool
+// or the heap when the pool has none to spare.
+class DLL_PUBLIC SliceBuffer
+{
+public:
+    unsigned char* data() { return reinterpret_cast<unsigned char*>(this) + kHeaderSize; }
+    size_t capacity() const { return capacity_; }
+
+private:
+    friend class ReceivePool;
+    friend void intrusive_ptr_add_ref(SliceBuffer* buffer);
+    friend void intrusive_ptr_release(SliceBuffer* buffer);
+
+    static const size_t kHeaderSize;
+
+    SliceBuffer(ReceivePool* pool, size_t capacity) : refs_(0), pool_(pool), capacity_(capacity) { }
+
+    boost::atomic<int32_t> refs_;
+    // NULL for buffers taken from the heap
+    ReceivePool* pool_;
+    size_t capacity_;
+
+    SliceBuffer(const SliceBuffer&);
+    void operator=(const SliceBuffer&);
+};
+
+// Immutable view of a received voice packet. Copies share the buffer, which
+// goes back to the receive pool when the last of them is destroyed, so a
+// slice can be held, queued or handed to another thread without copying the
+// packet. Like boost::shared_ptr, distinct copies may be used from
+// different threads at once.
+class DLL_PUBLIC VoiceSlice
+{
+public:
+    VoiceSlice() : data_(0), size_(0) { }
+    // The first |size| bytes of |buffer|
+    VoiceSlice(const boost::intrusive_ptr<SliceBuffer>& buffer, size_t size) :
+        buffer_(buffer),
+        data_(reinterpret_cast<const char*>(buffer->data())),
+        size_(size) { }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Bytes [offset, offset + length) of this slice, clamped to its end,
+    // sharing the same buffer
+    VoiceSlice Slice(size_t offset, size_t length) const;
+    VoiceSlice Slice(size_t offset) const { return Slice(offset, size_); }
+
+private:
+    boost::intrusive_ptr<SliceBuffer> buffer_;
+    const char* data_;
+    size_t size_;
+};
+
+// Slabs for received packets. The client holds one reference and every
+// buffer handed out holds another, so slices may outlive the client that
+// received them.
+class ReceivePool
+{
+public:
+    ReceivePool(size_t payload_size, size_t max_slabs);
+
+    // A buffer with room for |length| bytes. Taken from the heap when the
+    // packet does not fit a slab or every slab is in use.
+    boost::intrusive_ptr<SliceBuffer> Allocate(size_t length);
+    BufferPoolStats Stats() const;
+
+private:
+    friend void intrusive_ptr_release(SliceBuffer* buffer);
+    friend void intrusive_ptr_add_ref(ReceivePool* pool);
+    friend void intrusive_ptr_release(ReceivePool* pool);
+
+    ~ReceivePool() { }
+
+    void Release(SliceBuffer* buffer);
+
+    BufferPool slabs_;
+    boost::atomic<int32_t> refs_;
+
+    ReceivePool(const ReceivePool&);
+    void operator=(const ReceivePool&);
+};
+
+}  // namespace MumbleClient
+
+#endif
@@ -0,0 +1,329 @@
+#include "wire_decoder.h"
+
+#include <string.h>
+
+#include "mumble_wire_fields.h"
+
+namespace MumbleClient
+{
+    namespace wire_decoder
+    {
+        namespace
+        {
+            enum WireType
+            {
+                kVarint = 0,
+                kFixed64 = 1,
+                kLengthDelimited = 2,
+                kFixed32 = 5
+            };
+
+            // Protocol buffer field reader. Every call fails instead of
+            // reading past |end_|.
+            class Reader
+            {
+            public:
+                Reader(const void* data, size_t length) :
+                    p_(static_cast<const unsigned char*>(data)),
+                    end_(p_ + length) { }
+
+                bool AtEnd() const { return p_ == end_; }
+
+                // At most ten bytes; bits past the 64th are dropped, as
+                // libprotobuf does
+                bool ReadVarint(uint64_t& value)
+                {
+                    value = 0;
+                    for (int shift = 0; shift < 64; shift += 7)
+                    {
+                        if (p_ == end_)
+                            return false;
+                        unsigned char byte = *p_++;
+                        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                        if (!(byte & 0x80))
+                            return true;
+                    }
+                    return false;
+                }
+
+                // libprotobuf rejects tags longer than five bytes, even
+                // padded ones whose value fits
+                bool ReadTag(uint32_t& field, uint32_t& wire_type)
+                {
+                    const unsigned char* start = p_;
+                    uint64_t tag;
+                    if (!ReadVarint(tag) || tag > 0xFFFFFFFFULL || p_ - start > 5)
+                        return false;
+                    field = static_cast<uint32_t>(tag >> 3);
+                    wire_type = static_cast<uint32_t>(tag & 0x7);
+                    return field != 0;
+                }
+
+                bool ReadString(StringView& view)
+                {
+                    uint64_t length;
+                    if (!ReadVarint(length) || length > static_cast<uint64_t>(end_ - p_))
+                        return false;
+                    view.data = reinterpret_cast<const char*>(p_);
+                    view.size = static_cast<size_t>(length);
+                    p_ += view.size;
+                    return true;
+                }
+
+                bool Skip(uint32_t wire_type)
+                {
+                    uint64_t value;
+                    StringView view;
+                    switch (wire_type)
+                    {
+                    case kVarint:
+                        return ReadVarint(value);
+                    case kFixed64:
+                        return Advance(8);
+                    case kLengthDelimited:
+                        return ReadString(view);
+                    case kFixed32:
+                        return Advance(4);
+                    default:
+                        // Groups and invalid wire types
+                        return false;
+                    }
+                }
+
+            private:
+                bool Advance(size_t bytes)
+                {
+                    if (static_cast<size_t>(end_ - p_) < bytes)
+                        return false;
+                    p_ += bytes;
+                    return true;
+                }
+
+                const unsigned char* p_;
+                const unsigned char* end_;
+            };
+
+            bool ReadUint32(Reader& reader, uint32_t wire_type, bool& has, uint32_t& value)
+            {
+                uint64_t v;
+                if (wire_type != kVarint || !reader.ReadVarint(v))
+                    return false;
+                has = true;
+                value = static_cast<uint32_t>(v);
+                return true;
+            }
+
+            bool ReadBool(Reader& reader, uint32_t wire_type, bool& has, bool& value)
+            {
+                uint64_t v;
+                if (wire_type != kVarint || !reader.ReadVarint(v))
+                    return false;
+                has = true;
+                value = v != 0;
+                return true;
+            }
+
+            bool ReadString(Reader& reader, uint32_t wire_type, bool& has, StringView& value)
+            {
+                if (wire_type != kLengthDelimited || !reader.ReadString(value))
+                    return false;
+                has = true;
+                return true;
+            }
+
+            StringView View(const std::string& s)
+            {
+                StringView view;
+                view.data = s.data();
+                view.size = s.size();
+                return view;
+            }
+
+            bool Equal(bool has_a, const StringView& a, bool has_b, const StringView& b)
+            {
+                if (has_a != has_b)
+                    return false;
+                return !has_a || (a.size == b.size && memcmp(a.data, b.data, a.size) == 0);
+            }
+
+            template <class T>
+            bool Equal(bool has_a, const T& a, bool has_b, const T& b)
+            {
+                return has_a == has_b && (!has_a || a == b);
+            }
+        }
+
+        bool Decode(const void* data, size_t length, UserStateView& view)
+        {
+            namespace field = wire_fields::UserState;
+
+            memset(&view, 0, sizeof(view));
+            Reader reader(data, length);
+            while (!reader.AtEnd())
+            {
+                uint32_t number, wire_type;
+                if (!reader.ReadTag(number, wire_type))
+                    return false;
+
+                // Repeated occurrences overwrite, as for any optional field
+                bool ok;
+                switch (number)
+                {
+                case field::session:
+                    ok = ReadUint32(reader, wire_type, view.has_session, view.session);
+                    break;
+                case field::actor:
+                    ok = ReadUint32(reader, wire_type, view.has_actor, view.actor);
+                    break;
+                case field::name:
+                    ok = ReadString(reader, wire_type, view.has_name, view.name);
+                    break;
+                case field::user_id:
+                    ok = ReadUint32(reader, wire_type, view.has_user_id, view.user_id);
+                    break;
+                case field::channel_id:
+                    ok = ReadUint32(reader, wire_type, view.has_channel_id, view.channel_id);
+                    break;
+                case field::mute:
+                    ok = ReadBool(reader, wire_type, view.has_mute, view.mute);
+                    break;
+                case field::deaf:
+                    ok = ReadBool(reader, wire_type, view.has_deaf, view.deaf);
+                    break;
+                case field::suppress:
+                    ok = ReadBool(reader, wire_type, view.has_suppress, view.suppress);
+                    break;
+                case field::self_mute:
+                    ok = ReadBool(reader, wire_type, view.has_self_mute, view.self_mute);
+                    break;
+                case field::self_deaf:
+                    ok = ReadBool(reader, wire_type, view.has_self_deaf, view.self_deaf);
+                    break;
+                case field::comment:
+                    ok = ReadString(reader, wire_type, view.has_comment, view.comment);
+                    break;
+                case field::hash:
+                    ok = ReadString(reader, wire_type, view.has_hash, view.hash);
+                    break;
+                default:
+                    // Textures and the like are not used by the client
+                    ok = reader.Skip(wire_type);
+                }
+                if (!ok)
+                    return false;
+            }
+            return true;
+        }
+
+        bool Decode(const void* data, size_t length, PingView& view)
+        {
+            namespace field = wire_fields::Ping;
+
+            memset(&view, 0, sizeof(view));
+            Reader reader(data, length);
+            while (!reader.AtEnd())
+            {
+                uint32_t number, wire_type;
+                if (!reader.ReadTag(number, wire_type))
+                    return false;
+
+                bool ok;
+                switch (number)
+                {
+                case field::timestamp:
+                    ok = wire_type == kVarint && reader.ReadVarint(view.timestamp);
+                    view.has_timestamp = view.has_timestamp || ok;
+                    break;
+                case field::good:
+                    ok = ReadUint32(reader, wire_type, view.has_good, view.good);
+                    break;
+                case field::late:
+                    ok = ReadUint32(reader, wire_type, view.has_late, view.late);
+                    break;
+                case field::lost:
+                    ok = ReadUint32(reader, wire_type, view.has_lost, view.lost);
+                    break;
+                case field::resync:
+                    ok = ReadUint32(reader, wire_type, view.has_resync, view.resync);
+                    break;
+                default:
+                    ok = reader.Skip(wire_type);
+                }
+                if (!ok)
+                    return false;
+            }
+            return true;
+        }
+
+        void FromProtobuf(const MumbleProto::UserState& message, UserStateView& view)
+        {
+            memset(&view, 0, sizeof(view));
+
+            view.has_session = message.has_session();
+            view.session = message.session();
+            view.has_actor = message.has_actor();
+            view.actor = message.actor();
+            view.has_name = message.has_name();
+            view.name = View(message.name());
+            view.has_user_id = message.has_user_id();
+            view.user_id = message.user_id();
+            view.has_channel_id = message.has_channel_id();
+            view.channel_id = message.channel_id();
+            view.has_mute = message.has_mute();
+            view.mute = message.mute();
+            view.has_deaf = message.has_deaf();
+            view.deaf = message.deaf();
+            view.has_suppress = message.has_suppress();
+            view.suppress = message.suppress();
+            view.has_self_mute = message.has_self_mute();
+            view.self_mute = message.self_mute();
+            view.has_self_deaf = message.has_self_deaf();
+            view.self_deaf = message.self_deaf();
+            view.has_comment = message.has_comment();
+            view.comment = View(message.comment());
+            view.has_hash = message.has_hash();
+            view.hash = View(message.hash());
+        }
+
+        void FromProtobuf(const MumbleProto::Ping& message, PingView& view)
+        {
+            memset(&view, 0, sizeof(view));
+
+            view.has_timestamp = message.has_timestamp();
+            view.timestamp = message.timestamp();
+            view.has_good = message.has_good();
+            view.good = message.good();
+            view.has_late = message.has_late();
+            view.late = message.late();
+            view.has_lost = message.has_lost();
+            view.lost = message.lost();
+            view.has_resync = message.has_resync();
+            view.resync = message.resync();
+        }
+
+        bool Equal(const UserStateView& a, const UserStateView& b)
+        {
+            return Equal(a.has_session, a.session, b.has_session, b.session) &&
+                   Equal(a.has_actor, a.actor, b.has_actor, b.actor) &&
+                   Equal(a.has_name, a.name, b.has_name, b.name) &&
+                   Equal(a.has_user_id, a.user_id, b.has_user_id, b.user_id) &&
+                   Equal(a.has_channel_id, a.channel_id, b.has_channel_id, b.channel_id) &&
+                   Equal(a.has_mute, a.mute, b.has_mute, b.mute) &&
+                   Equal(a.has_deaf, a.deaf, b.has_deaf, b.deaf) &&
+                   Equal(a.has_suppress, a.suppress, b.has_suppress, b.suppress) &&
+                   Equal(a.has_self_mute, a.self_mute, b.has_self_mute, b.self_mute) &&
+                   Equal(a.has_self_deaf, a.self_deaf, b.has_self_deaf, b.self_deaf) &&
+                   Equal(a.has_comment, a.comment, b.has_comment, b.comment) &&
+                   Equal(a.has_hash, a.hash, b.has_hash, b.hash);
+        }
+
+        bool Equal(const PingView& a, const PingView& b)
+        {
+            return Equal(a.has_timestamp, a.timestamp, b.has_timestamp, b.timestamp) &&
+                   Equal(a.has_good, a.good, b.has_good, b.good) &&
+                   Equal(a.has_late, a.late, b.has_late, b.late) &&
+                   Equal(a.has_lost, a.lost, b.has_lost, b.lost) &&
+                   Equal(a.has_resync, a.resync, b.has_resync, b.resync);
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef _LIBMUMBLECLIENT_WIRE_DECODER_H_
+#define _LIBMUMBLECLIENT_WIRE_DECODER_H_
+
+#include <cstddef>
+#include <string>
+
+#include "libmumble_stdint.h"
+#include "Mumble.pb.h"
+
+namespace MumbleClient {
+
+// Reads the fields the client uses from hot control messages straight out
+// of the received frame, without building the protobuf message. Strings
+// point into the frame, or into the protobuf message they were taken from.
+// Decode() returns false for anything it does not handle exactly like
+// libprotobuf, such as a known field with an unexpected wire type or
+// groups; the caller then parses the message with protobuf instead.
+namespace wire_decoder {
+
+struct StringView
+{
+    const char* data;
+    size_t size;
+
+    std::string str() const { return std::string(data, size); }
+};
+
+struct UserStateView
+{
+    bool has_session;
+    bool has_actor;
+    bool has_name;
+    bool has_user_id;
+    bool has_channel_id;
+    bool has_mute;
+    bool has_deaf;
+    bool has_suppress;
+    bool has_self_mute;
+    bool has_self_deaf;
+    bool has_comment;
+    bool has_hash;
+
+    uint32_t session;
+    uint32_t actor;
+    uint32_t user_id;
+    uint32_t channel_id;
+    bool mute;
+    bool deaf;
+    bool suppress;
+    bool self_mute;
+    bool self_deaf;
+    StringView name;
+    StringView comment;
+    StringView hash;
+};
+
+struct PingView
+{
+    bool has_timestamp;
+    bool has_good;
+    bool has_late;
+    bool has_lost;
+    bool has_resync;
+
+    uint64_t timestamp;
+    uint32_t good;
+    uint32_t late;
+    uint32_t lost;
+    uint32_t resync;
+};
+
+bool Decode(const void* data, size_t length, UserStateView& view);
+bool Decode(const void* data, size_t length, PingView& view);
+
+// Views of messages parsed by protobuf, for the fallback path
+void FromProtobuf(const MumbleProto::UserState& message, UserStateView& view);
+void FromProtobuf(const MumbleProto::Ping& message, PingView& view);
+
+// Field by field comparison, for checking the decoder against protobuf
+bool Equal(const UserStateView& a, const UserStateView& b);
+bool Equal(const PingView& a, const PingView& b);
+
+}  // namespace wire_decoder
+
+}  // namespace MumbleClient
+
+#endif
@@ -0,0 +1,60 @@
+#include "allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+#include <boost/atomic.hpp>
+
+#if defined(__GNUC__)
+
+namespace {
+
+__thread bool counting = false;
+boost::atomic<int64_t> allocations(0);
+
+void* Allocate(size_t size)
+{
+    if (counting)
+        ++allocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+}  // namespace
+
+#if __cplusplus >= 201103L
+#define THROWS_BAD_ALLOC
+#define THROWS_NOTHING noexcept
+#else
+#define THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define THROWS_NOTHING throw()
+#endif
+
+void* operator new(size_t size) THROWS_BAD_ALLOC { return Allocate(size); }
+void* operator new[](size_t size) THROWS_BAD_ALLOC { return Allocate(size); }
+void operator delete(void* p) THROWS_NOTHING { std::free(p); }
+void operator delete[](void* p) THROWS_NOTHING { std::free(p); }
+
+namespace test {
+
+bool AllocationCountingSupported() { return true; }
+void CountAllocationsOnThisThread(bool enable) { counting = enable; }
+int64_t CountedAllocations() { return allocations; }
+void ResetCountedAllocations() { allocations = 0; }
+
+}  // namespace test
+
+#else
+
+namespace test {
+
+bool AllocationCountingSupported() { return false; }
+void CountAllocationsOnThisThread(bool) { }
+int64_t CountedAllocations() { return 0; }
+void ResetCountedAllocations() { }
+
+}  // namespace test
+
+#endif
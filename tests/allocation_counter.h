@@ -0,0 +1,18 @@
+#ifndef _LIBMUMBLECLIENT_TESTS_ALLOCATION_COUNTER_H_
+#define _LIBMUMBLECLIENT_TESTS_ALLOCATION_COUNTER_H_
+
+#include "src/libmumble_stdint.h"
+
+namespace test {
+
+// Linking allocation_counter.cc replaces the global operator new with one
+// that counts the allocations made by threads that asked to be counted.
+// Only available with GCC compatible compilers, see AllocationCountingSupported().
+bool AllocationCountingSupported();
+void CountAllocationsOnThisThread(bool enable);
+int64_t CountedAllocations();
+void ResetCountedAllocations();
+
+}  // namespace test
+
+#endif
@@ -0,0 +1,95 @@
+// Tunnelled voice received by several clients with MumbleClientLib::Run()
+// on 1, 2 and 4 threads. Each packet costs the callback about 5 us, so
+// throughput should grow with threads up to the number of cores while each
+// client's packets stay on its strand.
+//
+// bench_client_threads [packets per client]
+
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "fake_server.h"
+#include "src/logging.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+const int32_t kClients = 8;
+const int32_t kPacketSize = 60;
+
+void Increment(boost::atomic<int32_t>* count)
+{
+    ++*count;
+}
+
+// Stands in for decoding and mixing
+void ReceivePacket(boost::atomic<int32_t>* packets, int32_t /*length*/, void* /*buffer*/)
+{
+    test::Stopwatch stopwatch;
+    while (stopwatch.ElapsedNs() < 5000)
+        ;
+    ++*packets;
+}
+
+void Run(test::FakeServer& server, int32_t threads, int32_t packets_per_client)
+{
+    MumbleClientLib* lib = MumbleClientLib::instance();
+    boost::atomic<int32_t> authed(0), packets(0);
+
+    std::vector<MumbleClient::MumbleClient*> clients;
+    for (int32_t i = 0; i < kClients; ++i)
+    {
+        std::ostringstream name;
+        name << "bench" << threads << "_" << i;
+        MumbleClient::MumbleClient* client = lib->NewClient();
+        client->SetAuthCallback(boost::bind(&Increment, &authed));
+        client->SetRawUdpTunnelCallback(boost::bind(&ReceivePacket, &packets, _1, _2));
+        client->Connect(server.ClientSettings(name.str()));
+        clients.push_back(client);
+    }
+
+    boost::thread runner(boost::bind(&MumbleClientLib::Run, lib, threads));
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &authed, kClients)));
+
+    std::string frames;
+    std::string packet(kPacketSize, '\x80');
+    for (int32_t i = 0; i < packets_per_client; ++i)
+        test::FakeServer::AppendFrame(frames, PbMessageType::UDPTunnel, packet);
+
+    test::Stopwatch stopwatch;
+    server.SendRaw(frames);
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &packets, kClients * packets_per_client), 120000));
+    double seconds = stopwatch.ElapsedNs() / 1e9;
+
+    std::cout << threads << " threads: " << static_cast<int64_t>(packets / seconds) << " packets/s" << std::endl;
+
+    // Run() returns once the disconnected clients have nothing left pending
+    for (size_t i = 0; i < clients.size(); ++i)
+        clients[i]->Disconnect();
+    runner.join();
+    for (size_t i = 0; i < clients.size(); ++i)
+        delete clients[i];
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    int32_t packets_per_client = argc > 1 ? std::atoi(argv[1]) : 5000;
+
+    MumbleClientLib::SetLogLevel(logging::LOG_FATAL);
+    test::FakeServer server;
+
+    std::cout << kClients << " clients, " << boost::thread::hardware_concurrency() << " cores" << std::endl;
+    const int32_t threads[] = { 1, 2, 4 };
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i)
+        Run(server, threads[i], packets_per_client);
+    return 0;
+}
@@ -0,0 +1,97 @@
+// Voice packet encryption and decryption with the portable code and with
+// the hardware kernel, one packet per call and batches of 1, 8 and 64.
+//
+// bench_crypt_state [packets]
+
+#include <cstdlib>
+#include <string.h>
+#include <vector>
+
+#include "src/CryptState.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+const unsigned int kPacketSize = 60;
+const unsigned int kBatchSizes[] = { 1, 8, 64 };
+const unsigned int kMaxBatch = 64;
+
+// A batch of 0 calls encrypt() and decrypt() once per packet, |batch| at a time
+void Run(const char* label, bool portable, unsigned int batch, long packets)
+{
+    unsigned char key[AES_BLOCK_SIZE], client_nonce[AES_BLOCK_SIZE], server_nonce[AES_BLOCK_SIZE];
+    for (int i = 0; i < AES_BLOCK_SIZE; ++i)
+    {
+        key[i] = static_cast<unsigned char>(i);
+        client_nonce[i] = static_cast<unsigned char>(0x20 + i);
+        server_nonce[i] = static_cast<unsigned char>(0x40 + i);
+    }
+
+    CryptState client, server;
+    if (portable)
+    {
+        client.usePortable();
+        server.usePortable();
+    }
+    client.setKey(key, client_nonce, server_nonce);
+    server.setKey(key, server_nonce, client_nonce);
+
+    unsigned char plain[kMaxBatch][kPacketSize], crypted[kMaxBatch][kPacketSize + 4], decrypted[kMaxBatch][kPacketSize];
+    const unsigned char* sources[kMaxBatch];
+    const unsigned char* crypted_sources[kMaxBatch];
+    unsigned char* crypted_dsts[kMaxBatch];
+    unsigned char* plain_dsts[kMaxBatch];
+    unsigned int plain_lengths[kMaxBatch], crypted_lengths[kMaxBatch];
+    bool results[kMaxBatch];
+    for (unsigned int i = 0; i < kMaxBatch; ++i)
+    {
+        memset(plain[i], static_cast<int>(i), kPacketSize);
+        sources[i] = plain[i];
+        crypted_sources[i] = crypted[i];
+        crypted_dsts[i] = crypted[i];
+        plain_dsts[i] = decrypted[i];
+        plain_lengths[i] = kPacketSize;
+        crypted_lengths[i] = kPacketSize + 4;
+    }
+
+    test::Stopwatch stopwatch;
+    unsigned int step = batch > 0 ? batch : kMaxBatch;
+    for (long done = 0; done < packets; done += step)
+    {
+        if (batch > 0)
+        {
+            client.encryptBatch(sources, crypted_dsts, plain_lengths, batch);
+            CHECK_EQ(server.decryptBatch(crypted_sources, plain_dsts, crypted_lengths, results, batch), batch);
+            continue;
+        }
+        for (unsigned int i = 0; i < step; ++i)
+        {
+            client.encrypt(plain[i], crypted[i], kPacketSize);
+            CHECK(server.decrypt(crypted[i], decrypted[i], kPacketSize + 4));
+        }
+    }
+    std::cout << label;
+    if (batch > 0)
+        std::cout << ", batches of " << batch;
+    std::cout << ": " << stopwatch.ElapsedNs() / packets << " ns per packet encrypted and decrypted" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    long packets = argc > 1 ? std::atol(argv[1]) : 2000000;
+
+    CryptState probe;
+    std::cout << kPacketSize << " byte packets, kernel " << probe.kernelName() << std::endl;
+    for (int portable = 1; portable >= 0; --portable)
+    {
+        const char* label = portable ? "portable" : "kernel";
+        Run(label, portable != 0, 0, packets);
+        for (size_t i = 0; i < sizeof(kBatchSizes) / sizeof(kBatchSizes[0]); ++i)
+            Run(label, portable != 0, kBatchSizes[i], packets);
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Cost of a LOG(INFO) statement below the log level, next to an empty loop
+// and to LOG(WARNING) lines that are formatted and handed to a sink. The
+// operands of the suppressed statement must never be evaluated.
+//
+// bench_logging [lines]
+
+#include <cstdlib>
+
+#include "src/log_sink.h"
+#include "src/logging.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+volatile int64_t iterations = 0;
+int64_t evaluated = 0;
+int64_t delivered = 0;
+
+int64_t Evaluate()
+{
+    return ++evaluated;
+}
+
+void CountLine(logging::LogSeverity /*severity*/, const std::string& /*line*/)
+{
+    ++delivered;
+}
+
+double Empty(long lines)
+{
+    test::Stopwatch stopwatch;
+    for (long i = 0; i < lines; ++i)
+        iterations = iterations + 1;
+    return stopwatch.ElapsedNs() / lines;
+}
+
+double Suppressed(long lines)
+{
+    test::Stopwatch stopwatch;
+    for (long i = 0; i < lines; ++i)
+    {
+        iterations = iterations + 1;
+        LOG(INFO) << "suppressed line " << i << " " << Evaluate();
+    }
+    return stopwatch.ElapsedNs() / lines;
+}
+
+double Emitted(long lines)
+{
+    test::Stopwatch stopwatch;
+    for (long i = 0; i < lines; ++i)
+    {
+        iterations = iterations + 1;
+        LOG(WARNING) << "emitted line " << i << " " << Evaluate();
+    }
+    return stopwatch.ElapsedNs() / lines;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    long lines = argc > 1 ? std::atol(argv[1]) : 10000000;
+    // Formatting is much slower, so fewer of those lines are enough
+    long emitted_lines = lines / 100 > 0 ? lines / 100 : 1;
+
+    logging::CallbackLogSink sink(&CountLine);
+    logging::AddLogSink(&sink);
+    logging::SetLogLevel(logging::LOG_WARNING);
+
+    double empty = Empty(lines);
+    double suppressed = Suppressed(lines);
+    CHECK_EQ(evaluated, 0);
+    double emitted = Emitted(emitted_lines);
+    CHECK_EQ(delivered, static_cast<int64_t>(emitted_lines));
+
+    std::cout << "empty loop: " << empty << " ns per iteration" << std::endl;
+    std::cout << "suppressed LOG(INFO): " << suppressed << " ns per line" << std::endl;
+    std::cout << "emitted LOG(WARNING): " << emitted << " ns per line" << std::endl;
+
+    logging::RemoveLogSink(&sink);
+    return 0;
+}
@@ -0,0 +1,132 @@
+// Splitting the TCP control stream into messages: the old reader, which
+// went through a streambuf and an istream and copied every body into a
+// new[] buffer, against MessageFramer.
+//
+// bench_message_framer [messages]
+
+#include <algorithm>
+#include <cstdlib>
+#include <istream>
+#include <string.h>
+
+#include <boost/asio/streambuf.hpp>
+
+#include "src/message_framer.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+// Stand in for the parser, so the bodies are really read
+uint32_t Consume(const char* body, int32_t length)
+{
+    uint32_t sum = 0;
+    for (int32_t i = 0; i < length; i += 16)
+        sum += static_cast<unsigned char>(body[i]);
+    return sum;
+}
+
+// Voice tunnelled over TCP and the odd larger state message
+std::string MakeStream(long messages)
+{
+    test::Random random(7);
+    std::string stream;
+    for (long i = 0; i < messages; ++i)
+    {
+        int32_t length = random.OneIn(10) ? 200 + static_cast<int32_t>(random.Below(800)) : 60 + static_cast<int32_t>(random.Below(40));
+        MessageHeader header;
+        header.type(static_cast<int16_t>(random.OneIn(10) ? 9 : 1));
+        header.length(length);
+        stream.append(reinterpret_cast<const char*>(header.data()), MessageHeader::kSize);
+        stream.append(static_cast<size_t>(length), static_cast<char>(i));
+    }
+    return stream;
+}
+
+uint32_t RunStreambuf(const std::string& stream, size_t chunk)
+{
+    boost::asio::streambuf recv_buffer;
+    std::istream is(&recv_buffer);
+    uint32_t sum = 0;
+    bool have_header = false;
+    MessageHeader header;
+
+    for (size_t pos = 0; pos < stream.size(); pos += chunk)
+    {
+        size_t bytes = std::min(chunk, stream.size() - pos);
+        memcpy(boost::asio::buffer_cast<char*>(recv_buffer.prepare(bytes)), stream.data() + pos, bytes);
+        recv_buffer.commit(bytes);
+
+        for (;;)
+        {
+            if (!have_header)
+            {
+                if (recv_buffer.size() < static_cast<size_t>(MessageHeader::kSize))
+                    break;
+                unsigned char raw[MessageHeader::kSize];
+                is.read(reinterpret_cast<char*>(raw), MessageHeader::kSize);
+                header = MessageHeader(raw);
+                have_header = true;
+            }
+            if (recv_buffer.size() < static_cast<size_t>(header.length()))
+                break;
+
+            char* body = new char[header.length()];
+            is.read(body, header.length());
+            sum += Consume(body, header.length());
+            delete[] body;
+            have_header = false;
+        }
+    }
+    return sum;
+}
+
+uint32_t RunFramer(const std::string& stream, size_t chunk)
+{
+    MessageFramer framer;
+    uint32_t sum = 0;
+    MessageHeader header;
+    char* body = 0;
+
+    size_t pos = 0;
+    while (pos < stream.size())
+    {
+        boost::asio::mutable_buffers_1 space = framer.Prepare();
+        size_t bytes = std::min(std::min(chunk, boost::asio::buffer_size(space)), stream.size() - pos);
+        memcpy(boost::asio::buffer_cast<char*>(space), stream.data() + pos, bytes);
+        framer.Commit(bytes);
+        pos += bytes;
+
+        MessageFramer::Result result;
+        while ((result = framer.Next(header, body)) == MessageFramer::kFrame)
+            sum += Consume(body, header.length());
+        CHECK(result != MessageFramer::kInvalid);
+    }
+    return sum;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    long messages = argc > 1 ? std::atol(argv[1]) : 1000000;
+    std::string stream = MakeStream(messages);
+
+    // A TCP segment, and a full TLS record
+    const size_t chunks[] = { 1448, 16384 };
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i)
+    {
+        test::Stopwatch old_stopwatch;
+        uint32_t old_sum = RunStreambuf(stream, chunks[i]);
+        double old_ns = old_stopwatch.ElapsedNs() / messages;
+
+        test::Stopwatch framer_stopwatch;
+        uint32_t framer_sum = RunFramer(stream, chunks[i]);
+        double framer_ns = framer_stopwatch.ElapsedNs() / messages;
+
+        CHECK_EQ(old_sum, framer_sum);
+        std::cout << chunks[i] << " byte reads: streambuf " << old_ns << " ns, framer " << framer_ns << " ns per message" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+// UDP system calls per voice packet, with and without recvmmsg()/sendmmsg()
+// batching, against a loopback server. Packets go out in bursts, as a
+// server relays several speakers at once and a client sends the frames a
+// slow audio thread has piled up.
+//
+// bench_udp_syscalls [bursts] [burst size, at most the 64 pooled send buffers]
+
+#include <cstdlib>
+
+#include <boost/bind.hpp>
+
+#include "fake_server.h"
+#include "src/logging.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+const int32_t kPacketSize = 60;
+
+void Increment(boost::atomic<int32_t>* count)
+{
+    ++*count;
+}
+
+bool Received(MumbleClient::MumbleClient* client, uint64_t packets)
+{
+    return client->GetNetworkStats().udp_packets_received >= packets;
+}
+
+bool ServerReceived(test::FakeServer* server, uint64_t packets)
+{
+    return server->UdpVoiceReceived() >= packets;
+}
+
+void Run(bool batching, int32_t bursts, int32_t burst_size)
+{
+    test::FakeServer server;
+    test::ClientThread thread;
+    MumbleClient::MumbleClient* client = thread.lib().NewClient();
+
+    boost::atomic<int32_t> authed(0);
+    client->SetAuthCallback(boost::bind(&Increment, &authed));
+    if (batching && !client->SetUdpBatching(true))
+    {
+        std::cout << "batched: not supported on this platform" << std::endl;
+        thread.Stop();
+        delete client;
+        return;
+    }
+    client->Connect(server.ClientSettings("syscalls"));
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &authed, 1)));
+    CHECK(test::WaitUntil(boost::bind(&MumbleClient::MumbleClient::IsUdpActive, client)));
+
+    // Voice, type 4 in the top three bits
+    std::string packet(kPacketSize, '\x80');
+
+    // Waiting for each burst keeps the socket buffers from overflowing, so
+    // every packet is counted
+    NetworkStats before = client->GetNetworkStats();
+    for (int32_t i = 0; i < bursts; ++i)
+    {
+        server.SendUdp(packet, burst_size);
+        CHECK(test::WaitUntil(boost::bind(&Received, client, before.udp_packets_received + static_cast<uint64_t>(burst_size) * (i + 1))));
+    }
+
+    uint64_t server_before = server.UdpVoiceReceived();
+    for (int32_t i = 0; i < bursts; ++i)
+    {
+        for (int32_t n = 0; n < burst_size; ++n)
+            client->SendUdpMessage(packet.data(), kPacketSize);
+        CHECK(test::WaitUntil(boost::bind(&ServerReceived, &server, server_before + static_cast<uint64_t>(burst_size) * (i + 1))));
+    }
+    NetworkStats after = client->GetNetworkStats();
+
+    double received = static_cast<double>(after.udp_packets_received - before.udp_packets_received);
+    double sent = static_cast<double>(after.udp_packets_sent - before.udp_packets_sent);
+    std::cout << (batching ? "batched" : "single") << ": "
+              << (after.udp_recv_syscalls - before.udp_recv_syscalls) / received << " receive and "
+              << (after.udp_send_syscalls - before.udp_send_syscalls) / sent << " send syscalls per packet" << std::endl;
+
+    thread.Stop();
+    delete client;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    int32_t bursts = argc > 1 ? std::atoi(argv[1]) : 200;
+    int32_t burst_size = argc > 2 ? std::atoi(argv[2]) : 32;
+
+    MumbleClientLib::SetLogLevel(logging::LOG_FATAL);
+    std::cout << bursts << " bursts of " << burst_size << " packets each way" << std::endl;
+    Run(false, bursts, burst_size);
+    Run(true, bursts, burst_size);
+    return 0;
+}
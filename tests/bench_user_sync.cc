@@ -0,0 +1,130 @@
+// Initial sync of a large server followed by a burst of mute toggles, which
+// look up one user each, and the sync of fewer users with large comments.
+// The sync time includes connecting, so a run with an empty server is
+// printed first to compare against.
+//
+// bench_user_sync [users] [channels] [mute toggles] [commented users] [comment bytes]
+
+#include <cstdlib>
+#include <sstream>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+
+#include "fake_server.h"
+#include "src/logging.h"
+#include "src/user.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+const int32_t kFirstSession = 1000;
+
+void Increment(boost::atomic<int32_t>* count)
+{
+    ++*count;
+}
+
+void ReceiveText(boost::atomic<int32_t>* count, const std::string& /*text*/)
+{
+    ++*count;
+}
+
+// The root channel, |channels| - 1 channels below it and |users| users
+// spread over them, each with a comment of |comment_bytes|
+std::string SyncFrames(int32_t users, int32_t channels, size_t comment_bytes)
+{
+    std::string frames;
+    std::string comment(comment_bytes, 'c');
+    for (int32_t i = 0; i < channels; ++i)
+    {
+        MumbleProto::ChannelState channel;
+        channel.set_channel_id(i);
+        channel.set_parent(0);
+        std::ostringstream name;
+        name << "channel " << i;
+        channel.set_name(name.str());
+        test::FakeServer::AppendFrame(frames, PbMessageType::ChannelState, channel);
+    }
+    for (int32_t i = 0; i < users; ++i)
+    {
+        MumbleProto::UserState user;
+        user.set_session(kFirstSession + i);
+        user.set_channel_id(i % channels);
+        std::ostringstream name;
+        name << "user " << i;
+        user.set_name(name.str());
+        if (comment_bytes > 0)
+            user.set_comment(comment);
+        test::FakeServer::AppendFrame(frames, PbMessageType::UserState, user);
+    }
+    return frames;
+}
+
+void Run(int32_t users, int32_t channels, size_t comment_bytes, int32_t toggles)
+{
+    test::FakeServer server;
+    server.SetSyncFrames(SyncFrames(users, channels, comment_bytes));
+    test::ClientThread thread;
+    MumbleClient::MumbleClient* client = thread.lib().NewClient();
+
+    boost::atomic<int32_t> authed(0), texts(0);
+    client->SetAuthCallback(boost::bind(&Increment, &authed));
+    client->SetTextMessageCallback(boost::bind(&ReceiveText, &texts, _1));
+
+    test::Stopwatch sync;
+    client->Connect(server.ClientSettings("sync"));
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &authed, 1), 600000));
+    double sync_ns = sync.ElapsedNs();
+    CHECK_EQ(client->GetUserCount(), static_cast<size_t>(users));
+    CHECK_EQ(client->GetChannelCount(), static_cast<size_t>(channels));
+    std::cout << users << " users in " << channels << " channels";
+    if (comment_bytes > 0)
+        std::cout << " with " << comment_bytes << " byte comments";
+    std::cout << ": synced in " << sync_ns / 1000000 << " ms" << std::endl;
+    if (comment_bytes > 0)
+        CHECK_EQ(client->GetUser(kFirstSession)->comment.size(), comment_bytes);
+
+    if (users > 0 && toggles > 0)
+    {
+        // A text message after the toggles tells when they are all handled
+        std::string frames;
+        for (int32_t i = 0; i < toggles; ++i)
+        {
+            MumbleProto::UserState user;
+            user.set_session(kFirstSession + i % users);
+            user.set_self_mute(i % 2 == 0);
+            test::FakeServer::AppendFrame(frames, PbMessageType::UserState, user);
+        }
+        MumbleProto::TextMessage text;
+        text.set_message("done");
+        test::FakeServer::AppendFrame(frames, PbMessageType::TextMessage, text);
+
+        test::Stopwatch stopwatch;
+        server.SendRaw(frames);
+        CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &texts, 1), 600000));
+        std::cout << "  " << stopwatch.ElapsedNs() / toggles << " ns per mute toggle" << std::endl;
+    }
+
+    thread.Stop();
+    delete client;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    int32_t users = argc > 1 ? std::atoi(argv[1]) : 5000;
+    int32_t channels = argc > 2 ? std::atoi(argv[2]) : 500;
+    int32_t toggles = argc > 3 ? std::atoi(argv[3]) : 200000;
+    int32_t commented_users = argc > 4 ? std::atoi(argv[4]) : 500;
+    size_t comment_bytes = argc > 5 ? static_cast<size_t>(std::atol(argv[5])) : 100 * 1024;
+
+    MumbleClientLib::SetLogLevel(logging::LOG_FATAL);
+    Run(0, 1, 0, 0);
+    Run(users, channels, 0, toggles);
+    Run(commented_users, channels, comment_bytes, 0);
+    return 0;
+}
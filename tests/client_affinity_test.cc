@@ -0,0 +1,101 @@
+// Run() with pinned threads: every thread that runs a handler is bound to
+// a single CPU, and the thread that called Run() gets its own affinity
+// back afterwards.
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "fake_server.h"
+#include "src/logging.h"
+#include "test_util.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace MumbleClient;
+
+#if defined(__linux__)
+
+namespace {
+
+cpu_set_t CurrentAffinity()
+{
+    cpu_set_t set;
+    pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+    return set;
+}
+
+// Counts the handler threads that were bound to more than one CPU
+void Authenticated(boost::atomic<int32_t>* authed, boost::atomic<int32_t>* unpinned)
+{
+    cpu_set_t set = CurrentAffinity();
+    if (CPU_COUNT(&set) != 1)
+        ++*unpinned;
+    ++*authed;
+}
+
+// Runs the library from a thread bound to the last CPU, which pinning
+// would move to CPU 0
+void RunFromLastCpu(MumbleClientLib* lib, bool* restored)
+{
+    int32_t last = static_cast<int32_t>(boost::thread::hardware_concurrency()) - 1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(last > 0 ? last : 0, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    lib->Run(2);
+
+    cpu_set_t after = CurrentAffinity();
+    *restored = CPU_EQUAL(&set, &after);
+}
+
+}  // namespace
+
+int main()
+{
+    MumbleClientLib::SetLogLevel(logging::LOG_FATAL);
+    test::FakeServer server;
+
+    MumbleClientLib* lib = MumbleClientLib::instance();
+    CHECK(lib->SetShardCount(2, true));
+
+    boost::atomic<int32_t> authed(0), unpinned(0);
+    MumbleClient::MumbleClient* clients[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        clients[i] = lib->NewClient();
+        clients[i]->SetAuthCallback(boost::bind(&Authenticated, &authed, &unpinned));
+        clients[i]->Connect(server.ClientSettings(i == 0 ? "first" : "second"));
+    }
+    CHECK_EQ(lib->GetShardLoad(0), 1);
+    CHECK_EQ(lib->GetShardLoad(1), 1);
+
+    bool restored = false;
+    boost::thread runner(boost::bind(&RunFromLastCpu, lib, &restored));
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &authed, 2)));
+    CHECK_EQ(unpinned.load(), 0);
+
+    for (int i = 0; i < 2; ++i)
+        clients[i]->Disconnect();
+    runner.join();
+    CHECK(restored);
+
+    for (int i = 0; i < 2; ++i)
+        delete clients[i];
+    delete lib;
+    return 0;
+}
+
+#else
+
+int main()
+{
+    std::cout << "Thread affinity is only checked on Linux" << std::endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,71 @@
+// Control stream framing against a loopback server: messages split across
+// reads arrive whole, and a header announcing an oversized body closes the
+// connection and reports the error.
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+
+#include "fake_server.h"
+#include "src/logging.h"
+#include "src/message_framer.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+void Increment(boost::atomic<int32_t>* count)
+{
+    ++*count;
+}
+
+void RecordText(boost::atomic<int32_t>* count, size_t* length, const std::string& text)
+{
+    *length = text.size();
+    ++*count;
+}
+
+void RecordError(boost::atomic<int32_t>* count, boost::atomic<int32_t>* value, const boost::system::error_code& error)
+{
+    *value = error.value();
+    ++*count;
+}
+
+}  // namespace
+
+int main()
+{
+    MumbleClientLib::SetLogLevel(logging::LOG_WARNING);
+    test::FakeServer server;
+    test::ClientThread thread;
+    MumbleClient::MumbleClient* client = thread.lib().NewClient();
+
+    boost::atomic<int32_t> authed(0), texts(0), errors(0), error_value(0);
+    size_t text_length = 0;
+    client->SetAuthCallback(boost::bind(&Increment, &authed));
+    client->SetTextMessageCallback(boost::bind(&RecordText, &texts, &text_length, _1));
+    client->SetErrorCallback(boost::bind(&RecordError, &errors, &error_value, _1));
+    client->Connect(server.ClientSettings("framing"));
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &authed, 1)));
+
+    // Larger than one TLS record, so the client reads it in pieces
+    MumbleProto::TextMessage text;
+    text.set_message(std::string(100000, 'x'));
+    std::string frames;
+    test::FakeServer::AppendFrame(frames, PbMessageType::TextMessage, text);
+    server.SendRaw(frames);
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &texts, 1)));
+    CHECK_EQ(text_length, 100000U);
+
+    MessageHeader header;
+    header.type(PbMessageType::TextMessage);
+    header.length(MessageFramer::kMaxMessageLength + 1);
+    server.SendRaw(std::string(reinterpret_cast<const char*>(header.data()), MessageHeader::kSize) + "junk");
+    CHECK(test::WaitUntil(boost::bind(&test::FakeServer::Closed, &server) == 1));
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &errors, 1)));
+    CHECK_EQ(error_value.load(), static_cast<int32_t>(boost::system::errc::bad_message));
+
+    thread.Stop();
+    delete client;
+    return 0;
+}
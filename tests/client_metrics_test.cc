@@ -0,0 +1,75 @@
+// Clients created and destroyed on one thread while another reads the
+// library metrics, which walks the live clients. Nothing runs the shards,
+// so deleting a client runs its pending setters on the deleting thread, and
+// moving one waits for Poll() to run them.
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "src/client.h"
+#include "src/client_lib.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+void ReadMetrics(MumbleClientLib* lib, boost::atomic<bool>* done, boost::atomic<int>* reads)
+{
+    while (!done->load())
+    {
+        MetricsSnapshot snapshot = lib->GetMetrics();
+        CHECK(snapshot.clients <= 8);
+        ++*reads;
+    }
+}
+
+}  // namespace
+
+int main()
+{
+    MumbleClientLib* lib = MumbleClientLib::instance();
+    CHECK(lib->SetShardCount(2, false));
+
+    boost::atomic<bool> done(false);
+    boost::atomic<int> reads(0);
+    boost::thread reader(boost::bind(&ReadMetrics, lib, &done, &reads));
+
+    for (int round = 0; round < 200; ++round)
+    {
+        MumbleClient::MumbleClient* clients[8];
+        for (int i = 0; i < 8; ++i)
+            clients[i] = lib->NewClient();
+        CHECK_EQ(lib->GetShardLoad(0), 4);
+        CHECK_EQ(lib->GetShardLoad(1), 4);
+
+        for (int i = 0; i < 8; ++i)
+        {
+            clients[i]->SetVoiceQueueLimits(100, 10);
+            delete clients[i];
+        }
+    }
+
+    done = true;
+    reader.join();
+    // Deleting the clients ran all of their handlers
+    CHECK_EQ(lib->Poll(), 0U);
+
+    // A client with a setter still queued on its shard stays there
+    MumbleClient::MumbleClient* moving = lib->NewClient();
+    int32_t from = lib->GetShardLoad(0) == 1 ? 0 : 1;
+    moving->SetVoiceQueueLimits(100, 10);
+    CHECK(!lib->MoveClient(moving, 1 - from));
+    CHECK(lib->Poll() > 0);
+    CHECK(lib->MoveClient(moving, 1 - from));
+    CHECK_EQ(lib->GetShardLoad(1 - from), 1);
+    delete moving;
+
+    CHECK_EQ(lib->GetShardLoad(0), 0);
+    CHECK_EQ(lib->GetShardLoad(1), 0);
+    CHECK_EQ(lib->GetMetrics().clients, 0U);
+    CHECK(reads > 0);
+    delete lib;
+    return 0;
+}
@@ -0,0 +1,61 @@
+// Clients disconnected and deleted while their io_service keeps running on
+// another thread, with sends and the disconnect still queued, and clients
+// deleted mid-connect. Deleting must wait for the handlers of the client
+// and nothing may run on it afterwards.
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+
+#include "fake_server.h"
+#include "src/logging.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+void Increment(boost::atomic<int32_t>* count)
+{
+    ++*count;
+}
+
+}  // namespace
+
+int main()
+{
+    MumbleClientLib::SetLogLevel(logging::LOG_ERROR);
+    test::FakeServer server;
+    test::ClientThread thread;
+
+    boost::atomic<int32_t> authed(0), disconnected(0);
+    for (int round = 0; round < 20; ++round)
+    {
+        MumbleClient::MumbleClient* client = thread.lib().NewClient();
+        client->SetAuthCallback(boost::bind(&Increment, &authed));
+        client->Connect(server.ClientSettings("teardown"));
+        CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &authed, round + 1)));
+
+        MumbleProto::TextMessage text;
+        text.set_message("bye");
+        for (int i = 0; i < 50; ++i)
+            client->SendMessage(PbMessageType::TextMessage, text, false);
+        client->SetComment("leaving");
+        client->Disconnect(boost::bind(&Increment, &disconnected));
+        delete client;
+        // The disconnect was applied before the delete returned
+        CHECK_EQ(disconnected.load(), round + 1);
+    }
+
+    // Deleted while resolving, connecting or handshaking
+    for (int round = 0; round < 20; ++round)
+    {
+        MumbleClient::MumbleClient* client = thread.lib().NewClient();
+        client->Connect(server.ClientSettings("teardown"));
+        delete client;
+    }
+
+    CHECK(test::WaitUntil(boost::bind(&test::FakeServer::Closed, &server) >= 20));
+    CHECK_EQ(thread.lib().GetMetrics().clients, 0U);
+    thread.Stop();
+    return 0;
+}
@@ -0,0 +1,213 @@
+// OCB-AES128 known answers and packet level behaviour of CryptState, for
+// the portable code and for the hardware kernel where one is selected.
+//
+// Mumble uses OCB as in the OCB2 draft, not RFC 7253 (OCB3), so the known
+// answers are the OCB2 ones Mumble's own crypt test checks against.
+
+#include <string.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "src/CryptState.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+// Key and nonce 00..0f
+const unsigned char kEmptyTag[AES_BLOCK_SIZE] = {
+    0xBF, 0x31, 0x08, 0x13, 0x07, 0x73, 0xAD, 0x5E, 0xC7, 0x0E, 0xC6, 0x9E, 0x78, 0x75, 0xA7, 0xB0
+};
+
+// Same key and nonce, plain text 00..27
+const unsigned char kCipher[40] = {
+    0xF7, 0x5D, 0x6B, 0xC8, 0xB4, 0xDC, 0x8D, 0x66, 0xB8, 0x36, 0xA2, 0xB0, 0x8B, 0x32, 0xA6, 0x36,
+    0x9F, 0x1C, 0xD3, 0xC5, 0x22, 0x8D, 0x79, 0xFD, 0x6C, 0x26, 0x7F, 0x5F, 0x6A, 0xA7, 0xB2, 0x31,
+    0xC7, 0xDF, 0xB9, 0xD5, 0x99, 0x51, 0xAE, 0x9C
+};
+const unsigned char kCipherTag[AES_BLOCK_SIZE] = {
+    0x9D, 0xB0, 0xCD, 0xF8, 0x80, 0xF7, 0x3E, 0x3E, 0x10, 0xD4, 0xEB, 0x32, 0x17, 0x76, 0x66, 0x88
+};
+
+void Setup(CryptState& client, CryptState& server, bool portable)
+{
+    unsigned char key[AES_BLOCK_SIZE], client_nonce[AES_BLOCK_SIZE], server_nonce[AES_BLOCK_SIZE];
+    for (int i = 0; i < AES_BLOCK_SIZE; ++i)
+    {
+        key[i] = static_cast<unsigned char>(i);
+        client_nonce[i] = static_cast<unsigned char>(0x20 + i);
+        server_nonce[i] = static_cast<unsigned char>(0x40 + i);
+    }
+    if (portable)
+    {
+        client.usePortable();
+        server.usePortable();
+    }
+    client.setKey(key, client_nonce, server_nonce);
+    server.setKey(key, server_nonce, client_nonce);
+}
+
+void TestKnownAnswers(bool portable)
+{
+    unsigned char key[AES_BLOCK_SIZE], nonce[AES_BLOCK_SIZE];
+    for (int i = 0; i < AES_BLOCK_SIZE; ++i)
+        key[i] = nonce[i] = static_cast<unsigned char>(i);
+
+    CryptState cs;
+    if (portable)
+        cs.usePortable();
+    cs.setKey(key, nonce, nonce);
+
+    unsigned char plain[40], encrypted[40], decrypted[40], tag[AES_BLOCK_SIZE];
+    for (int i = 0; i < 40; ++i)
+        plain[i] = static_cast<unsigned char>(i);
+
+    cs.ocb_encrypt(plain, encrypted, 0, nonce, tag);
+    CHECK(memcmp(tag, kEmptyTag, AES_BLOCK_SIZE) == 0);
+    cs.ocb_decrypt(encrypted, decrypted, 0, nonce, tag);
+    CHECK(memcmp(tag, kEmptyTag, AES_BLOCK_SIZE) == 0);
+
+    cs.ocb_encrypt(plain, encrypted, 40, nonce, tag);
+    CHECK(memcmp(encrypted, kCipher, 40) == 0);
+    CHECK(memcmp(tag, kCipherTag, AES_BLOCK_SIZE) == 0);
+    cs.ocb_decrypt(encrypted, decrypted, 40, nonce, tag);
+    CHECK(memcmp(decrypted, plain, 40) == 0);
+    CHECK(memcmp(tag, kCipherTag, AES_BLOCK_SIZE) == 0);
+}
+
+void TestRoundTrip(bool portable)
+{
+    CryptState client, server;
+    Setup(client, server, portable);
+
+    unsigned char plain[200], packet[204], decrypted[200];
+    for (unsigned int len = 1; len <= sizeof(plain); ++len)
+    {
+        for (unsigned int i = 0; i < len; ++i)
+            plain[i] = static_cast<unsigned char>(i * 7 + len);
+        client.encrypt(plain, packet, len);
+        CHECK(server.decrypt(packet, decrypted, len + 4));
+        CHECK(memcmp(plain, decrypted, len) == 0);
+    }
+    CHECK_EQ(server.getGood(), sizeof(plain));
+    CHECK_EQ(server.getLost(), 0U);
+}
+
+void TestReplayAndTamper(bool portable)
+{
+    CryptState client, server;
+    Setup(client, server, portable);
+
+    unsigned char plain[32], packet[36], decrypted[32];
+    memset(plain, 0x5a, sizeof(plain));
+
+    client.encrypt(plain, packet, sizeof(plain));
+    CHECK(server.decrypt(packet, decrypted, sizeof(packet)));
+    // The same packet again is a replay
+    CHECK(!server.decrypt(packet, decrypted, sizeof(packet)));
+
+    client.encrypt(plain, packet, sizeof(plain));
+    packet[10] ^= 1;
+    CHECK(!server.decrypt(packet, decrypted, sizeof(packet)));
+    packet[10] ^= 1;
+    CHECK(server.decrypt(packet, decrypted, sizeof(packet)));
+}
+
+void TestLateAndLost(bool portable)
+{
+    CryptState client, server;
+    Setup(client, server, portable);
+
+    unsigned char plain[16], packets[4][20], decrypted[16];
+    memset(plain, 1, sizeof(plain));
+    for (int i = 0; i < 4; ++i)
+        client.encrypt(plain, packets[i], sizeof(plain));
+
+    // Packet 1 never arrives and packet 2 comes after 3
+    CHECK(server.decrypt(packets[0], decrypted, 20));
+    CHECK(server.decrypt(packets[3], decrypted, 20));
+    CHECK(server.decrypt(packets[2], decrypted, 20));
+    CHECK_EQ(server.getGood(), 3U);
+    CHECK_EQ(server.getLate(), 1U);
+    CHECK_EQ(server.getLost(), 1U);
+}
+
+void TestBatch(bool portable)
+{
+    const unsigned int kCount = 40;
+    CryptState client, server, reference_client, reference_server;
+    Setup(client, server, portable);
+    Setup(reference_client, reference_server, portable);
+
+    unsigned char plain[kCount][100], packets[kCount][104], reference[kCount][104], decrypted[kCount][100];
+    const unsigned char* sources[kCount];
+    const unsigned char* crypted[kCount];
+    unsigned char* dsts[kCount];
+    unsigned char* plain_dsts[kCount];
+    unsigned int plain_lengths[kCount], crypted_lengths[kCount];
+    bool results[kCount];
+
+    for (unsigned int i = 0; i < kCount; ++i)
+    {
+        plain_lengths[i] = 1 + (i * 37) % 100;
+        crypted_lengths[i] = plain_lengths[i] + 4;
+        for (unsigned int j = 0; j < plain_lengths[i]; ++j)
+            plain[i][j] = static_cast<unsigned char>(i + j);
+        sources[i] = plain[i];
+        dsts[i] = packets[i];
+        crypted[i] = packets[i];
+        plain_dsts[i] = decrypted[i];
+        reference_client.encrypt(plain[i], reference[i], plain_lengths[i]);
+    }
+
+    client.encryptBatch(sources, dsts, plain_lengths, kCount);
+    for (unsigned int i = 0; i < kCount; ++i)
+        CHECK(memcmp(packets[i], reference[i], crypted_lengths[i]) == 0);
+
+    // One tampered packet fails on its own
+    packets[5][8] ^= 0x80;
+    CHECK_EQ(server.decryptBatch(crypted, plain_dsts, crypted_lengths, results, kCount), kCount - 1);
+    for (unsigned int i = 0; i < kCount; ++i)
+    {
+        CHECK_EQ(results[i], i != 5);
+        if (results[i])
+            CHECK(memcmp(decrypted[i], plain[i], plain_lengths[i]) == 0);
+    }
+}
+
+void CreateCryptState(const char** kernel)
+{
+    CryptState cs;
+    *kernel = cs.kernelName();
+}
+
+void RunAll(bool portable)
+{
+    TestKnownAnswers(portable);
+    TestRoundTrip(portable);
+    TestReplayAndTamper(portable);
+    TestLateAndLost(portable);
+    TestBatch(portable);
+}
+
+}  // namespace
+
+int main()
+{
+    // The first CryptStates of the process, created at once, all get the
+    // same kernel
+    const char* kernels[8];
+    boost::thread_group threads;
+    for (int i = 0; i < 8; ++i)
+        threads.create_thread(boost::bind(&CreateCryptState, &kernels[i]));
+    threads.join_all();
+    for (int i = 1; i < 8; ++i)
+        CHECK(strcmp(kernels[0], kernels[i]) == 0);
+    std::cout << "Selected kernel: " << kernels[0] << std::endl;
+
+    RunAll(true);
+    RunAll(false);
+    return 0;
+}
@@ -0,0 +1,415 @@
+#include "fake_server.h"
+
+#include <deque>
+#include <sstream>
+#include <string.h>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+#include "src/CryptState.h"
+#include "src/message_framer.h"
+#include "src/messages.h"
+
+namespace test {
+
+namespace {
+
+void RunService(boost::asio::io_service* io_service)
+{
+    io_service->run();
+}
+
+// P-256 key and a certificate for it, valid for an hour
+void UseSelfSignedCertificate(SSL_CTX* ctx)
+{
+    EVP_PKEY* key = 0;
+    EVP_PKEY_CTX* key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, 0);
+    EVP_PKEY_keygen_init(key_ctx);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_ctx, NID_X9_62_prime256v1);
+    EVP_PKEY_keygen(key_ctx, &key);
+    EVP_PKEY_CTX_free(key_ctx);
+
+    X509* cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), 0);
+    X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+
+    SSL_CTX_use_certificate(ctx, cert);
+    SSL_CTX_use_PrivateKey(ctx, key);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+}  // namespace
+
+struct FakeServer::Session
+{
+    Session(boost::asio::io_service& io_service, boost::asio::ssl::context& context) :
+        socket(io_service, context),
+        id(0),
+        writing(false),
+        closed(false),
+        has_udp(false) { }
+
+    boost::asio::ssl::stream<boost::asio::ip::tcp::socket> socket;
+    int32_t id;
+    char chunk[16 * 1024];
+    std::string inbox;
+    std::deque<std::string> writes;
+    bool writing;
+    bool closed;
+    MumbleClient::CryptState crypt;
+    bool has_udp;
+    boost::asio::ip::udp::endpoint udp_endpoint;
+};
+
+FakeServer::FakeServer() :
+    context_(boost::asio::ssl::context::sslv23),
+    acceptor_(io_service_),
+    udp_socket_(io_service_),
+    port_(0),
+    next_session_(1),
+    synced_(0),
+    closed_(0),
+    udp_clients_(0),
+    udp_voice_(0),
+    records_(0),
+    record_bytes_(0)
+{
+    for (int32_t i = 0; i < MumbleClient::kPbMessageTypeCount; ++i)
+        frames_[i] = 0;
+
+    UseSelfSignedCertificate(context_.native_handle());
+    SSL_CTX_set_msg_callback(context_.native_handle(), &FakeServer::RecordCallback);
+    SSL_CTX_set_msg_callback_arg(context_.native_handle(), this);
+
+    // UDP has to get the port TCP was given
+    boost::asio::ip::address loopback = boost::asio::ip::address_v4::loopback();
+    for (int attempt = 0; attempt < 20; ++attempt)
+    {
+        acceptor_.open(boost::asio::ip::tcp::v4());
+        acceptor_.bind(boost::asio::ip::tcp::endpoint(loopback, 0));
+        port_ = acceptor_.local_endpoint().port();
+
+        boost::system::error_code error;
+        udp_socket_.open(boost::asio::ip::udp::v4());
+        udp_socket_.bind(boost::asio::ip::udp::endpoint(loopback, port_), error);
+        if (!error)
+            break;
+        udp_socket_.close();
+        acceptor_.close();
+    }
+    acceptor_.listen();
+
+    Accept();
+    ReceiveUdp();
+
+    boost::thread thread(boost::bind(&RunService, &io_service_));
+    thread_.swap(thread);
+}
+
+FakeServer::~FakeServer()
+{
+    // Closing everything lets the pending handlers finish, then run() returns
+    io_service_.post(boost::bind(&FakeServer::DoShutdown, this));
+    thread_.join();
+}
+
+void FakeServer::DoShutdown()
+{
+    boost::system::error_code ignored;
+    acceptor_.close(ignored);
+    udp_socket_.close(ignored);
+    for (size_t i = 0; i < sessions_.size(); ++i)
+        Close(sessions_[i]);
+}
+
+MumbleClient::Settings FakeServer::ClientSettings(const std::string& user_name) const
+{
+    std::ostringstream port;
+    port << port_;
+    return MumbleClient::Settings("127.0.0.1", port.str(), user_name, "");
+}
+
+void FakeServer::Accept()
+{
+    SessionPtr session = boost::make_shared<Session>(boost::ref(io_service_), boost::ref(context_));
+    acceptor_.async_accept(session->socket.lowest_layer(), boost::bind(&FakeServer::HandleAccept, this, session, boost::asio::placeholders::error));
+}
+
+void FakeServer::HandleAccept(const SessionPtr& session, const boost::system::error_code& error)
+{
+    if (error)
+        return;
+
+    session->id = next_session_++;
+    sessions_.push_back(session);
+    session->socket.lowest_layer().set_option(boost::asio::ip::tcp::no_delay(true));
+    session->socket.async_handshake(boost::asio::ssl::stream_base::server, boost::bind(&FakeServer::HandleHandshake, this, session, boost::asio::placeholders::error));
+    Accept();
+}
+
+void FakeServer::HandleHandshake(const SessionPtr& session, const boost::system::error_code& error)
+{
+    if (error)
+    {
+        Close(session);
+        return;
+    }
+    Read(session);
+}
+
+void FakeServer::Read(const SessionPtr& session)
+{
+    session->socket.async_read_some(boost::asio::buffer(session->chunk), boost::bind(&FakeServer::HandleRead, this, session, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+void FakeServer::HandleRead(const SessionPtr& session, const boost::system::error_code& error, size_t bytes)
+{
+    if (error)
+    {
+        Close(session);
+        return;
+    }
+
+    session->inbox.append(session->chunk, bytes);
+    size_t pos = 0;
+    while (session->inbox.size() - pos >= static_cast<size_t>(MumbleClient::MessageHeader::kSize))
+    {
+        MumbleClient::MessageHeader header(reinterpret_cast<const unsigned char*>(session->inbox.data() + pos));
+        size_t length = static_cast<size_t>(header.length());
+        if (session->inbox.size() - pos - MumbleClient::MessageHeader::kSize < length)
+            break;
+
+        std::string body = session->inbox.substr(pos + MumbleClient::MessageHeader::kSize, length);
+        pos += MumbleClient::MessageHeader::kSize + length;
+        HandleFrame(session, header.type(), body);
+    }
+    session->inbox.erase(0, pos);
+
+    if (!session->closed)
+        Read(session);
+}
+
+void FakeServer::HandleFrame(const SessionPtr& session, int32_t type, const std::string& body)
+{
+    if (type >= 0 && type < MumbleClient::kPbMessageTypeCount)
+        ++frames_[type];
+
+    if (type == MumbleClient::PbMessageType::Authenticate)
+    {
+        unsigned char key[AES_BLOCK_SIZE], client_nonce[AES_BLOCK_SIZE], server_nonce[AES_BLOCK_SIZE];
+        RAND_bytes(key, AES_BLOCK_SIZE);
+        RAND_bytes(client_nonce, AES_BLOCK_SIZE);
+        RAND_bytes(server_nonce, AES_BLOCK_SIZE);
+        session->crypt.setKey(key, server_nonce, client_nonce);
+
+        MumbleProto::CryptSetup crypt_setup;
+        crypt_setup.set_key(key, AES_BLOCK_SIZE);
+        crypt_setup.set_client_nonce(client_nonce, AES_BLOCK_SIZE);
+        crypt_setup.set_server_nonce(server_nonce, AES_BLOCK_SIZE);
+
+        MumbleProto::ServerSync server_sync;
+        server_sync.set_session(session->id);
+        server_sync.set_welcome_text("fake server");
+
+        std::string out;
+        AppendFrame(out, MumbleClient::PbMessageType::CryptSetup, crypt_setup);
+        out += sync_frames_;
+        AppendFrame(out, MumbleClient::PbMessageType::ServerSync, server_sync);
+        Write(session, out);
+        ++synced_;
+    }
+    else if (type == MumbleClient::PbMessageType::Ping)
+    {
+        std::string out;
+        AppendFrame(out, type, body);
+        Write(session, out);
+    }
+
+    if (frame_callback_)
+        frame_callback_(session->id, type, body);
+}
+
+void FakeServer::Write(const SessionPtr& session, const std::string& data)
+{
+    if (session->closed)
+        return;
+
+    session->writes.push_back(data);
+    if (session->writing)
+        return;
+
+    session->writing = true;
+    boost::asio::async_write(session->socket, boost::asio::buffer(session->writes.front()), boost::bind(&FakeServer::HandleWrite, this, session, boost::asio::placeholders::error));
+}
+
+void FakeServer::HandleWrite(const SessionPtr& session, const boost::system::error_code& error)
+{
+    session->writes.pop_front();
+    if (error || session->writes.empty())
+    {
+        session->writing = false;
+        return;
+    }
+
+    boost::asio::async_write(session->socket, boost::asio::buffer(session->writes.front()), boost::bind(&FakeServer::HandleWrite, this, session, boost::asio::placeholders::error));
+}
+
+void FakeServer::Close(const SessionPtr& session)
+{
+    if (session->closed)
+        return;
+
+    session->closed = true;
+    boost::system::error_code ignored;
+    session->socket.lowest_layer().close(ignored);
+    ++closed_;
+}
+
+void FakeServer::ReceiveUdp()
+{
+    udp_socket_.async_receive_from(boost::asio::buffer(udp_buffer_), udp_sender_, boost::bind(&FakeServer::HandleUdp, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+void FakeServer::HandleUdp(const boost::system::error_code& error, size_t bytes)
+{
+    if (error == boost::asio::error::operation_aborted)
+        return;
+
+    // As the real server does, find the client by its address, or else by
+    // whose key the packet decrypts with
+    unsigned char plain[2048];
+    if (!error && bytes > 4)
+    {
+        for (size_t i = 0; i < sessions_.size(); ++i)
+        {
+            Session& session = *sessions_[i];
+            if (session.closed || !session.crypt.isValid())
+                continue;
+            if (session.has_udp && session.udp_endpoint != udp_sender_)
+                continue;
+            if (!session.crypt.decrypt(udp_buffer_, plain, static_cast<unsigned int>(bytes)))
+                continue;
+
+            if (!session.has_udp)
+            {
+                session.has_udp = true;
+                session.udp_endpoint = udp_sender_;
+                ++udp_clients_;
+            }
+
+            int32_t type = (plain[0] >> 5) & 0x7;
+            if (type == MumbleClient::UdpMessageType::UDPPing)
+            {
+                unsigned char reply[2048];
+                session.crypt.encrypt(plain, reply, static_cast<unsigned int>(bytes - 4));
+                boost::system::error_code ignored;
+                udp_socket_.send_to(boost::asio::buffer(reply, bytes), session.udp_endpoint, 0, ignored);
+            }
+            else
+                ++udp_voice_;
+            break;
+        }
+    }
+
+    ReceiveUdp();
+}
+
+void FakeServer::SendRaw(const std::string& data)
+{
+    io_service_.post(boost::bind(&FakeServer::DoSendRaw, this, data));
+}
+
+void FakeServer::DoSendRaw(const std::string& data)
+{
+    for (size_t i = 0; i < sessions_.size(); ++i)
+        Write(sessions_[i], data);
+}
+
+void FakeServer::SendUdp(const std::string& packet, int32_t count)
+{
+    io_service_.post(boost::bind(&FakeServer::DoSendUdp, this, packet, count));
+}
+
+void FakeServer::DoSendUdp(const std::string& packet, int32_t count)
+{
+    std::vector<unsigned char> buffer(packet.size() + 4);
+    for (size_t i = 0; i < sessions_.size(); ++i)
+    {
+        Session& session = *sessions_[i];
+        if (session.closed || !session.has_udp)
+            continue;
+
+        for (int32_t n = 0; n < count; ++n)
+        {
+            session.crypt.encrypt(reinterpret_cast<const unsigned char*>(packet.data()), &buffer[0], static_cast<unsigned int>(packet.size()));
+            boost::system::error_code ignored;
+            udp_socket_.send_to(boost::asio::buffer(buffer), session.udp_endpoint, 0, ignored);
+        }
+    }
+}
+
+void FakeServer::AppendFrame(std::string& out, int32_t type, const google::protobuf::Message& message)
+{
+    AppendFrame(out, type, message.SerializePartialAsString());
+}
+
+void FakeServer::AppendFrame(std::string& out, int32_t type, const std::string& body)
+{
+    MumbleClient::MessageHeader header;
+    header.type(static_cast<int16_t>(type));
+    header.length(static_cast<int32_t>(body.size()));
+    out.append(reinterpret_cast<const char*>(header.data()), MumbleClient::MessageHeader::kSize);
+    out += body;
+}
+
+void FakeServer::RecordCallback(int write_p, int /*version*/, int content_type, const void* buf, size_t len, struct ssl_st* /*ssl*/, void* arg)
+{
+    if (write_p || content_type != SSL3_RT_HEADER || len < 5)
+        return;
+
+    const unsigned char* header = static_cast<const unsigned char*>(buf);
+    if (header[0] != SSL3_RT_APPLICATION_DATA)
+        return;
+
+    FakeServer* server = static_cast<FakeServer*>(arg);
+    ++server->records_;
+    server->record_bytes_ += 5 + ((header[3] << 8) | header[4]);
+}
+
+ClientThread::ClientThread() :
+    work_(new boost::asio::io_service::work(io_service_)),
+    lib_(io_service_)
+{
+    boost::thread thread(boost::bind(&RunService, &io_service_));
+    thread_.swap(thread);
+}
+
+ClientThread::~ClientThread()
+{
+    Stop();
+}
+
+void ClientThread::Stop()
+{
+    if (!work_)
+        return;
+
+    io_service_.stop();
+    thread_.join();
+    delete work_;
+    work_ = 0;
+}
+
+}  // namespace test
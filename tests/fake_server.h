@@ -0,0 +1,135 @@
+#ifndef _LIBMUMBLECLIENT_TESTS_FAKE_SERVER_H_
+#define _LIBMUMBLECLIENT_TESTS_FAKE_SERVER_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "src/client.h"
+#include "src/client_lib.h"
+#include "src/libmumble_stdint.h"
+#include "Mumble.pb.h"
+
+namespace test {
+
+// Loopback Mumble server for tests and benchmarks, run on its own thread.
+// It accepts TLS with a generated self-signed certificate, answers
+// Authenticate with CryptSetup, the sync frames and ServerSync, echoes TCP
+// and UDP pings and counts everything else clients send. UDP listens on
+// the same port as TCP.
+class FakeServer
+{
+public:
+    // Called on the server thread for every frame a client sends
+    typedef boost::function<void (int32_t session, int32_t type, const std::string& body)> FrameCallback;
+
+    FakeServer();
+    ~FakeServer();
+
+    unsigned short port() const { return port_; }
+    MumbleClient::Settings ClientSettings(const std::string& user_name) const;
+
+    // Frames sent between CryptSetup and ServerSync, such as channel and
+    // user state. Set these, and the callback, before clients connect.
+    void SetSyncFrames(const std::string& frames) { sync_frames_ = frames; }
+    void SetFrameCallback(const FrameCallback& callback) { frame_callback_ = callback; }
+
+    // Sends bytes as they are on the TCP connection of every client
+    void SendRaw(const std::string& data);
+    // Encrypts and sends |count| copies of a plain UDP packet to every
+    // client whose UDP address is known
+    void SendUdp(const std::string& packet, int32_t count);
+
+    int32_t Synced() const { return synced_; }
+    int32_t Closed() const { return closed_; }
+    // Clients whose UDP address is known, after their first UDP ping
+    int32_t UdpClients() const { return udp_clients_; }
+    uint64_t Frames(int32_t type) const { return frames_[type]; }
+    uint64_t UdpVoiceReceived() const { return udp_voice_; }
+    // TLS records of application data received from clients, header included
+    uint64_t RecordsReceived() const { return records_; }
+    uint64_t RecordBytesReceived() const { return record_bytes_; }
+
+    // Appends a frame, header and body, to |out|
+    static void AppendFrame(std::string& out, int32_t type, const google::protobuf::Message& message);
+    static void AppendFrame(std::string& out, int32_t type, const std::string& body);
+
+private:
+    struct Session;
+    typedef boost::shared_ptr<Session> SessionPtr;
+
+    void Accept();
+    void HandleAccept(const SessionPtr& session, const boost::system::error_code& error);
+    void HandleHandshake(const SessionPtr& session, const boost::system::error_code& error);
+    void Read(const SessionPtr& session);
+    void HandleRead(const SessionPtr& session, const boost::system::error_code& error, size_t bytes);
+    void HandleFrame(const SessionPtr& session, int32_t type, const std::string& body);
+    void Write(const SessionPtr& session, const std::string& data);
+    void HandleWrite(const SessionPtr& session, const boost::system::error_code& error);
+    void Close(const SessionPtr& session);
+    void ReceiveUdp();
+    void HandleUdp(const boost::system::error_code& error, size_t bytes);
+    void DoSendRaw(const std::string& data);
+    void DoSendUdp(const std::string& packet, int32_t count);
+    void DoShutdown();
+
+    static void RecordCallback(int write_p, int version, int content_type, const void* buf, size_t len, struct ssl_st* ssl, void* arg);
+
+    boost::asio::io_service io_service_;
+    boost::asio::ssl::context context_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::ip::udp::socket udp_socket_;
+    unsigned short port_;
+    std::string sync_frames_;
+    FrameCallback frame_callback_;
+
+    std::vector<SessionPtr> sessions_;
+    int32_t next_session_;
+    unsigned char udp_buffer_[2048];
+    boost::asio::ip::udp::endpoint udp_sender_;
+
+    boost::atomic<int32_t> synced_;
+    boost::atomic<int32_t> closed_;
+    boost::atomic<int32_t> udp_clients_;
+    boost::atomic<uint64_t> frames_[MumbleClient::kPbMessageTypeCount];
+    boost::atomic<uint64_t> udp_voice_;
+    boost::atomic<uint64_t> records_;
+    boost::atomic<uint64_t> record_bytes_;
+
+    boost::thread thread_;
+
+    FakeServer(const FakeServer&);
+    void operator=(const FakeServer&);
+};
+
+// A library context around an io_service run on its own thread. Clients
+// may be deleted while it runs; deleting waits for their handlers.
+class ClientThread
+{
+public:
+    ClientThread();
+    ~ClientThread();
+
+    MumbleClient::MumbleClientLib& lib() { return lib_; }
+    boost::asio::io_service& io_service() { return io_service_; }
+    void Stop();
+
+private:
+    boost::asio::io_service io_service_;
+    boost::asio::io_service::work* work_;
+    MumbleClient::MumbleClientLib lib_;
+    boost::thread thread_;
+
+    ClientThread(const ClientThread&);
+    void operator=(const ClientThread&);
+};
+
+}  // namespace test
+
+#endif
@@ -0,0 +1,92 @@
+// Asynchronous logging: queueing a record allocates nothing once the slots
+// exist, and every record is either written or counted as dropped, even
+// when StopAsyncLogging() races with threads that are logging.
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "allocation_counter.h"
+#include "src/log_sink.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+const int32_t kThreads = 4;
+const int32_t kRecordsPerThread = 500;
+const int32_t kStopRounds = 50;
+
+boost::atomic<int64_t> written(0);
+
+void CountLine(logging::LogSeverity /*severity*/, const std::string& /*line*/)
+{
+    ++written;
+}
+
+bool AllWritten(int64_t records)
+{
+    return written + static_cast<int64_t>(logging::GetDroppedLogCount()) >= records;
+}
+
+void Log(const std::string* line, int32_t records)
+{
+    for (int32_t i = 0; i < records; ++i)
+        logging::DeliverLogRecord(logging::LOG_INFO, *line);
+}
+
+void TestNoAllocations(const std::string& line)
+{
+    if (!test::AllocationCountingSupported())
+        return;
+
+    logging::StartAsyncLogging(1024);
+    Log(&line, 2000);
+    CHECK(test::WaitUntil(boost::bind(&AllWritten, 2000)));
+
+    test::ResetCountedAllocations();
+    test::CountAllocationsOnThisThread(true);
+    Log(&line, 10000);
+    test::CountAllocationsOnThisThread(false);
+    CHECK_EQ(test::CountedAllocations(), 0);
+
+    logging::StopAsyncLogging();
+    CHECK_EQ(written + static_cast<int64_t>(logging::GetDroppedLogCount()), 12000);
+}
+
+void TestStopWhileLogging(const std::string& line)
+{
+    for (int32_t round = 0; round < kStopRounds; ++round)
+    {
+        int64_t before = written + static_cast<int64_t>(logging::GetDroppedLogCount());
+        logging::StartAsyncLogging(256);
+
+        boost::thread_group threads;
+        for (int32_t i = 0; i < kThreads; ++i)
+            threads.create_thread(boost::bind(&Log, &line, kRecordsPerThread));
+        boost::this_thread::yield();
+        logging::StopAsyncLogging();
+        threads.join_all();
+
+        // Nothing may be left behind in the ring
+        int64_t after = written + static_cast<int64_t>(logging::GetDroppedLogCount());
+        CHECK_EQ(after - before, static_cast<int64_t>(kThreads * kRecordsPerThread));
+    }
+}
+
+}  // namespace
+
+int main()
+{
+    logging::CallbackLogSink sink(&CountLine);
+    logging::AddLogSink(&sink);
+
+    std::string line(100, 'x');
+    line += '\n';
+    TestNoAllocations(line);
+    TestStopWhileLogging(line);
+
+    logging::RemoveLogSink(&sink);
+    return 0;
+}
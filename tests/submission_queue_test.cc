@@ -0,0 +1,115 @@
+// Several threads sending control messages through one client at once,
+// many more than the submission queue holds. Every message reaches the
+// server, none is dropped, and the messages of each thread arrive in the
+// order it sent them.
+
+#include <cstdlib>
+#include <sstream>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "fake_server.h"
+#include "src/logging.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+const int32_t kProducers = 4;
+const int32_t kMessagesPerProducer = 5000;
+
+struct Received
+{
+    Received() : messages(0), out_of_order(0)
+    {
+        for (int32_t i = 0; i < kProducers; ++i)
+            last[i] = -1;
+    }
+
+    boost::atomic<int32_t> messages;
+    boost::atomic<int32_t> out_of_order;
+    // Only touched on the server thread
+    int32_t last[kProducers];
+};
+
+void Increment(boost::atomic<int32_t>* count)
+{
+    ++*count;
+}
+
+// Messages are "<producer> <sequence>"
+void ReceiveFrame(Received* received, int32_t /*session*/, int32_t type, const std::string& body)
+{
+    if (type != PbMessageType::TextMessage)
+        return;
+
+    MumbleProto::TextMessage text;
+    CHECK(text.ParseFromString(body));
+    std::istringstream fields(text.message());
+    int32_t producer = -1, sequence = -1;
+    fields >> producer >> sequence;
+    CHECK(producer >= 0 && producer < kProducers);
+
+    if (sequence <= received->last[producer])
+        ++received->out_of_order;
+    received->last[producer] = sequence;
+    ++received->messages;
+}
+
+void Produce(MumbleClient::MumbleClient* client, int32_t producer, boost::barrier* start)
+{
+    MumbleProto::TextMessage text;
+    text.add_channel_id(0);
+    start->wait();
+    for (int32_t i = 0; i < kMessagesPerProducer; ++i)
+    {
+        std::ostringstream message;
+        message << producer << " " << i;
+        text.set_message(message.str());
+        client->SendMessage(PbMessageType::TextMessage, text, false);
+    }
+}
+
+bool AllReceived(const Received* received)
+{
+    return received->messages >= kProducers * kMessagesPerProducer;
+}
+
+}  // namespace
+
+int main()
+{
+    MumbleClientLib::SetLogLevel(logging::LOG_FATAL);
+    test::FakeServer server;
+    Received received;
+    server.SetFrameCallback(boost::bind(&ReceiveFrame, &received, _1, _2, _3));
+
+    test::ClientThread thread;
+    MumbleClient::MumbleClient* client = thread.lib().NewClient();
+    boost::atomic<int32_t> authed(0);
+    client->SetAuthCallback(boost::bind(&Increment, &authed));
+    client->Connect(server.ClientSettings("producers"));
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &authed, 1)));
+
+    boost::barrier start(kProducers);
+    boost::thread_group producers;
+    for (int32_t i = 0; i < kProducers; ++i)
+        producers.create_thread(boost::bind(&Produce, client, i, &start));
+    producers.join_all();
+
+    CHECK(test::WaitUntil(boost::bind(&AllReceived, &received), 60000));
+    // Nothing arrives beyond what was sent
+    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    SendQueueStats stats = client->GetSendQueueStats();
+    CHECK_EQ(stats.submissions_dropped, 0U);
+    CHECK_EQ(received.messages.load(), kProducers * kMessagesPerProducer);
+    CHECK_EQ(received.out_of_order.load(), 0);
+    std::cout << received.messages << " received, " << stats.submissions_spilled << " spilled" << std::endl;
+
+    thread.Stop();
+    delete client;
+    return 0;
+}
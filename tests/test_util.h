@@ -0,0 +1,91 @@
+#ifndef _LIBMUMBLECLIENT_TESTS_TEST_UTIL_H_
+#define _LIBMUMBLECLIENT_TESTS_TEST_UTIL_H_
+
+#include <cstdlib>
+#include <iostream>
+
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "src/libmumble_stdint.h"
+
+// Ends the test with the failing condition and its location
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " << #condition << std::endl; \
+            std::exit(1); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        if (!((a) == (b))) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ failed: " << #a << " == " << #b \
+                      << " (" << (a) << " vs " << (b) << ")" << std::endl; \
+            std::exit(1); \
+        } \
+    } while (0)
+
+namespace test {
+
+// xorshift64*, so runs are reproducible from the seed
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : state_(seed ? seed : 1) { }
+
+    uint64_t Next()
+    {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 2685821657736338717ULL;
+    }
+
+    // Uniform in [0, bound)
+    uint32_t Below(uint32_t bound) { return static_cast<uint32_t>(Next() % bound); }
+    bool OneIn(uint32_t n) { return Below(n) == 0; }
+
+private:
+    uint64_t state_;
+};
+
+// Wall clock time since construction, for benchmarks
+class Stopwatch
+{
+public:
+    Stopwatch() : start_(boost::posix_time::microsec_clock::universal_time()) { }
+
+    double ElapsedNs() const
+    {
+        return static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start_).total_microseconds()) * 1000.0;
+    }
+
+private:
+    boost::posix_time::ptime start_;
+};
+
+inline bool AtLeast(const boost::atomic<int32_t>* value, int32_t n)
+{
+    return value->load() >= n;
+}
+
+// Polls |condition| every millisecond until it holds or |timeout_ms| pass
+inline bool WaitUntil(const boost::function<bool ()>& condition, int32_t timeout_ms = 10000)
+{
+    boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(timeout_ms);
+    while (!condition())
+    {
+        if (boost::posix_time::microsec_clock::universal_time() > deadline)
+            return false;
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    return true;
+}
+
+}  // namespace test
+
+#endif
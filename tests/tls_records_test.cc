@@ -0,0 +1,124 @@
+// TLS records on the wire for a burst of UDPTunnel frames. Written the old
+// way, one gathered write of header and body per frame, every frame costs
+// at least one record: two before Boost 1.70, whose SSL stream wrote each
+// buffer on its own, one since it linearises small buffer sequences. The
+// client coalesces queued frames into shared records.
+
+#include <vector>
+
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "fake_server.h"
+#include "src/logging.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+const int32_t kFrames = 500;
+const int32_t kPacketSize = 60;
+
+void Increment(boost::atomic<int32_t>* count)
+{
+    ++*count;
+}
+
+bool TunnelFrames(test::FakeServer* server, uint64_t frames)
+{
+    return server->Frames(PbMessageType::UDPTunnel) >= frames;
+}
+
+// Holds the client's network thread until released, so the burst queues up
+void Block(boost::barrier* entered, boost::barrier* release)
+{
+    entered->wait();
+    release->wait();
+}
+
+void Report(const char* label, uint64_t records, uint64_t bytes)
+{
+    std::cout << label << ": " << records << " records, " << bytes << " bytes for " << kFrames << " frames" << std::endl;
+}
+
+// Sends the burst over a TLS connection of its own with one gathered write
+// per frame, as the send queue did before coalescing
+void LegacyWrites(test::FakeServer& server, const std::string& packet)
+{
+    boost::asio::io_service io_service;
+    boost::asio::ssl::context context(boost::asio::ssl::context::sslv23);
+    context.set_verify_mode(boost::asio::ssl::verify_none);
+    boost::asio::ssl::stream<boost::asio::ip::tcp::socket> stream(io_service, context);
+    stream.lowest_layer().connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), server.port()));
+    stream.handshake(boost::asio::ssl::stream_base::client);
+
+    std::string frame;
+    test::FakeServer::AppendFrame(frame, PbMessageType::UDPTunnel, packet);
+
+    uint64_t records = server.RecordsReceived(), bytes = server.RecordBytesReceived();
+    uint64_t frames = server.Frames(PbMessageType::UDPTunnel);
+    for (int32_t i = 0; i < kFrames; ++i)
+    {
+        boost::array<boost::asio::const_buffer, 2> buffers = { {
+            boost::asio::buffer(frame.data(), 6),
+            boost::asio::buffer(frame.data() + 6, frame.size() - 6)
+        } };
+        boost::asio::write(stream, buffers);
+    }
+    CHECK(test::WaitUntil(boost::bind(&TunnelFrames, &server, frames + kFrames)));
+
+    records = server.RecordsReceived() - records;
+    bytes = server.RecordBytesReceived() - bytes;
+    Report("header and body written apart", records, bytes);
+    CHECK(records >= static_cast<uint64_t>(kFrames));
+}
+
+void CoalescedWrites(test::FakeServer& server, const std::string& packet)
+{
+    test::ClientThread thread;
+    MumbleClient::MumbleClient* client = thread.lib().NewClient();
+    boost::atomic<int32_t> authed(0);
+    client->SetAuthCallback(boost::bind(&Increment, &authed));
+    // The whole burst is queued at once, so none of it may be dropped
+    client->SetVoiceQueueLimits(0, kFrames);
+    client->Connect(server.ClientSettings("records"));
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &authed, 1)));
+
+    boost::barrier entered(2), release(2);
+    thread.io_service().post(boost::bind(&Block, &entered, &release));
+    entered.wait();
+
+    uint64_t records = server.RecordsReceived(), bytes = server.RecordBytesReceived();
+    uint64_t frames = server.Frames(PbMessageType::UDPTunnel);
+    for (int32_t i = 0; i < kFrames; ++i)
+        client->SendRawUdpTunnel(packet.data(), kPacketSize);
+    release.wait();
+    CHECK(test::WaitUntil(boost::bind(&TunnelFrames, &server, frames + kFrames)));
+
+    records = server.RecordsReceived() - records;
+    bytes = server.RecordBytesReceived() - bytes;
+    Report("coalesced", records, bytes);
+    // 66 byte frames fill a 16 KiB write buffer about 250 at a time
+    CHECK(records <= kFrames / 100);
+
+    thread.Stop();
+    delete client;
+}
+
+}  // namespace
+
+int main()
+{
+    MumbleClientLib::SetLogLevel(logging::LOG_FATAL);
+    test::FakeServer server;
+    std::string packet(kPacketSize, '\x80');
+
+    LegacyWrites(server, packet);
+    CoalescedWrites(server, packet);
+    return 0;
+}
@@ -0,0 +1,106 @@
+// Threads record trace events while tracing is restarted with other buffer
+// sizes, cleared and dumped. Every dumped event must be whole, and no
+// thread may show more events than its buffer holds.
+
+#include <map>
+#include <sstream>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "src/trace.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+const int32_t kThreads = 4;
+const int32_t kRounds = 300;
+const size_t kSizes[] = { 16, 1000, 1, 64 };
+
+// Consecutive events alternate between two name and id pairs, so an event
+// read while it was overwritten shows a name with the wrong id
+const char* const kNames[] = { "even", "odd" };
+const int32_t kIds[2] = { 0, 0 };
+
+void Record(boost::atomic<bool>* stop)
+{
+    for (uint64_t n = 0; !*stop; ++n)
+    {
+        trace::Scope scope(kNames[n % 2], &kIds[n % 2]);
+    }
+}
+
+std::string Field(const std::string& event, const std::string& name)
+{
+    std::string key = "\"" + name + "\":";
+    size_t begin = event.find(key);
+    CHECK(begin != std::string::npos);
+    begin += key.size();
+    if (event[begin] == '"')
+        return event.substr(begin + 1, event.find('"', begin + 1) - begin - 1);
+    return event.substr(begin, event.find_first_of(",}", begin) - begin);
+}
+
+// Returns the number of events
+size_t CheckTrace(const std::string& json, size_t events_per_thread)
+{
+    std::map<std::string, std::string> ids;
+    for (int32_t i = 0; i < 2; ++i)
+    {
+        std::ostringstream id;
+        id << static_cast<const void*>(&kIds[i]);
+        ids[kNames[i]] = id.str();
+    }
+
+    std::map<std::string, size_t> per_thread;
+    size_t events = 0;
+    for (size_t begin = json.find("{\"name\""); begin != std::string::npos; begin = json.find("{\"name\"", begin + 1))
+    {
+        std::string event = json.substr(begin, json.find('}', json.find("\"args\"", begin)) + 1 - begin);
+        std::string name = Field(event, "name");
+        CHECK(ids.count(name) == 1);
+        CHECK_EQ(Field(event, "id"), ids[name]);
+        ++per_thread[Field(event, "tid")];
+        ++events;
+    }
+
+    for (std::map<std::string, size_t>::const_iterator it = per_thread.begin(); it != per_thread.end(); ++it)
+        CHECK(it->second <= events_per_thread);
+    return events;
+}
+
+}  // namespace
+
+int main()
+{
+    boost::atomic<bool> stop(false);
+    trace::StartTracing(kSizes[0]);
+
+    size_t events = 0;
+    boost::thread_group threads;
+    for (int32_t i = 0; i < kThreads; ++i)
+        threads.create_thread(boost::bind(&Record, &stop));
+
+    for (int32_t round = 0; round < kRounds; ++round)
+    {
+        size_t size = kSizes[round % (sizeof(kSizes) / sizeof(kSizes[0]))];
+        trace::StartTracing(size);
+        boost::this_thread::yield();
+        events += CheckTrace(trace::GetTraceJson(), size);
+        trace::ClearTrace();
+        CheckTrace(trace::GetTraceJson(), size);
+    }
+
+    stop = true;
+    threads.join_all();
+    trace::StopTracing();
+    CHECK(events > 0);
+
+    // Cleared buffers stay empty until their threads record again
+    trace::ClearTrace();
+    CHECK(trace::GetTraceJson().find("{\"name\"") == std::string::npos);
+    return 0;
+}
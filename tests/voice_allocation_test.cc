@@ -0,0 +1,115 @@
+// Once warmed up, sending and receiving voice over UDP, tunnelling voice
+// and sending small control messages allocate nothing: not in SendVoice(),
+// SendRawUdpTunnel() or SendMessage() on the caller's thread and not on the
+// network thread. Global operator new counts the allocations of the threads
+// under test.
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+
+#include "allocation_counter.h"
+#include "fake_server.h"
+#include "src/logging.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+const int32_t kWarmupRounds = 500;
+const int32_t kRounds = 2000;
+const int32_t kPacketSize = 60;
+
+void Increment(boost::atomic<int32_t>* count)
+{
+    ++*count;
+}
+
+void ReceiveVoice(boost::atomic<int32_t>* count, int32_t /*length*/, void* /*buffer*/)
+{
+    ++*count;
+}
+
+bool ServerReceived(test::FakeServer* server, uint64_t packets)
+{
+    return server->UdpVoiceReceived() >= packets;
+}
+
+bool ServerReceivedFrames(test::FakeServer* server, int32_t type, uint64_t frames)
+{
+    return server->Frames(type) >= frames;
+}
+
+// Sends one voice packet each way per round, plus a tunnelled packet, a
+// Ping and a UserState to the server, and waits for all of them to arrive.
+// The server echoes the Ping, so its parsing is counted too.
+void Exchange(MumbleClient::MumbleClient* client, test::FakeServer& server, boost::atomic<int32_t>& received, int32_t rounds)
+{
+    std::string packet(kPacketSize, '\x80');
+    MumbleProto::Ping ping;
+    MumbleProto::UserState user_state;
+    user_state.set_session(1);
+    for (int32_t i = 0; i < rounds; ++i)
+    {
+        uint64_t server_expected = server.UdpVoiceReceived() + 1;
+        uint64_t tunnel_expected = server.Frames(PbMessageType::UDPTunnel) + 1;
+        uint64_t ping_expected = server.Frames(PbMessageType::Ping) + 1;
+        uint64_t user_state_expected = server.Frames(PbMessageType::UserState) + 1;
+        int32_t client_expected = received + 1;
+        ping.set_timestamp(i);
+        user_state.set_self_mute(i % 2 == 0);
+
+        test::CountAllocationsOnThisThread(true);
+        client->SendVoice(packet.data(), kPacketSize);
+        client->SendRawUdpTunnel(packet.data(), kPacketSize);
+        client->SendMessage(PbMessageType::Ping, ping, false);
+        client->SendMessage(PbMessageType::UserState, user_state, false);
+        test::CountAllocationsOnThisThread(false);
+        server.SendUdp(packet, 1);
+
+        CHECK(test::WaitUntil(boost::bind(&ServerReceived, &server, server_expected)));
+        CHECK(test::WaitUntil(boost::bind(&ServerReceivedFrames, &server, PbMessageType::UDPTunnel, tunnel_expected)));
+        CHECK(test::WaitUntil(boost::bind(&ServerReceivedFrames, &server, PbMessageType::Ping, ping_expected)));
+        CHECK(test::WaitUntil(boost::bind(&ServerReceivedFrames, &server, PbMessageType::UserState, user_state_expected)));
+        CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &received, client_expected)));
+    }
+}
+
+}  // namespace
+
+int main()
+{
+    if (!test::AllocationCountingSupported())
+    {
+        std::cout << "Allocations are only counted with GCC compatible compilers" << std::endl;
+        return 0;
+    }
+
+    MumbleClientLib::SetLogLevel(logging::LOG_FATAL);
+    test::FakeServer server;
+    test::ClientThread thread;
+    MumbleClient::MumbleClient* client = thread.lib().NewClient();
+
+    boost::atomic<int32_t> authed(0), received(0);
+    client->SetAuthCallback(boost::bind(&Increment, &authed));
+    client->SetUdpVoiceCallback(boost::bind(&ReceiveVoice, &received, _1, _2));
+    client->Connect(server.ClientSettings("allocations"));
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &authed, 1)));
+    CHECK(test::WaitUntil(boost::bind(&MumbleClient::MumbleClient::IsUdpActive, client)));
+
+    thread.io_service().post(boost::bind(&test::CountAllocationsOnThisThread, true));
+    Exchange(client, server, received, kWarmupRounds);
+
+    test::ResetCountedAllocations();
+    Exchange(client, server, received, kRounds);
+    int64_t steady = test::CountedAllocations();
+    thread.io_service().post(boost::bind(&test::CountAllocationsOnThisThread, false));
+
+    std::cout << steady << " allocations in " << kRounds << " rounds" << std::endl;
+    CHECK_EQ(steady, 0);
+
+    thread.Stop();
+    delete client;
+    return 0;
+}
+
@@ -0,0 +1,76 @@
+// SendVoice() with every UDP send buffer taken goes through the TCP tunnel
+// and is counted, instead of being dropped. Once buffers are free again
+// voice goes back to UDP.
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+
+#include "fake_server.h"
+#include "src/logging.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+const int32_t kPacketSize = 60;
+
+void Increment(boost::atomic<int32_t>* count)
+{
+    ++*count;
+}
+
+bool TunnelFrames(test::FakeServer* server, uint64_t frames)
+{
+    return server->Frames(PbMessageType::UDPTunnel) >= frames;
+}
+
+bool UdpVoice(test::FakeServer* server, uint64_t packets)
+{
+    return server->UdpVoiceReceived() >= packets;
+}
+
+}  // namespace
+
+int main()
+{
+    MumbleClientLib::SetLogLevel(logging::LOG_FATAL);
+    test::FakeServer server;
+    test::ClientThread thread;
+    MumbleClient::MumbleClient* client = thread.lib().NewClient();
+
+    boost::atomic<int32_t> authed(0);
+    client->SetAuthCallback(boost::bind(&Increment, &authed));
+    client->Connect(server.ClientSettings("fallback"));
+    CHECK(test::WaitUntil(boost::bind(&test::AtLeast, &authed, 1)));
+    CHECK(test::WaitUntil(boost::bind(&MumbleClient::MumbleClient::IsUdpActive, client)));
+
+    std::string packet(kPacketSize, '\x80');
+    client->SendVoice(packet.data(), kPacketSize);
+    CHECK(test::WaitUntil(boost::bind(&UdpVoice, &server, 1)));
+    CHECK_EQ(server.Frames(PbMessageType::UDPTunnel), 0U);
+
+    std::vector<unsigned char*> taken;
+    while (unsigned char* buffer = client->AcquireUdpBuffer())
+        taken.push_back(buffer);
+    CHECK(!taken.empty());
+
+    client->SendVoice(packet.data(), kPacketSize);
+    client->SendVoice(packet.data(), kPacketSize);
+    CHECK(test::WaitUntil(boost::bind(&TunnelFrames, &server, 2)));
+    CHECK_EQ(client->GetNetworkStats().udp_pool_fallbacks, 2U);
+    CHECK_EQ(client->GetMetrics().network.udp_pool_fallbacks, 2U);
+
+    for (size_t i = 0; i < taken.size(); ++i)
+        client->ReleaseUdpBuffer(taken[i]);
+    client->SendVoice(packet.data(), kPacketSize);
+    CHECK(test::WaitUntil(boost::bind(&UdpVoice, &server, 2)));
+    CHECK_EQ(server.Frames(PbMessageType::UDPTunnel), 2U);
+    CHECK_EQ(client->GetNetworkStats().udp_pool_fallbacks, 2U);
+
+    thread.Stop();
+    delete client;
+    return 0;
+}
@@ -0,0 +1,213 @@
+// Differential fuzzer for the wire decoder. Valid, mutated and random
+// UserState and Ping messages go through both the decoder and libprotobuf;
+// whenever the decoder accepts a message it must read the same fields as
+// protobuf does.
+//
+// wire_decoder_fuzz [iterations] [seed]
+
+#include <cstdlib>
+#include <string>
+
+#include <google/protobuf/stubs/common.h>
+
+#include "src/wire_decoder.h"
+#include "test_util.h"
+
+using namespace MumbleClient;
+
+namespace {
+
+std::string RandomString(test::Random& random)
+{
+    std::string s(random.Below(40), ' ');
+    for (size_t i = 0; i < s.size(); ++i)
+        s[i] = static_cast<char>('a' + random.Below(26));
+    return s;
+}
+
+// Values near the varint length boundaries
+uint32_t RandomUint32(test::Random& random)
+{
+    switch (random.Below(4))
+    {
+    case 0: return random.Below(128);
+    case 1: return random.Below(1 << 14);
+    case 2: return 0xFFFFFFFFU - random.Below(4);
+    default: return static_cast<uint32_t>(random.Next());
+    }
+}
+
+std::string ValidUserState(test::Random& random)
+{
+    MumbleProto::UserState us;
+    if (!random.OneIn(4)) us.set_session(RandomUint32(random));
+    if (random.OneIn(2)) us.set_actor(RandomUint32(random));
+    if (random.OneIn(2)) us.set_name(RandomString(random));
+    if (random.OneIn(3)) us.set_user_id(RandomUint32(random));
+    if (random.OneIn(2)) us.set_channel_id(RandomUint32(random));
+    if (random.OneIn(3)) us.set_mute(random.OneIn(2));
+    if (random.OneIn(3)) us.set_deaf(random.OneIn(2));
+    if (random.OneIn(3)) us.set_suppress(random.OneIn(2));
+    if (random.OneIn(3)) us.set_self_mute(random.OneIn(2));
+    if (random.OneIn(3)) us.set_self_deaf(random.OneIn(2));
+    // Fields the decoder skips
+    if (random.OneIn(4)) us.set_texture(RandomString(random));
+    if (random.OneIn(4)) us.set_plugin_identity(RandomString(random));
+    if (random.OneIn(2)) us.set_comment(RandomString(random));
+    if (random.OneIn(2)) us.set_hash(RandomString(random));
+    if (random.OneIn(4)) us.set_comment_hash(RandomString(random));
+    if (random.OneIn(4)) us.set_priority_speaker(random.OneIn(2));
+    return us.SerializePartialAsString();
+}
+
+std::string ValidPing(test::Random& random)
+{
+    MumbleProto::Ping p;
+    if (!random.OneIn(4)) p.set_timestamp(random.Next() >> random.Below(64));
+    if (random.OneIn(2)) p.set_good(RandomUint32(random));
+    if (random.OneIn(2)) p.set_late(RandomUint32(random));
+    if (random.OneIn(2)) p.set_lost(RandomUint32(random));
+    if (random.OneIn(2)) p.set_resync(RandomUint32(random));
+    if (random.OneIn(3)) p.set_udp_packets(RandomUint32(random));
+    if (random.OneIn(3)) p.set_udp_ping_avg(static_cast<float>(random.Below(1000)) / 7.0f);
+    if (random.OneIn(3)) p.set_tcp_ping_var(static_cast<float>(random.Below(1000)) / 3.0f);
+    return p.SerializePartialAsString();
+}
+
+// A field with any number and wire type, so unknown fields, wrong wire
+// types and groups turn up as well
+void AppendRandomField(test::Random& random, std::string& data)
+{
+    uint32_t number = 1 + random.Below(random.OneIn(4) ? 1000 : 24);
+    uint32_t wire_type = random.Below(8);
+    uint64_t tag = (static_cast<uint64_t>(number) << 3) | wire_type;
+    do {
+        data += static_cast<char>((tag & 0x7F) | (tag > 0x7F ? 0x80 : 0));
+        tag >>= 7;
+    } while (tag);
+
+    size_t length = random.Below(12);
+    if (wire_type == 2)
+        data += static_cast<char>(length);
+    for (size_t i = 0; i < length; ++i)
+        data += static_cast<char>(random.Below(256));
+}
+
+void Mutate(test::Random& random, std::string& data)
+{
+    int mutations = 1 + random.Below(3);
+    for (int m = 0; m < mutations; ++m)
+    {
+        switch (random.Below(5))
+        {
+        case 0:
+            if (!data.empty())
+                data[random.Below(static_cast<uint32_t>(data.size()))] ^= static_cast<char>(1 << random.Below(8));
+            break;
+        case 1:
+            if (!data.empty())
+                data.resize(random.Below(static_cast<uint32_t>(data.size())));
+            break;
+        case 2:
+            data.insert(random.Below(static_cast<uint32_t>(data.size()) + 1), 1, static_cast<char>(random.Below(256)));
+            break;
+        case 3:
+            AppendRandomField(random, data);
+            break;
+        default:
+            // Overlong varint in front of a valid message
+            data.insert(0, "\x88\x80\x80\x80\x00", 5);
+            break;
+        }
+    }
+}
+
+std::string NextInput(test::Random& random, bool user_state)
+{
+    std::string data;
+    switch (random.Below(4))
+    {
+    case 0:
+        return user_state ? ValidUserState(random) : ValidPing(random);
+    case 1:
+        // Repeated fields: the last occurrence wins in both
+        data = user_state ? ValidUserState(random) + ValidUserState(random) : ValidPing(random) + ValidPing(random);
+        return data;
+    case 2:
+        data = user_state ? ValidUserState(random) : ValidPing(random);
+        Mutate(random, data);
+        return data;
+    default:
+        data.resize(random.Below(64));
+        for (size_t i = 0; i < data.size(); ++i)
+            data[i] = static_cast<char>(random.Below(256));
+        return data;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    long iterations = argc > 1 ? std::atol(argv[1]) : 200000;
+    uint64_t seed = argc > 2 ? std::strtoull(argv[2], 0, 10) : 20240613;
+    test::Random random(seed);
+    // Random strings are rarely UTF-8, which protobuf logs for every message
+    google::protobuf::SetLogHandler(0);
+
+    long decoded = 0;
+    long fallbacks = 0;
+    for (long i = 0; i < iterations; ++i)
+    {
+        bool user_state = random.OneIn(2);
+        std::string data = NextInput(random, user_state);
+
+        bool accepted;
+        bool equal = true;
+        bool parsed;
+        if (user_state)
+        {
+            wire_decoder::UserStateView view, expected;
+            accepted = wire_decoder::Decode(data.data(), data.size(), view);
+            MumbleProto::UserState us;
+            parsed = us.ParsePartialFromArray(data.data(), static_cast<int>(data.size()));
+            if (accepted && parsed)
+            {
+                wire_decoder::FromProtobuf(us, expected);
+                equal = wire_decoder::Equal(view, expected);
+            }
+        }
+        else
+        {
+            wire_decoder::PingView view, expected;
+            accepted = wire_decoder::Decode(data.data(), data.size(), view);
+            MumbleProto::Ping p;
+            parsed = p.ParsePartialFromArray(data.data(), static_cast<int>(data.size()));
+            if (accepted && parsed)
+            {
+                wire_decoder::FromProtobuf(p, expected);
+                equal = wire_decoder::Equal(view, expected);
+            }
+        }
+
+        // Rejecting is always allowed, the client then uses protobuf
+        if (accepted && (!parsed || !equal))
+        {
+            std::cerr << "Mismatch on iteration " << i << " (seed " << seed << "), "
+                      << (user_state ? "UserState" : "Ping") << " of " << data.size() << " bytes:";
+            for (size_t b = 0; b < data.size(); ++b)
+                std::cerr << " " << static_cast<int>(static_cast<unsigned char>(data[b]));
+            std::cerr << std::endl;
+            return 1;
+        }
+        if (accepted)
+            ++decoded;
+        else if (parsed)
+            ++fallbacks;
+    }
+
+    std::cout << iterations << " inputs, " << decoded << " decoded, " << fallbacks << " left to protobuf" << std::endl;
+    // The valid half of the inputs must not all fall back
+    CHECK(decoded > iterations / 4);
+    return 0;
+}